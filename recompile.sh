@@ -1,2 +1,2 @@
-x86_64-w64-mingw32-c++ src/main.cpp src/fvm.cpp src/runner.cpp src/compiler/compiler.cpp src/compiler/bytecodeGenerator.cpp src/compiler/parser.cpp src/compiler/lexer/lexer.cpp src/compiler/lexer/token.cpp -o femic.exe
-g++ src/main.cpp src/fvm.cpp src/runner.cpp src/compiler/compiler.cpp src/compiler/bytecodeGenerator.cpp src/compiler/parser.cpp src/compiler/lexer/lexer.cpp src/compiler/lexer/token.cpp -o femic.out
+x86_64-w64-mingw32-c++ src/main.cpp src/fvm.cpp src/gc.cpp src/builtins.cpp src/persistent.cpp src/profiler.cpp src/jit.cpp src/fiber.cpp src/channel.cpp src/generator.cpp src/parallel.cpp src/simd.cpp src/typedArray.cpp src/bytecodeFile.cpp src/runner.cpp src/compiler/compiler.cpp src/compiler/bytecodeGenerator.cpp src/compiler/cppEmitter.cpp src/compiler/parser.cpp src/compiler/lexer/lexer.cpp src/compiler/lexer/token.cpp -o femic.exe
+g++ src/main.cpp src/fvm.cpp src/gc.cpp src/builtins.cpp src/persistent.cpp src/profiler.cpp src/jit.cpp src/fiber.cpp src/channel.cpp src/generator.cpp src/parallel.cpp src/simd.cpp src/typedArray.cpp src/bytecodeFile.cpp src/runner.cpp src/compiler/compiler.cpp src/compiler/bytecodeGenerator.cpp src/compiler/cppEmitter.cpp src/compiler/parser.cpp src/compiler/lexer/lexer.cpp src/compiler/lexer/token.cpp -o femic.out
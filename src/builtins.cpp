@@ -0,0 +1,128 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <math.h>
+
+#include "include/builtins.h"
+#include "include/persistent.h"
+#include "include/fiber.h"
+#include "include/channel.h"
+#include "include/generator.h"
+#include "include/parallel.h"
+#include "include/typedArray.h"
+
+using namespace std;
+
+void defineNative(shared_ptr<Scope> scope, string id, int argsNum, function<shared_ptr<InstructionOperrand>(FVM*, vector<shared_ptr<InstructionOperrand>>)> native) {
+    scope->members[id] = ScopeMember(makePooled<InstructionNativeFunctionOperrand>(id, argsNum, native));
+}
+
+shared_ptr<InstructionOperrand> with(shared_ptr<InstructionOperrand> collection, shared_ptr<InstructionOperrand> key, shared_ptr<InstructionOperrand> value) {
+    if (auto array = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(collection)) {
+        auto index = dynamic_pointer_cast<InstructionNumberOperrand>(key);
+        if (!index || index->tag != TAG_INT || index->operrand < 0) throw runtime_error("FVM: with() FOR FROZEN ARRAY EXPECTED INTEGER INDEX");
+
+        shared_ptr<InstructionOperrand> frozen = freeze(value);
+
+        return makePooled<InstructionFrozenArrayOperrand>(array->operrand.set(index->operrand, frozen), array->containsReferences || frozen->hasReferences());
+    } else if (auto object = dynamic_pointer_cast<InstructionFrozenObjectOperrand>(collection)) {
+        auto field = dynamic_pointer_cast<InstructionStringOperrand>(key);
+        if (!field) throw runtime_error("FVM: with() FOR FROZEN OBJECT EXPECTED STRING KEY");
+
+        shared_ptr<InstructionOperrand> frozen = freeze(value);
+
+        return makePooled<InstructionFrozenObjectOperrand>(object->operrand.set(string(field->text()), frozen), object->containsReferences || frozen->hasReferences());
+    }
+
+    throw runtime_error("FVM: with() EXPECTED FROZEN COLLECTION, USE freeze() FIRST");
+}
+
+void registerBuiltins(shared_ptr<Scope> scope) {
+    defineNative(scope, "freeze", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return freeze(args.at(0));
+    });
+
+    defineNative(scope, "with", 3, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return with(args.at(0), args.at(1), args.at(2));
+    });
+
+    defineNative(scope, "spawn", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return spawnFiber(vm, args.at(0));
+    });
+
+    defineNative(scope, "join", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return joinFiber(vm, args.at(0));
+    });
+
+    defineNative(scope, "channel", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return makeChannel(args.at(0));
+    });
+
+    defineNative(scope, "send", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return sendChannel(vm, args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "recv", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return recvChannel(vm, args.at(0));
+    });
+
+    defineNative(scope, "close", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return closeChannel(vm, args.at(0));
+    });
+
+    defineNative(scope, "parallel_map", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return parallelMap(vm, args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "parallel_reduce", 3, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return parallelReduce(vm, args.at(0), args.at(1), args.at(2));
+    });
+
+    defineNative(scope, "range", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return makeRange(vm, args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "next", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return nextValue(args.at(0));
+    });
+
+    defineNative(scope, "slice", 3, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return sliceString(args.at(0), args.at(1), args.at(2));
+    });
+
+    defineNative(scope, "Float64Array", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return makeFloat64Array(args.at(0));
+    });
+
+    defineNative(scope, "Int64Array", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return makeInt64Array(args.at(0));
+    });
+
+    defineNative(scope, "sum", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedSum(args.at(0));
+    });
+
+    defineNative(scope, "min", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedMin(args.at(0));
+    });
+
+    defineNative(scope, "max", 1, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedMax(args.at(0));
+    });
+
+    defineNative(scope, "dot", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedDot(args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "add", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedAdd(args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "scale", 2, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedScale(args.at(0), args.at(1));
+    });
+
+    defineNative(scope, "compare", 3, [](FVM* vm, vector<shared_ptr<InstructionOperrand>> args) {
+        return typedCompare(args.at(0), args.at(1), args.at(2));
+    });
+}
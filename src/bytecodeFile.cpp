@@ -0,0 +1,459 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <map>
+
+#include "include/bytecodeFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FEMIRA_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+enum BytecodeOperrandKind : uint8_t {
+    OPERRAND_NULL,
+    OPERRAND_NUMBER,
+    OPERRAND_STRING,
+    OPERRAND_BOOL,
+    OPERRAND_ARRAY,
+    OPERRAND_OBJECT,
+    OPERRAND_SHAPE,
+    OPERRAND_CONSTANT,
+    OPERRAND_FUNCTION,
+};
+
+uint64_t fnv1a(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+class BytecodeWriter {
+    public:
+        string payload;
+
+        // function -> index in function table, in order they are written
+        map<FuncDeclaration*, uint32_t> indexes;
+        vector<shared_ptr<FuncDeclaration>> functions;
+
+        template <typename T>
+        void value(T value) { payload.append(reinterpret_cast<const char*>(&value), sizeof(T)); };
+
+        void text(const string& text) {
+            value<uint32_t>(text.size());
+            payload += text;
+        }
+
+        uint32_t function(shared_ptr<FuncDeclaration> declaration) {
+            auto known = indexes.find(declaration.get());
+            if (known != indexes.end()) return known->second;
+
+            uint32_t index = functions.size();
+            indexes[declaration.get()] = index;
+            functions.push_back(declaration);
+
+            return index;
+        }
+
+        void code(const vector<Instruction>& bytecode) {
+            value<uint32_t>(bytecode.size());
+
+            // header is 32 bytes, so offset in payload keeps alignment of file
+            while (payload.size() % alignof(Instruction) != 0) payload += '\0';
+
+            payload.append(reinterpret_cast<const char*>(bytecode.data()), bytecode.size() * sizeof(Instruction));
+        }
+
+        void operrand(shared_ptr<InstructionOperrand> operrand) {
+            if (auto number = dynamic_pointer_cast<InstructionNumberOperrand>(operrand)) {
+                value(OPERRAND_NUMBER);
+                value(number->operrand);
+            } else if (auto str = dynamic_pointer_cast<InstructionStringOperrand>(operrand)) {
+                value(OPERRAND_STRING);
+                text(str->tostring());
+            } else if (auto boolean = dynamic_pointer_cast<InstructionBoolOperrand>(operrand)) {
+                value(OPERRAND_BOOL);
+                value<uint8_t>(boolean->operrand);
+            } else if (dynamic_pointer_cast<InstructionNullOperrand>(operrand)) {
+                value(OPERRAND_NULL);
+            } else if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(operrand)) {
+                value(OPERRAND_ARRAY);
+                value<uint32_t>(array->operrand->size());
+
+                for (shared_ptr<InstructionOperrand>& element: *array->operrand) this->operrand(element);
+            } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(operrand)) {
+                value(OPERRAND_OBJECT);
+                value<uint32_t>(object->operrand->size());
+
+                for (auto& field: *object->operrand) {
+                    text(field.first);
+                    this->operrand(field.second);
+                }
+            } else if (auto shape = dynamic_pointer_cast<InstructionShapeOperrand>(operrand)) {
+                value(OPERRAND_SHAPE);
+                value<uint32_t>(shape->operrand.size());
+
+                for (string& key: shape->operrand) text(key);
+            } else if (auto constant = dynamic_pointer_cast<InstructionConstantOperrand>(operrand)) {
+                value(OPERRAND_CONSTANT);
+                value<int32_t>(constant->index);
+                value<uint8_t>(constant->isFlat);
+                this->operrand(constant->operrand);
+            } else if (auto func = dynamic_pointer_cast<InstructionFunctionOperrand>(operrand)) {
+                value(OPERRAND_FUNCTION);
+                value<uint32_t>(function(func->operrand));
+            } else throw runtime_error("Compile error! Operrand " + operrand->tostring() + " cannot be written to bytecode file");
+        }
+
+        void declaration(FuncDeclaration* declaration) {
+            declaration->compileBody();
+
+            text(declaration->id);
+            value<uint8_t>(declaration->isLambda);
+            value<uint8_t>(declaration->isGenerator);
+
+            value<uint32_t>(declaration->argsIds.size());
+            for (string& arg: declaration->argsIds) text(arg);
+
+            value<uint32_t>(declaration->upvalues.size());
+
+            for (UpvalueDescriptor& upvalue: declaration->upvalues) {
+                text(upvalue.id);
+                value<uint8_t>(upvalue.fromParent);
+                value<uint32_t>(upvalue.index);
+                value<uint8_t>(upvalue.isMutable);
+                value<uint8_t>(upvalue.isSelf);
+            }
+
+            CodeTables& tables = *declaration->tables;
+
+            value<uint32_t>(tables.constants.size());
+
+            for (size_t i = 0; i < tables.constants.size(); ++i) {
+                operrand(tables.constants[i]);
+
+                const AllocationSite* site = tables.sites[i];
+                value<uint8_t>(site != nullptr);
+
+                if (site) {
+                    text(site->file);
+                    value<int32_t>(site->line);
+                }
+            }
+
+            value<uint32_t>(tables.names.size());
+            for (string& name: tables.names) text(name);
+
+            value<uint32_t>(tables.branches.size());
+
+            for (IfStatement& statement: tables.branches) {
+                code(statement.bytecode);
+                code(statement.elseBytecode);
+            }
+
+            code(declaration->bytecode);
+        }
+};
+
+void writeBytecodeFile(ostream& out, shared_ptr<FuncDeclaration> program, const vector<string>& imports) {
+    BytecodeWriter writer;
+    writer.function(program);
+
+    writer.value<uint32_t>(imports.size());
+    for (const string& path: imports) writer.text(path);
+
+    // functions found in constants are appended to table while it is written
+    for (size_t i = 0; i < writer.functions.size(); ++i) writer.declaration(writer.functions[i].get());
+
+    BytecodeHeader header;
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version = BYTECODE_VERSION;
+    header.opcodes = F_OPCODES_COUNT;
+    header.functions = writer.functions.size();
+    header.payloadSize = writer.payload.size();
+    header.checksum = fnv1a(writer.payload.data(), writer.payload.size());
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(writer.payload.data(), writer.payload.size());
+}
+
+// read only view of whole file, mapped where mmap exists
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    string buffer;
+    bool mapped = false;
+
+    MappedFile(string path) {
+#ifdef FEMIRA_MMAP
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) throw runtime_error("FVM: CANNOT OPEN " + path);
+
+        struct stat info;
+
+        if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+            void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+            if (memory != MAP_FAILED) {
+                data = static_cast<const char*>(memory);
+                size = info.st_size;
+                mapped = true;
+            }
+        }
+
+        close(descriptor);
+
+        if (mapped) return;
+#endif
+        ifstream file(path, ios::binary);
+        if (!file) throw runtime_error("FVM: CANNOT OPEN " + path);
+
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+        data = buffer.data();
+        size = buffer.size();
+    }
+
+    ~MappedFile() {
+#ifdef FEMIRA_MMAP
+        if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+    }
+};
+
+class BytecodeReader {
+    public:
+        const char* data;
+        size_t size;
+        size_t offset = 0;
+
+        vector<shared_ptr<FuncDeclaration>> functions;
+
+        BytecodeReader(const char* data, size_t size) { this->data = data; this->size = size; };
+
+        const char* take(size_t bytes) {
+            if (bytes > size - offset) throw runtime_error("FVM: BYTECODE FILE IS TRUNCATED");
+
+            const char* position = data + offset;
+            offset += bytes;
+
+            return position;
+        }
+
+        template <typename T>
+        T value() {
+            T value;
+            memcpy(&value, take(sizeof(T)), sizeof(T));
+
+            return value;
+        }
+
+        string text() {
+            uint32_t length = value<uint32_t>();
+            return string(take(length), length);
+        }
+
+        vector<Instruction> code() {
+            uint32_t count = value<uint32_t>();
+
+            while (offset % alignof(Instruction) != 0) take(1);
+
+            if (count > (size - offset) / sizeof(Instruction)) throw runtime_error("FVM: BYTECODE FILE IS TRUNCATED");
+
+            const Instruction* words = reinterpret_cast<const Instruction*>(take(count * sizeof(Instruction)));
+
+            return vector<Instruction>(words, words + count);
+        }
+
+        // checksum finds only damaged files, stale or hand made one could still send VM outside of tables
+        void checkCode(const vector<Instruction>& bytecode, FuncDeclaration* declaration) {
+            CodeTables& tables = *declaration->tables;
+
+            for (const Instruction& instruction: bytecode) {
+                if (instruction.code() >= F_OPCODES_COUNT) throw runtime_error("FVM: BYTECODE FILE HAS UNKNOWN OPCODE");
+
+                size_t limit;
+
+                switch (argumentKind(instruction.code())) {
+                    case ARGUMENT_CONSTANT: limit = tables.constants.size(); break;
+                    case ARGUMENT_NAME: limit = tables.names.size(); break;
+                    case ARGUMENT_BRANCH: limit = tables.branches.size(); break;
+                    case ARGUMENT_IMMEDIATE: limit = declaration->upvalues.size(); break;
+                    default: continue;
+                }
+
+                if (instruction.argument() >= limit) {
+                    throw runtime_error("FVM: BYTECODE FILE REFERS OUTSIDE OF TABLES (" + opcodeToString(instruction.code()) + " " + to_string(instruction.argument()) + ")");
+                }
+            }
+        }
+
+        shared_ptr<InstructionOperrand> operrand() {
+            BytecodeOperrandKind kind = BytecodeOperrandKind(value<uint8_t>());
+
+            switch (kind) {
+                case OPERRAND_NULL: return nullOperrand();
+                case OPERRAND_NUMBER: return make_shared<InstructionNumberOperrand>(value<double>());
+                case OPERRAND_STRING: return make_shared<InstructionStringOperrand>(text());
+                case OPERRAND_BOOL: return boolOperrand(value<uint8_t>() != 0);
+                case OPERRAND_ARRAY:
+                    {
+                        uint32_t count = value<uint32_t>();
+                        shared_ptr<OperrandVector> elements = make_shared<OperrandVector>();
+
+                        for (uint32_t i = 0; i < count; ++i) elements->push_back(operrand());
+
+                        return make_shared<InstructionArrayOperrand>(elements);
+                    }
+                case OPERRAND_OBJECT:
+                    {
+                        uint32_t count = value<uint32_t>();
+                        shared_ptr<OperrandMap> fields = make_shared<OperrandMap>();
+
+                        for (uint32_t i = 0; i < count; ++i) {
+                            string key = text();
+                            (*fields)[key] = operrand();
+                        }
+
+                        return make_shared<InstructionObjectOperrand>(fields);
+                    }
+                case OPERRAND_SHAPE:
+                    {
+                        uint32_t count = value<uint32_t>();
+                        vector<string> keys;
+
+                        for (uint32_t i = 0; i < count; ++i) keys.push_back(text());
+
+                        return make_shared<InstructionShapeOperrand>(keys);
+                    }
+                case OPERRAND_CONSTANT:
+                    {
+                        int32_t index = value<int32_t>();
+                        bool isFlat = value<uint8_t>() != 0;
+
+                        return make_shared<InstructionConstantOperrand>(operrand(), index, isFlat);
+                    }
+                case OPERRAND_FUNCTION:
+                    {
+                        uint32_t index = value<uint32_t>();
+                        if (index >= functions.size()) throw runtime_error("FVM: BYTECODE FILE REFERS TO UNKNOWN FUNCTION");
+
+                        return make_shared<InstructionFunctionOperrand>(functions[index]);
+                    }
+            }
+
+            throw runtime_error("FVM: UNKNOWN OPERRAND IN BYTECODE FILE");
+        }
+
+        void declaration(FuncDeclaration* declaration) {
+            declaration->id = text();
+            declaration->isLambda = value<uint8_t>() != 0;
+            declaration->isGenerator = value<uint8_t>() != 0;
+
+            uint32_t argsNum = value<uint32_t>();
+            for (uint32_t i = 0; i < argsNum; ++i) declaration->argsIds.push_back(text());
+
+            uint32_t upvaluesNum = value<uint32_t>();
+
+            for (uint32_t i = 0; i < upvaluesNum; ++i) {
+                UpvalueDescriptor upvalue;
+                upvalue.id = text();
+                upvalue.fromParent = value<uint8_t>() != 0;
+                upvalue.index = value<uint32_t>();
+                upvalue.isMutable = value<uint8_t>() != 0;
+                upvalue.isSelf = value<uint8_t>() != 0;
+
+                declaration->upvalues.push_back(upvalue);
+            }
+
+            declaration->tables = make_shared<CodeTables>();
+            CodeTables& tables = *declaration->tables;
+
+            uint32_t constantsNum = value<uint32_t>();
+
+            for (uint32_t i = 0; i < constantsNum; ++i) {
+                tables.constants.push_back(operrand());
+
+                const AllocationSite* site = nullptr;
+
+                if (value<uint8_t>()) {
+                    string file = text();
+                    site = internAllocationSite(file, value<int32_t>());
+                }
+
+                tables.sites.push_back(site);
+            }
+
+            uint32_t namesNum = value<uint32_t>();
+            for (uint32_t i = 0; i < namesNum; ++i) tables.names.push_back(text());
+
+            uint32_t branchesNum = value<uint32_t>();
+
+            for (uint32_t i = 0; i < branchesNum; ++i) {
+                vector<Instruction> bytecode = code();
+                tables.branches.push_back(IfStatement(bytecode, code()));
+            }
+
+            declaration->bytecode = code();
+
+            checkCode(declaration->bytecode, declaration);
+
+            for (IfStatement& branch: tables.branches) {
+                checkCode(branch.bytecode, declaration);
+                checkCode(branch.elseBytecode, declaration);
+            }
+        }
+};
+
+bool isBytecodeFile(string path) {
+    ifstream file(path, ios::binary);
+
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+
+    return file && memcmp(magic, BYTECODE_MAGIC, sizeof(magic)) == 0;
+}
+
+shared_ptr<FuncDeclaration> loadBytecodeFile(string path, vector<string>* imports) {
+    MappedFile file(path);
+
+    BytecodeHeader header;
+    if (file.size < sizeof(header)) throw runtime_error("FVM: BYTECODE FILE IS TRUNCATED");
+
+    memcpy(&header, file.data, sizeof(header));
+
+    if (memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0) throw runtime_error("FVM: " + path + " IS NOT A BYTECODE FILE");
+    if (header.version != BYTECODE_VERSION || header.opcodes != F_OPCODES_COUNT) throw runtime_error("FVM: BYTECODE FILE IS WRITTEN BY OTHER VERSION OF FEMIC, COMPILE IT AGAIN");
+    if (header.payloadSize != file.size - sizeof(header)) throw runtime_error("FVM: BYTECODE FILE IS TRUNCATED");
+
+    const char* payload = file.data + sizeof(header);
+    if (fnv1a(payload, header.payloadSize) != header.checksum) throw runtime_error("FVM: BYTECODE FILE CHECKSUM MISMATCH");
+
+    if (header.functions == 0) throw runtime_error("FVM: BYTECODE FILE HAS NO PROGRAM");
+
+    BytecodeReader reader(payload, header.payloadSize);
+
+    uint32_t importsNum = reader.value<uint32_t>();
+
+    for (uint32_t i = 0; i < importsNum; ++i) {
+        string module = reader.text();
+        if (imports) imports->push_back(module);
+    }
+
+    // functions can refer to each other, declarations exist before any of them is read
+    for (uint32_t i = 0; i < header.functions; ++i) reader.functions.push_back(make_shared<FuncDeclaration>());
+    for (shared_ptr<FuncDeclaration>& declaration: reader.functions) reader.declaration(declaration.get());
+
+    return reader.functions.front();
+}
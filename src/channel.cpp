@@ -0,0 +1,175 @@
+#include <algorithm>
+
+#include "include/channel.h"
+#include "include/fiber.h"
+
+using namespace std;
+
+Channel::Channel(size_t capacity) {
+    this->capacity = capacity;
+
+    if (capacity == 0) return;
+
+    slotsCount = max(capacity, (size_t) 2);
+
+    slots = make_unique<Slot[]>(slotsCount);
+    for (size_t i = 0; i < slotsCount; ++i) slots[i].sequence.store(i, memory_order_relaxed);
+}
+
+bool Channel::trySend(shared_ptr<InstructionOperrand> value) {
+    if (capacity == 0) {
+        lock_guard<mutex> guard(lock);
+        values.push_back(value);
+
+        return true;
+    }
+
+    size_t position = tail.load(memory_order_relaxed);
+    Slot* slot;
+
+    while (true) {
+        // head only grows, so channel is at most as full as it looks here when position is taken
+        if (position >= head.load(memory_order_acquire) + capacity) return false;
+
+        slot = &slots[position % slotsCount];
+
+        // sequence == position - slot is free for this position, less - receiver did not take value of previous round yet
+        intptr_t difference = (intptr_t) slot->sequence.load(memory_order_acquire) - (intptr_t) position;
+
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+
+    slot->value = value;
+    slot->sequence.store(position + 1, memory_order_release);
+
+    return true;
+}
+
+bool Channel::tryRecv(shared_ptr<InstructionOperrand>& value) {
+    if (capacity == 0) {
+        lock_guard<mutex> guard(lock);
+        if (values.empty()) return false;
+
+        value = values.front();
+        values.pop_front();
+
+        return true;
+    }
+
+    size_t position = head.load(memory_order_relaxed);
+    Slot* slot;
+
+    while (true) {
+        slot = &slots[position % slotsCount];
+
+        // sequence == position + 1 - value is written, less - sender did not write it yet
+        intptr_t difference = (intptr_t) slot->sequence.load(memory_order_acquire) - (intptr_t) (position + 1);
+
+        if (difference == 0) {
+            if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = head.load(memory_order_relaxed);
+        }
+    }
+
+    value = slot->value;
+    slot->value = nullptr;
+    slot->sequence.store(position + slotsCount, memory_order_release);
+
+    return true;
+}
+
+shared_ptr<Channel> channelOf(shared_ptr<InstructionOperrand> value, string name) {
+    auto channel = dynamic_pointer_cast<InstructionChannelOperrand>(value);
+    if (!channel) throw runtime_error("FVM: " + name + "() EXPECTED CHANNEL");
+
+    return channel->operrand;
+}
+
+// wakes fibers which sleep in send/recv of channel
+void wakeWaiting(FVM* vm, Channel* channel) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (channel->waiting.load() > 0 && vm->fibers) vm->fibers->notify(channel->waiters);
+}
+
+// nothing else can change channel when program has no fibers
+void waitChannel(FVM* vm, Channel* channel, string name, function<bool()> ready) {
+    if (!vm->fibers) throw runtime_error("FVM: " + name + "() WOULD WAIT FOREVER, NO FIBERS ARE RUNNING");
+
+    channel->waiting++;
+    atomic_thread_fence(memory_order_seq_cst);
+
+    vm->fibers->block(ready, channel->waiters);
+    channel->waiting--;
+}
+
+shared_ptr<InstructionOperrand> makeChannel(shared_ptr<InstructionOperrand> capacity) {
+    auto number = dynamic_pointer_cast<InstructionNumberOperrand>(capacity);
+    if (!number || number->tag != TAG_INT || number->operrand < 0) throw runtime_error("FVM: channel() EXPECTED NON-NEGATIVE INTEGER CAPACITY");
+
+    return makePooled<InstructionChannelOperrand>(make_shared<Channel>((size_t) number->operrand));
+}
+
+shared_ptr<InstructionOperrand> sendChannel(FVM* vm, shared_ptr<InstructionOperrand> value, shared_ptr<InstructionOperrand> message) {
+    shared_ptr<Channel> channel = channelOf(value, "send");
+    if (channel->isClosed()) throw runtime_error("FVM: send() TO CLOSED CHANNEL");
+
+    // receiver gets its own copy, sender can change value after send
+    FiberCopies copies;
+    shared_ptr<InstructionOperrand> copy = transfer(message, nullptr, copies);
+
+    bool sent = channel->trySend(copy);
+
+    if (!sent) {
+        waitChannel(vm, channel.get(), "send", [&]() { return sent || (sent = channel->trySend(copy)) || channel->isClosed(); });
+
+        if (!sent) throw runtime_error("FVM: send() TO CLOSED CHANNEL");
+    }
+
+    wakeWaiting(vm, channel.get());
+
+    return nullOperrand();
+}
+
+shared_ptr<InstructionOperrand> recvChannel(FVM* vm, shared_ptr<InstructionOperrand> value) {
+    shared_ptr<Channel> channel = channelOf(value, "recv");
+
+    shared_ptr<InstructionOperrand> message;
+    bool received = channel->tryRecv(message);
+
+    if (!received) {
+        // values sent before close are still received
+        auto ready = [&]() {
+            if (received) return true;
+            bool closed = channel->isClosed();
+
+            return (received = channel->tryRecv(message)) || closed;
+        };
+
+        if (!ready()) waitChannel(vm, channel.get(), "recv", ready);
+        if (!received) return nullOperrand();
+    }
+
+    wakeWaiting(vm, channel.get());
+    adopt(message, vm);
+
+    return message;
+}
+
+shared_ptr<InstructionOperrand> closeChannel(FVM* vm, shared_ptr<InstructionOperrand> value) {
+    shared_ptr<Channel> channel = channelOf(value, "close");
+
+    channel->close();
+    wakeWaiting(vm, channel.get());
+
+    return nullOperrand();
+}
@@ -7,32 +7,478 @@
 #include "include/parser.h"
 #include "../include/fvm.h"
 #include "include/bytecodeGenerator.h"
-#include "include/compiler.h"
 
-string readFile(string path) {
-    ifstream file(path);
+using namespace std;
+
+void collectAssignments(AstNode* node, map<string, int>& assignments) {
+    if (BlockNode* block = dynamic_cast<BlockNode*>(node)) {
+        for (AstNode* node: block->nodes) collectAssignments(node, assignments);
+    } else if (AssignmentNode* assignment = dynamic_cast<AssignmentNode*>(node)) {
+        if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(assignment->id)) assignments[identifier->token->value]++;
+    } else if (FnDefineNode* fnDefine = dynamic_cast<FnDefineNode*>(node)) {
+        if (!fnDefine->isLambda) assignments[fnDefine->id->token->value]++;
+    } else if (IfStatementNode* ifStatement = dynamic_cast<IfStatementNode*>(node)) {
+        collectAssignments(ifStatement->block, assignments);
+        if (ifStatement->elseBlock) collectAssignments(ifStatement->elseBlock, assignments);
+    } else if (ForInNode* forIn = dynamic_cast<ForInNode*>(node)) {
+        // loop variable is assigned on every iteration
+        assignments[forIn->id->token->value] += 2;
+        collectAssignments(forIn->block, assignments);
+    }
+}
 
-    string code;
-    string line;
+// assignments made by functions nested anywhere in node (args of nested function are its own), so variable
+// written by any closure is mutable in its owner and every capture of it shares one cell
+void collectNestedAssignments(AstNode* node, map<string, int>& assignments) {
+    if (node == nullptr) return;
+
+    if (BlockNode* block = dynamic_cast<BlockNode*>(node)) {
+        for (AstNode* node: block->nodes) collectNestedAssignments(node, assignments);
+    } else if (FnDefineNode* fnDefine = dynamic_cast<FnDefineNode*>(node)) {
+        map<string, int> nested;
+        collectAssignments(fnDefine->block, nested);
+        collectNestedAssignments(fnDefine->block, nested);
+
+        for (AstNode* arg: fnDefine->args->nodes) {
+            if (IdentifierNode* id = dynamic_cast<IdentifierNode*>(arg)) nested.erase(id->token->value);
+        }
 
-    while (getline(file, line)) {
-        code += line + "\n";
+        for (pair<string, int> assignment: nested) assignments[assignment.first] += assignment.second;
+    } else if (AssignmentNode* assignment = dynamic_cast<AssignmentNode*>(node)) {
+        collectNestedAssignments(assignment->id, assignments);
+        collectNestedAssignments(assignment->value, assignments);
+    } else if (ObjectNode* object = dynamic_cast<ObjectNode*>(node)) {
+        for (pair<AstNode*, AstNode*> field: object->fields) collectNestedAssignments(field.second, assignments);
+    } else if (UnaryOperationNode* unary = dynamic_cast<UnaryOperationNode*>(node)) {
+        collectNestedAssignments(unary->operrand, assignments);
+    } else if (BinaryOperationNode* binary = dynamic_cast<BinaryOperationNode*>(node)) {
+        collectNestedAssignments(binary->left, assignments);
+        collectNestedAssignments(binary->right, assignments);
+    } else if (ConditionNode* condition = dynamic_cast<ConditionNode*>(node)) {
+        collectNestedAssignments(condition->left, assignments);
+        collectNestedAssignments(condition->right, assignments);
+    } else if (IfStatementNode* ifStatement = dynamic_cast<IfStatementNode*>(node)) {
+        collectNestedAssignments(ifStatement->condition, assignments);
+        collectNestedAssignments(ifStatement->block, assignments);
+        collectNestedAssignments(ifStatement->elseBlock, assignments);
+    } else if (ForInNode* forIn = dynamic_cast<ForInNode*>(node)) {
+        collectNestedAssignments(forIn->iterable, assignments);
+        collectNestedAssignments(forIn->block, assignments);
+    } else if (ParenthisizedNode* parenthisized = dynamic_cast<ParenthisizedNode*>(node)) {
+        collectNestedAssignments(parenthisized->wrapped, assignments);
+    } else if (CallNode* call = dynamic_cast<CallNode*>(node)) {
+        for (AstNode* arg: call->args->nodes) collectNestedAssignments(arg, assignments);
+        collectNestedAssignments(call->calling, assignments);
+    } else if (ArrayNode* array = dynamic_cast<ArrayNode*>(node)) {
+        for (AstNode* element: array->elements) collectNestedAssignments(element, assignments);
+    } else if (IndexationNode* indexation = dynamic_cast<IndexationNode*>(node)) {
+        collectNestedAssignments(indexation->where, assignments);
+        collectNestedAssignments(indexation->index, assignments);
     }
+}
 
-    file.close();
+// function with yield in its own body (not in nested functions) is generator
+bool containsYield(AstNode* node) {
+    if (BlockNode* block = dynamic_cast<BlockNode*>(node)) {
+        for (AstNode* node: block->nodes) if (containsYield(node)) return true;
+    } else if (UnaryOperationNode* unary = dynamic_cast<UnaryOperationNode*>(node)) {
+        return unary->operatorToken->getType() == YIELD || containsYield(unary->operrand);
+    } else if (IfStatementNode* ifStatement = dynamic_cast<IfStatementNode*>(node)) {
+        return containsYield(ifStatement->block) || (ifStatement->elseBlock && containsYield(ifStatement->elseBlock));
+    } else if (ForInNode* forIn = dynamic_cast<ForInNode*>(node)) {
+        return containsYield(forIn->block);
+    }
 
-    return code;
+    return false;
 }
 
-using namespace std;
+// canonical text of literal made only from constants, empty string if node is not constant
+string getConstantKey(AstNode* node) {
+    if (LiteralNode* literal = dynamic_cast<LiteralNode*>(node)) {
+        string value = literal->token->value;
+        return to_string(literal->token->getType()) + ":" + to_string(value.size()) + ":" + value;
+    } else if (ArrayNode* array = dynamic_cast<ArrayNode*>(node)) {
+        string key = "[";
+
+        for (AstNode* element: array->elements) {
+            string elementKey = getConstantKey(element);
+            if (elementKey.empty()) return "";
+
+            key += elementKey + ",";
+        }
+
+        return key + "]";
+    } else if (ObjectNode* object = dynamic_cast<ObjectNode*>(node)) {
+        map<string, string> fields;
+
+        for (pair<AstNode*, AstNode*> field: object->fields) {
+            IdentifierNode* id = dynamic_cast<IdentifierNode*>(field.first);
+            if (!id) return "";
+
+            string valueKey = getConstantKey(field.second);
+            if (valueKey.empty()) return "";
+
+            fields[id->token->value] = valueKey;
+        }
+
+        string key = "{";
+
+        for (pair<string, string> field: fields) {
+            key += to_string(field.first.size()) + ":" + field.first + "=" + field.second + ",";
+        }
+
+        return key + "}";
+    }
+
+    return "";
+}
+
+BytecodeGenerator::BytecodeGenerator(BlockNode* root, string path) {
+    this->root = root;
+    this->path = path;
+    this->context = nullptr;
+    this->globals = make_shared<map<string, int>>();
+    this->constants = make_shared<ConstantPool>();
+    this->tables = make_shared<CodeTablesBuilder>();
+    this->imports = make_shared<vector<string>>();
+
+    collectAssignments(root, *globals);
+
+    map<string, int> nested;
+    collectNestedAssignments(root, nested);
+
+    for (pair<string, int> assignment: nested) {
+        if (globals->find(assignment.first) != globals->end()) (*globals)[assignment.first] += assignment.second;
+    }
+}
 
-BytecodeGenerator::BytecodeGenerator(BlockNode* root) {
+BytecodeGenerator::BytecodeGenerator(BlockNode* root, FunctionContext* context, shared_ptr<map<string, int>> globals, shared_ptr<ConstantPool> constants, shared_ptr<CodeTablesBuilder> tables) {
     this->root = root;
+    this->context = context;
+    this->globals = globals;
+    this->constants = constants;
+    this->tables = tables;
+}
+
+const AllocationSite* BytecodeGenerator::getSite(Token* token) {
+    return internAllocationSite(path, token->line);
+}
+
+// argument of instruction has 24 bits
+uint32_t checkArgument(size_t index, string table) {
+    if (index > MAX_ARGUMENT) throw runtime_error("Compile error! Too many " + table + " in one function");
+
+    return index;
+}
+
+uint32_t BytecodeGenerator::addConstant(shared_ptr<InstructionOperrand> operrand, const AllocationSite* site) {
+    CodeTables& codeTables = *tables->tables;
+
+    uint32_t index = checkArgument(codeTables.constants.size(), "constants");
+
+    codeTables.constants.push_back(operrand);
+    codeTables.sites.push_back(site);
+
+    return index;
+}
+
+uint32_t BytecodeGenerator::addLiteral(LiteralNode* literal) {
+    string key = getConstantKey(literal);
+
+    auto entry = tables->literals.find(key);
+    if (entry != tables->literals.end()) return entry->second;
+
+    uint32_t index = addConstant(getOperrandFromNode(literal));
+    tables->literals[key] = index;
+
+    return index;
+}
+
+uint32_t BytecodeGenerator::addName(string id) {
+    auto entry = tables->names.find(id);
+    if (entry != tables->names.end()) return entry->second;
+
+    CodeTables& codeTables = *tables->tables;
+
+    uint32_t index = checkArgument(codeTables.names.size(), "variables");
+
+    codeTables.names.push_back(id);
+    tables->names[id] = index;
+
+    return index;
+}
+
+uint32_t BytecodeGenerator::addBranch(IfStatement statement) {
+    CodeTables& codeTables = *tables->tables;
+
+    uint32_t index = checkArgument(codeTables.branches.size(), "if statements");
+
+    codeTables.branches.push_back(statement);
+
+    return index;
+}
+
+shared_ptr<InstructionConstantOperrand> BytecodeGenerator::getConstant(AstNode* node) {
+    string key = getConstantKey(node);
+    if (key.empty()) return nullptr;
+
+    auto entry = constants->entries.find(key);
+    if (entry != constants->entries.end()) return entry->second;
+
+    shared_ptr<InstructionOperrand> value = getOperrandFromNode(node);
+
+    bool isFlat = true;
+
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) {
+        for (shared_ptr<InstructionOperrand> element: *array->operrand) {
+            if (dynamic_pointer_cast<InstructionArrayOperrand>(element) || dynamic_pointer_cast<InstructionObjectOperrand>(element)) isFlat = false;
+        }
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(value)) {
+        for (auto field: *object->operrand) {
+            if (dynamic_pointer_cast<InstructionArrayOperrand>(field.second) || dynamic_pointer_cast<InstructionObjectOperrand>(field.second)) isFlat = false;
+        }
+    }
+
+    auto constant = make_shared<InstructionConstantOperrand>(value, constants->constants.size(), isFlat);
+
+    constants->entries[key] = constant;
+    constants->constants.push_back(constant);
+
+    return constant;
+}
+
+bool BytecodeGenerator::isVisible(FunctionContext* function, string id) {
+    if (function == nullptr) return globals->find(id) != globals->end();
+    if (function->locals.find(id) != function->locals.end()) return true;
+
+    return isVisible(function->enclosing.get(), id);
+}
+
+int BytecodeGenerator::resolveUpvalue(FunctionContext* function, string id) {
+    for (size_t i = 0; i < function->upvalues.size(); ++i) {
+        if (function->upvalues.at(i).id == id) return i;
+    }
+
+    UpvalueDescriptor upvalue;
+    upvalue.id = id;
+
+    FunctionContext* enclosing = function->enclosing.get();
+
+    if (enclosing == nullptr) {
+        auto global = globals->find(id);
+        upvalue.isMutable = global != globals->end() && global->second > 1;
+    } else if (enclosing->locals.find(id) != enclosing->locals.end()) {
+        upvalue.isMutable = enclosing->locals.at(id) > 1;
+    } else {
+        upvalue.fromParent = true;
+        upvalue.index = resolveUpvalue(enclosing, id);
+        upvalue.isMutable = enclosing->upvalues.at(upvalue.index).isMutable;
+    }
+
+    function->upvalues.push_back(upvalue);
+
+    return function->upvalues.size() - 1;
 }
 
-map<ArrayNode*, shared_ptr<InstructionArrayOperrand>> arrayLinks;
+void markUpvalueMutable(FunctionContext* function, int index) {
+    UpvalueDescriptor& upvalue = function->upvalues.at(index);
 
-shared_ptr<InstructionOperrand> getOperrandFromNode(AstNode* node) {
+    // context of function compiled on first call is already resolved, it is only read then
+    if (!upvalue.isMutable) upvalue.isMutable = true;
+
+    if (upvalue.fromParent) markUpvalueMutable(function->enclosing.get(), upvalue.index);
+}
+
+void BytecodeGenerator::emitGet(string id) {
+    if (context == nullptr || context->locals.find(id) != context->locals.end()) {
+        bytecode.push_back(Instruction(Bytecode(F_GETENV), addName(id)));
+        return;
+    }
+
+    bytecode.push_back(Instruction(Bytecode(F_GETUPVAL), checkArgument(resolveUpvalue(context, id), "upvalues")));
+}
+
+void BytecodeGenerator::emitSet(string id) {
+    if (context == nullptr || context->locals.find(id) != context->locals.end()) {
+        bytecode.push_back(Instruction(Bytecode(F_SETENV), addName(id)));
+        return;
+    }
+
+    int index = resolveUpvalue(context, id);
+    markUpvalueMutable(context, index);
+
+    bytecode.push_back(Instruction(Bytecode(F_SETUPVAL), checkArgument(index, "upvalues")));
+}
+
+shared_ptr<FunctionContext> BytecodeGenerator::functionContext(FnDefineNode* fnDefine, bool isMethod, FunctionContext* enclosing) {
+    shared_ptr<FunctionContext> function = make_shared<FunctionContext>();
+    if (enclosing) function->enclosing = enclosing->shared_from_this();
+
+    for (AstNode* arg: fnDefine->args->nodes) {
+        if (IdentifierNode* id = dynamic_cast<IdentifierNode*>(arg)) function->locals[id->token->value] = 1;
+        else throw runtime_error("Compile error! Argument in function define statement must be a identifier");
+    }
+
+    if (isMethod) {
+        UpvalueDescriptor self;
+        self.id = "self";
+        self.isSelf = true;
+
+        function->upvalues.push_back(self);
+    }
+
+    map<string, int> assignments;
+    collectAssignments(fnDefine->block, assignments);
+
+    for (pair<string, int> assignment: assignments) {
+        if (function->locals.find(assignment.first) != function->locals.end()) function->locals[assignment.first] += assignment.second;
+        else if (!isVisible(enclosing, assignment.first)) function->locals[assignment.first] = assignment.second;
+    }
+
+    map<string, int> nested;
+    collectNestedAssignments(fnDefine->block, nested);
+
+    for (pair<string, int> assignment: nested) {
+        if (function->locals.find(assignment.first) != function->locals.end()) function->locals[assignment.first] += assignment.second;
+    }
+
+    return function;
+}
+
+void BytecodeGenerator::resolveName(string id, FunctionContext* function, bool isSet) {
+    if (function == nullptr || function->locals.find(id) != function->locals.end()) return;
+
+    int index = resolveUpvalue(function, id);
+    if (isSet) markUpvalueMutable(function, index);
+}
+
+void BytecodeGenerator::resolveNames(AstNode* node, FunctionContext* function) {
+    if (node == nullptr) return;
+
+    if (BlockNode* block = dynamic_cast<BlockNode*>(node)) {
+        for (AstNode* node: block->nodes) resolveNames(node, function);
+    } else if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(node)) {
+        resolveName(identifier->token->value, function, false);
+    } else if (AssignmentNode* assignment = dynamic_cast<AssignmentNode*>(node)) {
+        if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(assignment->id)) {
+            resolveNames(assignment->value, function);
+            resolveName(identifier->token->value, function, true);
+        } else if (IndexationNode* indexation = dynamic_cast<IndexationNode*>(assignment->id)) {
+            resolveNames(indexation->where, function);
+            resolveNames(assignment->value, function);
+            resolveNames(indexation->index, function);
+        }
+    } else if (FnDefineNode* fnDefine = dynamic_cast<FnDefineNode*>(node)) {
+        // nested function takes its upvalues from this one, so they are resolved here too
+        resolveNames(fnDefine->block, functionContext(fnDefine, false, function).get());
+
+        if (!fnDefine->isLambda) resolveName(fnDefine->id->token->value, function, true);
+    } else if (ObjectNode* object = dynamic_cast<ObjectNode*>(node)) {
+        for (pair<AstNode*, AstNode*> field: object->fields) {
+            if (FnDefineNode* method = dynamic_cast<FnDefineNode*>(field.second)) resolveNames(method->block, functionContext(method, true, function).get());
+            else resolveNames(field.second, function);
+        }
+    } else if (UnaryOperationNode* unary = dynamic_cast<UnaryOperationNode*>(node)) {
+        if (unary->operatorToken->getType() == USING) {
+            // wrong operrand is reported when body is generated
+            LiteralNode* literal = dynamic_cast<LiteralNode*>(unary->operrand);
+            if (literal && literal->token->getType() == STRING) imports->push_back(literal->token->value);
+
+            return;
+        }
+
+        resolveNames(unary->operrand, function);
+    } else if (BinaryOperationNode* binary = dynamic_cast<BinaryOperationNode*>(node)) {
+        resolveNames(binary->left, function);
+        resolveNames(binary->right, function);
+    } else if (ConditionNode* condition = dynamic_cast<ConditionNode*>(node)) {
+        resolveNames(condition->left, function);
+        resolveNames(condition->right, function);
+    } else if (IfStatementNode* ifStatement = dynamic_cast<IfStatementNode*>(node)) {
+        resolveNames(ifStatement->condition, function);
+        resolveNames(ifStatement->block, function);
+        resolveNames(ifStatement->elseBlock, function);
+    } else if (ForInNode* forIn = dynamic_cast<ForInNode*>(node)) {
+        resolveNames(forIn->iterable, function);
+        resolveName(forIn->id->token->value, function, true);
+        resolveNames(forIn->block, function);
+    } else if (ParenthisizedNode* parenthisized = dynamic_cast<ParenthisizedNode*>(node)) {
+        resolveNames(parenthisized->wrapped, function);
+    } else if (CallNode* call = dynamic_cast<CallNode*>(node)) {
+        for (auto arg = call->args->nodes.rbegin(); arg != call->args->nodes.rend(); ++arg) resolveNames(*arg, function);
+
+        resolveNames(call->calling, function);
+    } else if (ArrayNode* array = dynamic_cast<ArrayNode*>(node)) {
+        for (AstNode* element: array->elements) resolveNames(element, function);
+    } else if (IndexationNode* indexation = dynamic_cast<IndexationNode*>(node)) {
+        resolveNames(indexation->where, function);
+        resolveNames(indexation->index, function);
+    }
+}
+
+// body generated on first call, with context resolved when function was declared
+struct LazyFunction : LazyFunctionBody {
+    FnDefineNode* fnDefine;
+    shared_ptr<FunctionContext> context;
+    shared_ptr<map<string, int>> globals;
+    string path;
+
+    void compile(FuncDeclaration* declaration) override {
+        // own constant pool, bodies of different functions can be generated on different threads
+        BytecodeGenerator bgen(fnDefine->block, context.get(), globals, make_shared<ConstantPool>(), make_shared<CodeTablesBuilder>());
+        bgen.path = path;
+        bgen.imports = make_shared<vector<string>>();
+
+        vector<Instruction> bytecode = bgen.generate();
+
+        if (context->upvalues.size() != declaration->upvalues.size()) throw runtime_error("Compile error! Function " + declaration->id + " captures variables which were not resolved");
+
+        declaration->tables = bgen.tables->tables;
+        declaration->bytecode = bytecode;
+    }
+};
+
+shared_ptr<InstructionFunctionOperrand> BytecodeGenerator::compileFunction(FnDefineNode* fnDefine, bool isMethod) {
+    shared_ptr<FunctionContext> function = functionContext(fnDefine, isMethod, context);
+
+    vector<string> argsIds;
+    for (AstNode* arg: fnDefine->args->nodes) argsIds.push_back(static_cast<IdentifierNode*>(arg)->token->value);
+
+    vector<Instruction> bytecode;
+    shared_ptr<CodeTablesBuilder> functionTables = make_shared<CodeTablesBuilder>();
+
+    if (eager) {
+        // function has its own tables
+        BytecodeGenerator bgen(fnDefine->block, function.get(), globals, constants, functionTables);
+        bgen.path = path;
+        bgen.imports = imports;
+        bgen.eager = true;
+
+        bytecode = bgen.generate();
+    } else resolveNames(fnDefine->block, function.get());
+
+    shared_ptr<FuncDeclaration> declaration;
+    if (!fnDefine->isLambda) declaration = make_shared<FuncDeclaration>(bytecode, argsIds, fnDefine->id->token->value);
+    else declaration = make_shared<FuncDeclaration>(bytecode, argsIds);
+
+    declaration->tables = functionTables->tables;
+    declaration->upvalues = function->upvalues;
+    declaration->isGenerator = containsYield(fnDefine->block);
+
+    if (!eager) {
+        shared_ptr<LazyFunction> body = make_shared<LazyFunction>();
+        body->fnDefine = fnDefine;
+        body->context = function;
+        body->globals = globals;
+        body->path = path;
+
+        declaration->lazyBody = body;
+    }
+
+    return make_shared<InstructionFunctionOperrand>(declaration);
+}
+
+shared_ptr<InstructionOperrand> BytecodeGenerator::getOperrandFromNode(AstNode* node) {
     if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(node)) {
         return make_shared<InstructionStringOperrand>(identifier->token->value);
     }  else if (LiteralNode* literal = dynamic_cast<LiteralNode*>(node)) {
@@ -44,14 +490,14 @@ shared_ptr<InstructionOperrand> getOperrandFromNode(AstNode* node) {
         } else if (literalType == STRING) {
             return make_shared<InstructionStringOperrand>(token->value);
         } else if (literalType == TRUE) {
-            return make_shared<InstructionBoolOperrand>(true);
+            return boolOperrand(true);
         } else if (literalType == FALSE) {
-            return make_shared<InstructionBoolOperrand>(false);
+            return boolOperrand(false);
         } else if (literalType == NULLT) {
-            return make_shared<InstructionNullOperrand>();
+            return nullOperrand();
         }
     } else if (ArrayNode* array = dynamic_cast<ArrayNode*>(node)) {
-        shared_ptr<vector<shared_ptr<InstructionOperrand>>> elements = make_shared<vector<shared_ptr<InstructionOperrand>>>();
+        shared_ptr<OperrandVector> elements = make_shared<OperrandVector>();
         
         for (AstNode* element: array->elements) {
             elements->push_back(getOperrandFromNode(element));
@@ -61,7 +507,7 @@ shared_ptr<InstructionOperrand> getOperrandFromNode(AstNode* node) {
 
         return operrand;
     } else if (ObjectNode* object = dynamic_cast<ObjectNode*>(node)) {
-        shared_ptr<map<string, shared_ptr<InstructionOperrand>>> fields = make_shared<map<string, shared_ptr<InstructionOperrand>>>();
+        shared_ptr<OperrandMap> fields = make_shared<OperrandMap>();
 
         shared_ptr<InstructionObjectOperrand> operrand = make_shared<InstructionObjectOperrand>(fields);
 
@@ -70,29 +516,10 @@ shared_ptr<InstructionOperrand> getOperrandFromNode(AstNode* node) {
             shared_ptr<InstructionOperrand> value = getOperrandFromNode(field.second);
             
             if (auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index)) {
-                if (auto funcOperrand = dynamic_pointer_cast<InstructionFunctionOperrand>(value)) {
-                    funcOperrand->operrand.bytecode.insert(funcOperrand->operrand.bytecode.begin(), Instruction(Bytecode(F_SETENV), make_shared<InstructionStringOperrand>("self")));
-                    funcOperrand->operrand.bytecode.insert(funcOperrand->operrand.bytecode.begin(), Instruction(Bytecode(F_PUSH), operrand));
-                }
-                fields->insert({ indexCasted->operrand, value });
+                fields->insert({ indexCasted->tostring(), value });
             }
         }
 
-        return operrand;
-    } else if (FnDefineNode* fnDefine = dynamic_cast<FnDefineNode*>(node)) {
-        vector<string> argsIds;
-
-        for (AstNode* arg: fnDefine->args->nodes) {
-            if (IdentifierNode* id = dynamic_cast<IdentifierNode*>(arg)) argsIds.push_back(id->token->value);
-            else throw runtime_error("Compile error! Argument in function define statement must be a identifier");
-        }
-
-        BytecodeGenerator bgen(fnDefine->block);
-
-        shared_ptr<InstructionFunctionOperrand> operrand;
-        if (!fnDefine->isLambda) operrand = make_shared<InstructionFunctionOperrand>(FuncDeclaration(bgen.generate(), argsIds, fnDefine->id->token->value));
-        else operrand = make_shared<InstructionFunctionOperrand>(FuncDeclaration(bgen.generate(), argsIds));
-
         return operrand;
     }
 
@@ -118,6 +545,12 @@ void BytecodeGenerator::visitNode(AstNode* node) {
             else if (operatorType == MINUS) instr = Instruction(Bytecode(F_SUB));
             else if (operatorType == MUL) instr = Instruction(Bytecode(F_MUL));
             else if (operatorType == DIV) instr = Instruction(Bytecode(F_DIV));
+            else if (operatorType == MOD) instr = Instruction(Bytecode(F_MOD));
+            else if (operatorType == SHIFT_LEFT) instr = Instruction(Bytecode(F_SHL));
+            else if (operatorType == SHIFT_RIGHT) instr = Instruction(Bytecode(F_SHR));
+            else if (operatorType == BIT_AND) instr = Instruction(Bytecode(F_BIT_AND));
+            else if (operatorType == BIT_OR) instr = Instruction(Bytecode(F_BIT_OR));
+            else if (operatorType == BIT_XOR) instr = Instruction(Bytecode(F_BIT_XOR));
 
             bytecode.push_back(instr);
         } else if (ConditionNode* condition = dynamic_cast<ConditionNode*>(node)) {
@@ -144,32 +577,53 @@ void BytecodeGenerator::visitNode(AstNode* node) {
             AstNode* id = assignment->id;
             if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(id)) {
                 visitNode(assignment->value);
-                bytecode.push_back(Instruction(Bytecode(F_SETENV), make_shared<InstructionStringOperrand>(identifier->token->value)));
+                emitSet(identifier->token->value);
             } else if (IndexationNode* indexation = dynamic_cast<IndexationNode*>(id)) {
                 visitNode(indexation->where);
                 visitNode(assignment->value);
                 visitNode(indexation->index);
-                bytecode.push_back(Instruction(Bytecode(F_SETINDEX)));
+
+                // entry of constants only carries allocation site
+                bytecode.push_back(Instruction(Bytecode(F_SETINDEX), addConstant(nullOperrand(), getSite(indexation->token))));
             }
         } else if (LiteralNode* literal = dynamic_cast<LiteralNode*>(node)) {
-             bytecode.push_back(Instruction(Bytecode(F_PUSH), getOperrandFromNode(literal)));
+             bytecode.push_back(Instruction(Bytecode(F_PUSH), addLiteral(literal)));
         } else if (IfStatementNode* ifStatement = dynamic_cast<IfStatementNode*>(node)) {
-            BytecodeGenerator bgen(ifStatement->block);
+            BytecodeGenerator bgen(ifStatement->block, context, globals, constants, tables);
+            bgen.path = path;
+            bgen.imports = imports;
+            bgen.eager = eager;
 
             visitNode(ifStatement->condition);
 
             if (ifStatement->elseBlock) {
-                BytecodeGenerator bgenElse(ifStatement->elseBlock);
+                BytecodeGenerator bgenElse(ifStatement->elseBlock, context, globals, constants, tables);
+                bgenElse.path = path;
+                bgenElse.imports = imports;
+                bgenElse.eager = eager;
+
+                IfStatement statement(bgen.generate(), bgenElse.generate());
                 
-                bytecode.push_back(Instruction(Bytecode(F_IF), make_shared<InstructionIfStatementLoadOperrand>(
-                    IfStatement(bgen.generate(), bgenElse.generate())
-                )));
+                bytecode.push_back(Instruction(Bytecode(F_IF), addBranch(statement)));
                 return;
             };
 
-            bytecode.push_back(Instruction(Bytecode(F_IF), make_shared<InstructionIfStatementLoadOperrand>(
-                IfStatement(bgen.generate())
-            )));
+            IfStatement statement(bgen.generate());
+
+            bytecode.push_back(Instruction(Bytecode(F_IF), addBranch(statement)));
+        } else if (ForInNode* forIn = dynamic_cast<ForInNode*>(node)) {
+            visitNode(forIn->iterable);
+
+            // body starts with assignment of element which FOR_IN pushes
+            BytecodeGenerator bgen(forIn->block, context, globals, constants, tables);
+            bgen.path = path;
+            bgen.imports = imports;
+            bgen.eager = eager;
+            bgen.emitSet(forIn->id->token->value);
+
+            IfStatement statement(bgen.generate());
+
+            bytecode.push_back(Instruction(Bytecode(F_FOR_IN), addBranch(statement)));
         } else if (UnaryOperationNode* unary = dynamic_cast<UnaryOperationNode*>(node)) {
             Token* token = unary->operatorToken;
             TokenType unaryType = token->getType();
@@ -178,16 +632,7 @@ void BytecodeGenerator::visitNode(AstNode* node) {
                 AstNode* operrand = unary->operrand;
                 if (LiteralNode* operrandCasted = dynamic_cast<LiteralNode*>(operrand)) {
                     if (operrandCasted->token->getType() == STRING) {
-                        string path = operrandCasted->token->value;
-                        string code = readFile(path);
-
-                        Compiler newCompiler;
-                        vector<Instruction> importedBytecode = newCompiler.compile(code);
-
-                        for (Instruction importedInstruction: importedBytecode) {
-                            bytecode.insert(bytecode.begin(), importedInstruction);
-                        }
-
+                        imports->push_back(operrandCasted->token->value);
                         return;
                     }
                 }
@@ -195,33 +640,57 @@ void BytecodeGenerator::visitNode(AstNode* node) {
                 throw runtime_error("Compile error! Cant import module");
             }
 
+            if (unaryType == YIELD && context == nullptr) throw runtime_error("Compile error! yield outside of function");
+
             visitNode(unary->operrand);
 
             if (unaryType == RETURN) bytecode.push_back(Instruction(Bytecode(F_RETURN)));
             else if (unaryType == DELAY) bytecode.push_back(Instruction(Bytecode(F_DELAY)));
             else if (unaryType == OUTPUT) bytecode.push_back(Instruction(Bytecode(F_OUTPUT)));
+            else if (unaryType == YIELD) bytecode.push_back(Instruction(Bytecode(F_YIELD)));
         } else if (IdentifierNode* identifier = dynamic_cast<IdentifierNode*>(node)) {
-            bytecode.push_back(Instruction(Bytecode(F_GETENV), getOperrandFromNode(identifier)));
+            emitGet(identifier->token->value);
         } else if (ParenthisizedNode* parenthisized = dynamic_cast<ParenthisizedNode*>(node)) {
             visitNode(parenthisized->wrapped);
         } else if (FnDefineNode* fnDefine = dynamic_cast<FnDefineNode*>(node)) {
-            bytecode.push_back(Instruction(Bytecode(F_PUSH), getOperrandFromNode(fnDefine)));
+            bytecode.push_back(Instruction(Bytecode(F_MAKE_CLOSURE), addConstant(compileFunction(fnDefine))));
 
-            if (!fnDefine->isLambda) bytecode.push_back(Instruction(Bytecode(F_SETENV), make_shared<InstructionStringOperrand>(fnDefine->id->token->value)));
+            if (!fnDefine->isLambda) emitSet(fnDefine->id->token->value);
         } else if (CallNode* call = dynamic_cast<CallNode*>(node)) {
-            reverse(call->args->nodes.begin(), call->args->nodes.end());
-            
-            for (AstNode* arg: call->args->nodes) {
-                visitNode(arg);
-            }
+            // arguments are pushed last first, ast is not changed since body of function can be generated again after error
+            for (auto arg = call->args->nodes.rbegin(); arg != call->args->nodes.rend(); ++arg) visitNode(*arg);
 
             visitNode(call->calling);
 
             bytecode.push_back(Instruction(Bytecode(F_CALL)));
         } else if (ArrayNode* array = dynamic_cast<ArrayNode*>(node)) {
-            bytecode.push_back(Instruction(Bytecode(F_PUSH), getOperrandFromNode(array)));
+            const AllocationSite* site = getSite(array->token);
+
+            if (auto constant = getConstant(array)) bytecode.push_back(Instruction(Bytecode(F_CLONE), addConstant(constant, site)));
+            else {
+                for (AstNode* element: array->elements) visitNode(element);
+
+                bytecode.push_back(Instruction(Bytecode(F_NEW_ARRAY), addConstant(make_shared<InstructionNumberOperrand>(array->elements.size()), site)));
+            }
         } else if (ObjectNode* object = dynamic_cast<ObjectNode*>(node)) {
-            bytecode.push_back(Instruction(Bytecode(F_PUSH), getOperrandFromNode(object)));
+            if (auto constant = getConstant(object)) {
+                bytecode.push_back(Instruction(Bytecode(F_CLONE), addConstant(constant, getSite(object->token))));
+                return;
+            }
+
+            vector<string> keys;
+
+            for (pair<AstNode*, AstNode*> field: object->fields) {
+                auto key = dynamic_pointer_cast<InstructionStringOperrand>(getOperrandFromNode(field.first));
+                if (!key) throw runtime_error("Compile error! Object field name must be a identifier or string");
+
+                keys.push_back(key->tostring());
+
+                if (FnDefineNode* method = dynamic_cast<FnDefineNode*>(field.second)) bytecode.push_back(Instruction(Bytecode(F_MAKE_CLOSURE), addConstant(compileFunction(method, true))));
+                else visitNode(field.second);
+            }
+
+            bytecode.push_back(Instruction(Bytecode(F_NEW_OBJECT), addConstant(make_shared<InstructionShapeOperrand>(keys), getSite(object->token))));
         } else if (IndexationNode* indexation = dynamic_cast<IndexationNode*>(node)) {
             visitNode(indexation->where);
             visitNode(indexation->index);
@@ -1,15 +1,30 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "include/compiler.h"
 #include "lexer/include/lexer.h"
 #include "include/parser.h"
 #include "include/bytecodeGenerator.h"
 #include "../include/fvm.h"
+#include "../include/bytecodeFile.h"
 
 using namespace std;
 
-vector<Instruction> Compiler::compile(string code) {
+string canonicalPath(string path) {
+    error_code error;
+    filesystem::path canonical = filesystem::weakly_canonical(path, error);
+
+    return error ? path : canonical.string();
+}
+
+CompiledModule Compiler::compileModule(string code, string path) {
     Lexer lexer(code);
     Parser parser(lexer.tokenize(false));
 
@@ -17,7 +32,420 @@ vector<Instruction> Compiler::compile(string code) {
 
     // for (auto v: ast->nodes) cout << v->tostr() << endl;
 
-    vector<Instruction> bytecode = BytecodeGenerator(ast).generate();
+    BytecodeGenerator bgen(ast, path);
+    bgen.eager = eager;
+
+    CompiledModule module;
+    module.body = make_shared<FuncDeclaration>(bgen.generate(), vector<string>(), path);
+    module.body->tables = bgen.tables->tables;
+    module.imports = *bgen.imports;
+
+    return module;
+}
+
+CompiledModule Compiler::loadModule(string path, string canonical) {
+    if (!registry) return readModule(path, canonical);
+
+    unique_lock<mutex> guard(registry->lock);
+
+    // first compiler which needs module compiles it, others wait for it
+    auto known = registry->modules.find(canonical);
+    if (known != registry->modules.end()) {
+        shared_future<CompiledModule> module = known->second;
+        guard.unlock();
+
+        return module.get();
+    }
+
+    promise<CompiledModule> compiled;
+    registry->modules[canonical] = compiled.get_future().share();
+
+    guard.unlock();
+
+    try {
+        CompiledModule module = readModule(path, canonical);
+        compiled.set_value(module);
+
+        return module;
+    } catch (...) {
+        compiled.set_exception(current_exception());
+        throw;
+    }
+}
+
+CompiledModule Compiler::readModule(string path, string canonical) {
+    ifstream file(path, ios::binary);
+    if (!file) throw runtime_error("Compile error! Cant import module " + path);
+
+    stringstream source;
+    source << file.rdbuf();
+    string code = source.str();
+
+    CompiledModule module;
+
+    // cached module is found by path and content, so edited module is compiled again
+    string cached;
+
+    if (!moduleCache.empty()) {
+        string key = canonical + "\n" + code;
+
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv1a(key.data(), key.size()));
+
+        cached = (filesystem::path(moduleCache) / (string(name) + ".fmc")).string();
+
+        try {
+            if (isBytecodeFile(cached)) {
+                module.body = loadBytecodeFile(cached, &module.imports);
+                return module;
+            }
+        } catch (const exception&) {
+            // written by other version or broken, replaced below
+            module.imports.clear();
+        }
+    }
+
+    module = compileModule(code, path);
+
+    if (!cached.empty()) {
+        error_code error;
+        filesystem::create_directories(moduleCache, error);
+
+        // other femic can read cache at the same time, file appears complete or not at all
+        string temporary = cached + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()) ^ chrono::steady_clock::now().time_since_epoch().count());
+
+        ofstream out(temporary, ios::binary);
+
+        if (out) {
+            writeBytecodeFile(out, module.body, module.imports);
+            out.close();
+
+            filesystem::rename(temporary, cached, error);
+            if (error) filesystem::remove(temporary, error);
+        }
+    }
+
+    return module;
+}
+
+void Compiler::compileModules(const vector<string>& paths, string program) {
+    mutex lock;
+    condition_variable changed;
+
+    deque<pair<string, string>> queue;
+    set<string> scheduled;
+    size_t active = 0;
+
+    if (!program.empty()) scheduled.insert(canonicalPath(program));
+
+    auto schedule = [&](const string& path) {
+        string canonical = canonicalPath(path);
+        if (modules.count(canonical) || !scheduled.insert(canonical).second) return;
+
+        queue.push_back({ path, canonical });
+    };
+
+    for (const string& path: paths) schedule(path);
+    if (queue.empty()) return;
+
+    // module is compiled without lock, its imports are scheduled when it is done
+    auto worker = [&]() {
+        unique_lock<mutex> guard(lock);
+
+        while (true) {
+            changed.wait(guard, [&]() { return !queue.empty() || active == 0; });
+            if (queue.empty()) return;
+
+            pair<string, string> next = queue.front();
+            queue.pop_front();
+            active++;
+
+            guard.unlock();
+
+            CompiledModule module;
+
+            try {
+                module = loadModule(next.first, next.second);
+            } catch (...) {
+                module.error = current_exception();
+            }
+
+            guard.lock();
+
+            for (string& dependency: module.imports) schedule(dependency);
+            modules[next.second] = module;
+
+            active--;
+            changed.notify_all();
+        }
+    };
+
+    size_t count = threads ? threads : max(1u, thread::hardware_concurrency());
+
+    vector<thread> workers;
+    for (size_t i = 1; i < count; ++i) workers.push_back(thread(worker));
+
+    worker();
+
+    for (thread& thread: workers) thread.join();
+}
+
+CompiledModule& Compiler::import(string path) {
+    string canonical = canonicalPath(path);
+
+    auto known = modules.find(canonical);
+    if (known == modules.end()) known = modules.insert({ canonical, loadModule(path, canonical) }).first;
+
+    if (known->second.error) rethrow_exception(known->second.error);
+
+    return known->second;
+}
+
+void Compiler::collectModules(string path, set<string>& visited, vector<CompiledModule*>& order) {
+    if (!visited.insert(canonicalPath(path)).second) return;
+
+    CompiledModule* module = &import(path);
+
+    for (string dependency: module->imports) collectModules(dependency, visited, order);
+
+    order.push_back(module);
+}
+
+// top level code of module with arguments moved to tables of program, one pass over instructions
+vector<Instruction> relocate(const vector<Instruction>& bytecode, uint32_t constantsOffset, uint32_t branchesOffset, vector<uint32_t>& names) {
+    vector<Instruction> relocated = bytecode;
+
+    for (Instruction& code: relocated) {
+        switch (argumentKind(code.code())) {
+            case ARGUMENT_CONSTANT: code.setArgument(code.argument() + constantsOffset); break;
+            case ARGUMENT_NAME: code.setArgument(names.at(code.argument())); break;
+            case ARGUMENT_BRANCH: code.setArgument(code.argument() + branchesOffset); break;
+            default: break;
+        }
+    }
+
+    return relocated;
+}
+
+void linkModule(CompiledModule& module, CodeTablesBuilder& program, vector<Instruction>& bytecode) {
+    CodeTables& from = *module.body->tables;
+    CodeTables& into = *program.tables;
+
+    if (into.constants.size() + from.constants.size() > MAX_ARGUMENT || into.branches.size() + from.branches.size() > MAX_ARGUMENT) {
+        throw runtime_error("Compile error! Too many constants in program with modules");
+    }
+
+    uint32_t constantsOffset = into.constants.size();
+    uint32_t branchesOffset = into.branches.size();
+
+    into.constants.insert(into.constants.end(), from.constants.begin(), from.constants.end());
+    into.sites.insert(into.sites.end(), from.sites.begin(), from.sites.end());
+
+    vector<uint32_t> names;
+
+    for (string& name: from.names) {
+        auto entry = program.names.find(name);
+
+        if (entry == program.names.end()) {
+            entry = program.names.insert({ name, into.names.size() }).first;
+            into.names.push_back(name);
+        }
+
+        names.push_back(entry->second);
+    }
+
+    for (IfStatement& statement: from.branches) {
+        into.branches.push_back(IfStatement(
+            relocate(statement.bytecode, constantsOffset, branchesOffset, names),
+            relocate(statement.elseBytecode, constantsOffset, branchesOffset, names)
+        ));
+    }
+
+    vector<Instruction> relocated = relocate(module.body->bytecode, constantsOffset, branchesOffset, names);
+    bytecode.insert(bytecode.end(), relocated.begin(), relocated.end());
+}
+
+// first instruction of value which only pushes constants, closures and literals made of them, -1 if it does more
+long pureValueStart(const vector<Instruction>& bytecode, long end, long from, CodeTables& tables) {
+    if (end < from) return -1;
+
+    const Instruction& code = bytecode[end];
+    size_t count = 0;
+
+    switch (code.code()) {
+        case F_PUSH:
+        case F_CLONE:
+        case F_MAKE_CLOSURE:
+            return end;
+        case F_NEW_ARRAY:
+            if (auto size = dynamic_cast<InstructionNumberOperrand*>(constantOf(code, tables))) count = size->operrand;
+            else return -1;
+            break;
+        case F_NEW_OBJECT:
+            if (auto shape = dynamic_cast<InstructionShapeOperrand*>(constantOf(code, tables))) count = shape->operrand.size();
+            else return -1;
+            break;
+        default:
+            return -1;
+    }
+
+    long start = end;
+
+    for (size_t i = 0; i < count; ++i) {
+        start = pureValueStart(bytecode, start - 1, from, tables);
+        if (start < 0) return -1;
+    }
+
+    return start;
+}
+
+// globals read by code: names of GETENV and what closures capture
+void collectReads(const vector<Instruction>& bytecode, size_t from, size_t to, CodeTables& tables, set<string>& reads) {
+    for (size_t i = from; i < to; ++i) {
+        const Instruction& code = bytecode[i];
+
+        if (code.code() == F_GETENV) reads.insert(tables.names.at(code.argument()));
+        else if (code.code() == F_MAKE_CLOSURE) {
+            if (auto closure = dynamic_cast<InstructionFunctionOperrand*>(constantOf(code, tables))) {
+                for (UpvalueDescriptor& upvalue: closure->operrand->upvalues) {
+                    if (!upvalue.isSelf) reads.insert(upvalue.id);
+                }
+            }
+        }
+    }
+}
+
+struct ShakeCandidate {
+    size_t start;
+    size_t end;
+    ShakenDefinition definition;
+    bool live = false;
+};
+
+// definitions of modules (value without side effects stored by SETENV) whose names program never reads are dropped,
+// reads are followed through kept definitions until nothing changes
+vector<Instruction> shake(const vector<Instruction>& bytecode, const vector<pair<size_t, string>>& modules, size_t modulesEnd, CodeTables& tables, vector<ShakenDefinition>& shaken) {
+    vector<ShakeCandidate> candidates;
+
+    for (size_t m = 0; m < modules.size(); ++m) {
+        size_t from = modules[m].first;
+        size_t to = m + 1 < modules.size() ? modules[m + 1].first : modulesEnd;
+
+        for (size_t i = from + 1; i < to; ++i) {
+            if (bytecode[i].code() != F_SETENV) continue;
+
+            Bytecode last = bytecode[i - 1].code();
+            if (last != F_MAKE_CLOSURE && last != F_CLONE && last != F_NEW_OBJECT && last != F_NEW_ARRAY) continue;
+
+            long start = pureValueStart(bytecode, i - 1, from, tables);
+            if (start < 0) continue;
+
+            ShakeCandidate candidate;
+            candidate.start = start;
+            candidate.end = i + 1;
+            candidate.definition.module = modules[m].second;
+            candidate.definition.name = tables.names.at(bytecode[i].argument());
+
+            if (last == F_MAKE_CLOSURE) candidate.definition.kind = "function";
+            else if (last == F_NEW_ARRAY) candidate.definition.kind = "array";
+            else if (auto constant = dynamic_cast<InstructionConstantOperrand*>(constantOf(bytecode[i - 1], tables))) {
+                candidate.definition.kind = dynamic_pointer_cast<InstructionArrayOperrand>(constant->operrand) ? "array" : "object";
+            } else candidate.definition.kind = "object";
+
+            candidates.push_back(candidate);
+        }
+    }
+
+    if (candidates.empty()) return bytecode;
+
+    // everything outside of candidates is kept, blocks of IF too
+    set<string> reads;
+    size_t position = 0;
+
+    for (ShakeCandidate& candidate: candidates) {
+        collectReads(bytecode, position, candidate.start, tables, reads);
+        position = candidate.end;
+    }
+
+    collectReads(bytecode, position, bytecode.size(), tables, reads);
+
+    for (IfStatement& statement: tables.branches) {
+        collectReads(statement.bytecode, 0, statement.bytecode.size(), tables, reads);
+        collectReads(statement.elseBytecode, 0, statement.elseBytecode.size(), tables, reads);
+    }
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (ShakeCandidate& candidate: candidates) {
+            if (candidate.live || !reads.count(candidate.definition.name)) continue;
+
+            candidate.live = changed = true;
+            collectReads(bytecode, candidate.start, candidate.end, tables, reads);
+        }
+    }
+
+    vector<Instruction> shakenBytecode;
+    position = 0;
+
+    for (ShakeCandidate& candidate: candidates) {
+        if (candidate.live) continue;
+
+        shakenBytecode.insert(shakenBytecode.end(), bytecode.begin() + position, bytecode.begin() + candidate.start);
+        position = candidate.end;
+
+        shaken.push_back(candidate.definition);
+    }
+
+    shakenBytecode.insert(shakenBytecode.end(), bytecode.begin() + position, bytecode.end());
+
+    return shakenBytecode;
+}
+
+void Compiler::printShakeReport(ostream& out) {
+    out << "[ TREE SHAKING ]" << endl;
+    out << "  > removed definitions: " << shaken.size() << endl;
+
+    for (ShakenDefinition& definition: shaken) {
+        out << "  > " << definition.module << " | " << definition.kind << " " << definition.name << endl;
+    }
+}
+
+shared_ptr<FuncDeclaration> Compiler::compile(string code, string path) {
+    CompiledModule program = compileModule(code, path);
+    if (program.imports.empty()) return program.body;
+
+    set<string> visited;
+    if (!path.empty()) visited.insert(canonicalPath(path));
+
+    compileModules(program.imports, path);
+
+    // order does not depend on which thread finished first
+    vector<CompiledModule*> order;
+    for (string dependency: program.imports) collectModules(dependency, visited, order);
+
+    // modules go to tables of program, their code runs before it
+    CodeTablesBuilder builder;
+    builder.tables = program.body->tables;
+
+    for (size_t i = 0; i < builder.tables->names.size(); ++i) builder.names[builder.tables->names[i]] = i;
+
+    vector<Instruction> bytecode;
+
+    // where code of each module starts, for tree shaking
+    vector<pair<size_t, string>> linked;
+
+    for (CompiledModule* module: order) {
+        linked.push_back({ bytecode.size(), module->body->id });
+        linkModule(*module, builder, bytecode);
+    }
+
+    size_t modulesEnd = bytecode.size();
+
+    bytecode.insert(bytecode.end(), program.body->bytecode.begin(), program.body->bytecode.end());
+    program.body->bytecode = treeShake ? shake(bytecode, linked, modulesEnd, *builder.tables, shaken) : bytecode;
 
-    return bytecode;
-}
\ No newline at end of file
+    return program.body;
+}
@@ -0,0 +1,575 @@
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+
+#include "include/cppEmitter.h"
+
+using namespace std;
+
+const string BLOCK_ARGS = "(FVM* vm, shared_ptr<Scope> scope, shared_ptr<Scope> parent, shared_ptr<InstructionFunctionOperrand> closure)";
+
+string cppNumber(double value) {
+    if (isnan(value)) return "numeric_limits<double>::quiet_NaN()";
+    if (isinf(value)) return value > 0 ? "numeric_limits<double>::infinity()" : "(-numeric_limits<double>::infinity())";
+
+    // hexadecimal literal keeps every bit of double
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%a", value);
+
+    string literal = buffer;
+
+    return literal[0] == '-' ? "(" + literal + ")" : literal;
+}
+
+string cppString(string value) {
+    string literal = "\"";
+
+    for (unsigned char c: value) {
+        if (c == '"' || c == '\\') literal += string("\\") + (char)c;
+        else if (c == '\n') literal += "\\n";
+        else if (c == '\t') literal += "\\t";
+        else if (c < 32 || c >= 127) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\%03o", c);
+
+            literal += buffer;
+        } else literal += c;
+    }
+
+    return "string(" + literal + "\", " + to_string(value.size()) + ")";
+}
+
+string CppEmitter::operrand(shared_ptr<InstructionOperrand> operrand) {
+    if (auto number = dynamic_pointer_cast<InstructionNumberOperrand>(operrand)) {
+        return "make_shared<InstructionNumberOperrand>(" + cppNumber(number->operrand) + ")";
+    } else if (auto str = dynamic_pointer_cast<InstructionStringOperrand>(operrand)) {
+        return "make_shared<InstructionStringOperrand>(" + cppString(str->tostring()) + ")";
+    } else if (auto boolean = dynamic_pointer_cast<InstructionBoolOperrand>(operrand)) {
+        return boolean->operrand ? "boolOperrand(true)" : "boolOperrand(false)";
+    } else if (dynamic_pointer_cast<InstructionNullOperrand>(operrand)) {
+        return "nullOperrand()";
+    } else if (auto shape = dynamic_pointer_cast<InstructionShapeOperrand>(operrand)) {
+        string keys;
+
+        for (string key: shape->operrand) keys += (keys.empty() ? "" : ", ") + cppString(key);
+
+        return "make_shared<InstructionShapeOperrand>(vector<string>{ " + keys + " })";
+    } else if (auto constant = dynamic_pointer_cast<InstructionConstantOperrand>(operrand)) {
+        return "make_shared<InstructionConstantOperrand>(" + this->operrand(constant->operrand) + ", " + to_string(constant->index) + ", " + (constant->isFlat ? "true" : "false") + ")";
+    } else if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(operrand)) {
+        string elements;
+
+        for (shared_ptr<InstructionOperrand> element: *array->operrand) elements += (elements.empty() ? "" : ", ") + this->operrand(element);
+
+        return "aotArray({ " + elements + " })";
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(operrand)) {
+        string fields;
+
+        for (auto& field: *object->operrand) fields += string(fields.empty() ? "" : ", ") + "{ " + cppString(field.first) + ", " + this->operrand(field.second) + " }";
+
+        return "aotObject({ " + fields + " })";
+    } else if (auto func = dynamic_pointer_cast<InstructionFunctionOperrand>(operrand)) {
+        return "make_shared<InstructionFunctionOperrand>(functions[" + to_string(function(func->operrand)) + "])";
+    }
+
+    throw runtime_error("Compile error! Operrand " + operrand->tostring() + " cannot be emitted as C++");
+}
+
+size_t CppEmitter::instruction(const Instruction& code) {
+    size_t index = instructions++;
+
+    // argument keeps pointing into same table, tables are emitted with their original order
+    instructionsSetup += "    code[" + to_string(index) + "] = Instruction(Bytecode(" + to_string(code.code()) + "), " + to_string(code.argument()) + "); // "
+        + opcodeToString(code.code()) + "\n";
+
+    return index;
+}
+
+int CppEmitter::table(CodeTables& tables) {
+    auto known = this->tables.find(&tables);
+    if (known != this->tables.end()) return known->second;
+
+    int id = this->tables.size();
+    this->tables[&tables] = id;
+
+    // operrands are built first, function operrand emits setup of its own tables
+    string constants;
+    for (shared_ptr<InstructionOperrand>& constant: tables.constants) constants += (constants.empty() ? "" : ", ") + operrand(constant);
+
+    string names;
+    for (string& name: tables.names) names += (names.empty() ? "" : ", ") + cppString(name);
+
+    string target = "    tables[" + to_string(id) + "]";
+
+    if (!constants.empty()) tablesSetup += target + "->constants = { " + constants + " };\n";
+    if (!tables.sites.empty()) tablesSetup += target + "->sites.resize(" + to_string(tables.sites.size()) + ");\n";
+    if (!names.empty()) tablesSetup += target + "->names = { " + names + " };\n";
+
+    return id;
+}
+
+int CppEmitter::function(shared_ptr<FuncDeclaration> declaration) {
+    auto known = functions.find(declaration.get());
+    if (known != functions.end()) return known->second;
+
+    int id = functions.size();
+    functions[declaration.get()] = id;
+
+    declaration->compileBody();
+
+    string name = "fn_" + to_string(id);
+    string target = "    functions[" + to_string(id) + "]";
+
+    string args;
+    for (string arg: declaration->argsIds) args += (args.empty() ? "" : ", ") + cppString(arg);
+
+    functionsSetup += target + " = make_shared<FuncDeclaration>(vector<Instruction>(), vector<string>{ " + args + " }" + (declaration->isLambda ? "" : ", " + cppString(declaration->id)) + ");\n";
+
+    if (declaration->isGenerator) functionsSetup += target + "->isGenerator = true;\n";
+
+    if (!declaration->upvalues.empty()) {
+        string upvalues;
+
+        for (UpvalueDescriptor& upvalue: declaration->upvalues) {
+            upvalues += string(upvalues.empty() ? "" : ", ") + "aotUpvalue(" + cppString(upvalue.id) + ", " + (upvalue.fromParent ? "true" : "false") + ", "
+                + to_string(upvalue.index) + ", " + (upvalue.isMutable ? "true" : "false") + ", " + (upvalue.isSelf ? "true" : "false") + ")";
+        }
+
+        functionsSetup += target + "->upvalues = { " + upvalues + " };\n";
+    }
+
+    functionsSetup += target + "->tables = tables[" + to_string(table(*declaration->tables)) + "];\n";
+    functionsSetup += target + "->compiled = " + name + ";\n";
+
+    string fastPath = typedFunction(declaration.get(), id);
+
+    bool returned;
+    string body = block(declaration->bytecode, *declaration->tables, returned);
+
+    prototypes += "static bool " + name + BLOCK_ARGS + ";\n";
+
+    definitions += "static bool " + name + BLOCK_ARGS + " {\n" + fastPath + "    BlockGuard guard(vm, scope, parent, closure);\n\n" + body;
+    if (!returned) definitions += "\n    mergeScope(scope, parent);\n\n    return false;\n";
+    definitions += "}\n\n";
+
+    return id;
+}
+
+string CppEmitter::block(const vector<Instruction>& bytecode, CodeTables& tables, bool& returned) {
+    string out;
+    returned = false;
+
+    for (const Instruction& code: bytecode) {
+        if (code.code() == F_IF) {
+            if (code.argument() >= tables.branches.size()) throw runtime_error("Compile error! IF without statement cannot be emitted as C++");
+
+            IfStatement& statement = tables.branches[code.argument()];
+
+            out += "    {\n        int condition = aotCondition(vm);\n\n";
+
+            // branch runs in new scope over current one, like run() of interpreter
+            if (!statement.bytecode.empty()) {
+                out += "        if (condition == 1 && " + blockFunction(statement.bytecode, tables) + "(vm, makePooled<Scope>(), scope, closure)) return true;\n";
+            }
+
+            if (!statement.elseBytecode.empty()) {
+                out += "        if (condition == 0 && " + blockFunction(statement.elseBytecode, tables) + "(vm, makePooled<Scope>(), scope, closure)) return true;\n";
+            }
+
+            out += "    }\n";
+            continue;
+        }
+
+        if (code.code() == F_FOR_IN) {
+            if (code.argument() >= tables.branches.size()) throw runtime_error("Compile error! FOR_IN without body cannot be emitted as C++");
+
+            string body = blockFunction(tables.branches[code.argument()].bytecode, tables);
+
+            out += "    if (vm->forIn([&]() { return " + body + "(vm, makePooled<Scope>(), scope, closure); })) return true;\n";
+            continue;
+        }
+
+        string call = "vm->execute(code[" + to_string(instruction(code)) + "], *tables[" + to_string(table(tables)) + "], scope, parent, closure)";
+
+        if (code.code() == F_RETURN) {
+            // rest of block is never executed
+            out += "    return " + call + ";\n";
+            returned = true;
+
+            break;
+        }
+
+        out += "    " + call + ";\n";
+    }
+
+    return out;
+}
+
+string CppEmitter::blockFunction(const vector<Instruction>& bytecode, CodeTables& tables) {
+    string name = "block_" + to_string(blocks++);
+
+    bool returned;
+    string body = block(bytecode, tables, returned);
+
+    prototypes += "static bool " + name + BLOCK_ARGS + ";\n";
+
+    definitions += "static bool " + name + BLOCK_ARGS + " {\n    BlockGuard guard(vm, scope, parent, closure);\n\n" + body;
+    if (!returned) definitions += "\n    mergeScope(scope, parent);\n\n    return false;\n";
+    definitions += "}\n\n";
+
+    return name;
+}
+
+string CppEmitter::temporary() {
+    return "t" + to_string(temporaries++);
+}
+
+bool CppEmitter::typedBlock(const vector<Instruction>& bytecode, CppTypedState& state, string indent, string& out, bool& returned) {
+    returned = false;
+
+    CodeTables& tables = *declaration->tables;
+
+    for (const Instruction& code: bytecode) {
+        vector<CppValue>& stack = state.stack;
+        size_t depth = stack.size();
+
+        Bytecode opcode = genericOpcode(code.code());
+        uint32_t argument = code.argument();
+
+        switch (opcode) {
+            case F_PUSH:
+                {
+                    if (argument >= tables.constants.size()) return false;
+
+                    InstructionOperrand* constant = tables.constants[argument].get();
+
+                    if (auto number = dynamic_cast<InstructionNumberOperrand*>(constant)) stack.push_back({ cppNumber(number->operrand), CPP_NUMBER });
+                    else if (auto boolean = dynamic_cast<InstructionBoolOperrand*>(constant)) stack.push_back({ boolean->operrand ? "1.0" : "0.0", CPP_BOOL });
+                    else return false;
+                }
+                break;
+            case F_GETENV:
+            case F_SETENV:
+                {
+                    if (argument >= tables.names.size()) return false;
+
+                    const string& id = tables.names[argument];
+                    auto local = state.locals.find(id);
+
+                    if (opcode == F_GETENV) {
+                        // interpreter would fail with unknown address
+                        if (local == state.locals.end()) return false;
+
+                        // copy, local can be assigned while value is still on stack
+                        string value = temporary();
+                        out += indent + "const double " + value + " = " + local->second.expression + ";\n";
+
+                        stack.push_back({ value, local->second.type });
+                        break;
+                    }
+
+                    if (depth == 0 || stack.back().type == CPP_SELF) return false;
+
+                    CppValue value = stack.back();
+                    stack.pop_back();
+
+                    if (local != state.locals.end()) {
+                        // one variable keeps one type
+                        if (local->second.type != value.type) return false;
+
+                        out += indent + local->second.expression + " = " + value.expression + ";\n";
+                    } else {
+                        // declared in C++ block of branch, so it is gone after branch like member of branch scope
+                        string variable = "l" + to_string(locals++);
+                        out += indent + "double " + variable + " = " + value.expression + ";\n";
+
+                        state.locals[id] = { variable, value.type };
+                    }
+                }
+                break;
+            case F_GETUPVAL:
+                {
+                    if (argument >= declaration->upvalues.size()) return false;
+
+                    int upvalueIndex = argument;
+                    UpvalueDescriptor& upvalue = declaration->upvalues.at(upvalueIndex);
+
+                    // name of function itself is guarded to hold called closure, others to hold numbers
+                    CppValueType type = !declaration->isLambda && !upvalue.isSelf && upvalue.id == declaration->id ? CPP_SELF : CPP_NUMBER;
+                    upvalueTypes[upvalueIndex] = type;
+
+                    stack.push_back({ type == CPP_SELF ? "" : "upvalues[" + to_string(upvalueIndex) + "]", type });
+                }
+                break;
+            case F_ADD:
+            case F_SUB:
+            case F_MUL:
+            case F_DIV:
+                {
+                    if (depth < 2 || stack[depth - 1].type != CPP_NUMBER || stack[depth - 2].type != CPP_NUMBER) return false;
+
+                    string op = opcode == F_ADD ? " + " : opcode == F_SUB ? " - " : opcode == F_MUL ? " * " : " / ";
+                    string value = temporary();
+
+                    // second popped operrand is left one
+                    out += indent + "const double " + value + " = " + stack[depth - 2].expression + op + stack[depth - 1].expression + ";\n";
+
+                    stack.resize(depth - 2);
+                    stack.push_back({ value, CPP_NUMBER });
+                }
+                break;
+            case F_BIGGER:
+            case F_SMALLER:
+            case F_BIGGER_OR_EQ:
+            case F_SMALLER_OR_EQ:
+            case F_EQ:
+            case F_NOTEQ:
+                {
+                    if (depth < 2) return false;
+
+                    CppValue left = stack[depth - 2];
+                    CppValue right = stack[depth - 1];
+
+                    bool equality = opcode == F_EQ || opcode == F_NOTEQ;
+
+                    if (left.type == CPP_SELF || right.type == CPP_SELF) return false;
+                    if (!equality && (left.type != CPP_NUMBER || right.type != CPP_NUMBER)) return false;
+
+                    string value = temporary();
+
+                    if (left.type != right.type) {
+                        // number never equals boolean
+                        out += indent + "const double " + value + " = " + (opcode == F_NOTEQ ? "1.0" : "0.0") + ";\n";
+                    } else {
+                        string op = opcode == F_BIGGER ? " > " : opcode == F_SMALLER ? " < " : opcode == F_BIGGER_OR_EQ ? " >= "
+                            : opcode == F_SMALLER_OR_EQ ? " <= " : opcode == F_EQ ? " == " : " != ";
+
+                        out += indent + "const double " + value + " = " + left.expression + op + right.expression + " ? 1.0 : 0.0;\n";
+                    }
+
+                    stack.resize(depth - 2);
+                    stack.push_back({ value, CPP_BOOL });
+                }
+                break;
+            case F_AND:
+            case F_OR:
+                {
+                    if (depth < 2) return false;
+
+                    CppValue left = stack[depth - 2];
+                    CppValue right = stack[depth - 1];
+
+                    // OR gives left operrand when it is not false or null, number always is
+                    if (opcode == F_OR && left.type == CPP_NUMBER) {
+                        stack.pop_back();
+                        break;
+                    }
+
+                    if (left.type != CPP_BOOL || right.type != CPP_BOOL) return false;
+
+                    string value = temporary();
+                    string op = opcode == F_AND ? " && " : " || ";
+
+                    out += indent + "const double " + value + " = " + left.expression + " != 0.0" + op + right.expression + " != 0.0 ? 1.0 : 0.0;\n";
+
+                    stack.resize(depth - 2);
+                    stack.push_back({ value, CPP_BOOL });
+                }
+                break;
+            case F_IF:
+                {
+                    // interpreter skips both branches for non boolean condition
+                    if (argument >= tables.branches.size() || depth == 0 || stack.back().type != CPP_BOOL) return false;
+
+                    IfStatement& statement = tables.branches[argument];
+
+                    string condition = stack.back().expression;
+                    stack.pop_back();
+
+                    CppTypedState thenState = state;
+                    CppTypedState elseState = state;
+                    bool thenReturned;
+                    bool elseReturned;
+
+                    out += indent + "if (" + condition + " != 0.0) {\n";
+                    if (!typedBlock(statement.bytecode, thenState, indent + "    ", out, thenReturned)) return false;
+                    out += indent + "} else {\n";
+                    if (!typedBlock(statement.elseBytecode, elseState, indent + "    ", out, elseReturned)) return false;
+                    out += indent + "}\n";
+
+                    if (thenReturned && elseReturned) {
+                        returned = true;
+                        return true;
+                    }
+
+                    // values of stack are C++ names, branch which falls through must leave them as they were
+                    auto sameStack = [&](CppTypedState& branch) {
+                        if (branch.stack.size() != stack.size()) return false;
+
+                        for (size_t i = 0; i < stack.size(); ++i) {
+                            if (branch.stack[i].expression != stack[i].expression) return false;
+                        }
+
+                        return true;
+                    };
+
+                    if ((!thenReturned && !sameStack(thenState)) || (!elseReturned && !sameStack(elseState))) return false;
+                }
+                break;
+            case F_CALL:
+                {
+                    size_t argsNum = declaration->argsIds.size();
+
+                    if (depth < argsNum + 1 || stack.back().type != CPP_SELF) return false;
+
+                    // first argument is right under callee
+                    string args;
+
+                    for (size_t i = 0; i < argsNum; ++i) {
+                        if (stack[depth - 2 - i].type != CPP_NUMBER) return false;
+
+                        args += (args.empty() ? "" : ", ") + stack[depth - 2 - i].expression;
+                    }
+
+                    if (!hasReturnType) {
+                        hasReturnType = true;
+                        assumedNumberReturn = true;
+                        returnType = CPP_NUMBER;
+                    }
+
+                    string argsArray = "nullptr";
+
+                    if (argsNum > 0) {
+                        argsArray = temporary();
+                        out += indent + "const double " + argsArray + "[] = { " + args + " };\n";
+                    }
+
+                    string value = temporary();
+                    out += indent + "const double " + value + " = fast_" + to_string(declarationId) + "(" + argsArray + ", upvalues);\n";
+
+                    stack.resize(depth - 1 - argsNum);
+                    stack.push_back({ value, returnType });
+                }
+                break;
+            case F_RETURN:
+                {
+                    // value under result would stay on interpreter stack, empty stack would give null
+                    if (depth != 1 || stack.back().type == CPP_SELF) return false;
+
+                    if (!hasReturnType) {
+                        hasReturnType = true;
+                        returnType = stack.back().type;
+                    } else if (returnType != stack.back().type) return false;
+
+                    out += indent + "return " + stack.back().expression + ";\n";
+
+                    returned = true;
+                    return true;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+string CppEmitter::typedFunction(FuncDeclaration* declaration, int id) {
+    this->declaration = declaration;
+    declarationId = id;
+    upvalueTypes.clear();
+    temporaries = 0;
+    locals = 0;
+    hasReturnType = false;
+    assumedNumberReturn = false;
+    returnType = CPP_NUMBER;
+
+    // arguments are assumed to be numbers, wrapper checks it before every call
+    CppTypedState state;
+    string body;
+
+    for (size_t i = 0; i < declaration->argsIds.size(); ++i) {
+        string variable = "l" + to_string(locals++);
+        body += "    double " + variable + " = args[" + to_string(i) + "];\n";
+
+        state.locals[declaration->argsIds[i]] = { variable, CPP_NUMBER };
+    }
+
+    bool returned;
+
+    // falling out of function without return pushes nothing, interpreter keeps that
+    if (!typedBlock(declaration->bytecode, state, "    ", body, returned) || !returned) return "";
+    if (assumedNumberReturn && returnType != CPP_NUMBER) return "";
+
+    string name = "fast_" + to_string(id);
+
+    prototypes += "static double " + name + "(const double* args, const double* upvalues);\n";
+    definitions += "static double " + name + "(const double* args, const double* upvalues) {\n" + body + "}\n\n";
+
+    size_t argsNum = declaration->argsIds.size();
+    size_t upvaluesNum = declaration->upvalues.size();
+
+    string guards;
+
+    for (size_t i = 0; i < argsNum; ++i) {
+        guards += string(guards.empty() ? "" : " && ") + "aotNumberArgument(scope.get(), " + cppString(declaration->argsIds[i]) + ", args[" + to_string(i) + "])";
+    }
+
+    for (pair<int, CppValueType> upvalue: upvalueTypes) {
+        string index = to_string(upvalue.first);
+
+        if (upvalue.second == CPP_SELF) guards += string(guards.empty() ? "" : " && ") + "aotSelfUpvalue(closure.get(), " + index + ")";
+        else guards += string(guards.empty() ? "" : " && ") + "aotNumberUpvalue(closure.get(), " + index + ", upvalues[" + index + "])";
+    }
+
+    if (guards.empty()) guards = "true";
+
+    string result = name + "(args, upvalues)";
+    string push = returnType == CPP_BOOL ? "boolOperrand(" + result + " != 0.0)" : "makePooled<InstructionNumberOperrand>(" + result + ")";
+
+    return "    {\n"
+        "        double args[" + to_string(max(argsNum, (size_t)1)) + "] = {};\n"
+        "        double upvalues[" + to_string(max(upvaluesNum, (size_t)1)) + "] = {};\n\n"
+        "        if (" + guards + ") {\n"
+        "            vm->push(" + push + ");\n"
+        "            return true;\n"
+        "        }\n"
+        "    }\n\n";
+}
+
+string CppEmitter::emit(shared_ptr<FuncDeclaration> program, string source) {
+    string main = blockFunction(program->bytecode, *program->tables);
+
+    string out;
+
+    out += "// generated by femic --emit-cpp from " + source + "\n\n";
+    out += "#include <iostream>\n#include <limits>\n#include <memory>\n\n";
+    out += "#include \"include/fvm.h\"\n#include \"include/aot.h\"\n\n";
+    out += "using namespace std;\n\n";
+
+    // never freed: operrands must outlive static destructors of runtime pools
+    out += "static Instruction* code = new Instruction[" + to_string(instructions) + "];\n";
+    out += "static shared_ptr<FuncDeclaration>* functions = new shared_ptr<FuncDeclaration>[" + to_string(functions.size()) + "];\n";
+    out += "static shared_ptr<CodeTables>* tables = new shared_ptr<CodeTables>[" + to_string(tables.size()) + "];\n\n";
+
+    out += prototypes + "\n" + definitions;
+
+    out += "static void setup() {\n"
+        "    for (size_t i = 0; i < " + to_string(tables.size()) + "; ++i) tables[i] = make_shared<CodeTables>();\n\n"
+        + functionsSetup + (functionsSetup.empty() ? "" : "\n") + tablesSetup + (tablesSetup.empty() ? "" : "\n") + instructionsSetup + "}\n\n";
+
+    out += "int main() {\n"
+        "    setup();\n\n"
+        "    FVM vm(false);\n\n"
+        "    try {\n"
+        "        " + main + "(&vm, vm.globals, make_shared<Scope>(), nullptr);\n"
+        "    } catch (const exception& e) {\n"
+        "        cerr << " + cppString(source) + " << \": \" << e.what() << endl;\n"
+        "        return 1;\n"
+        "    }\n\n"
+        "    return 0;\n"
+        "}\n";
+
+    return out;
+}
@@ -2,12 +2,38 @@
 #define BGENERATOR_H
 
 #include <vector>
+#include <map>
+#include <memory>
 
 #include "parser.h"
 #include "../../include/fvm.h"
 
 using namespace std;
 
+// owned by shared_ptr, function compiled on first call keeps its context and contexts around it
+struct FunctionContext : enable_shared_from_this<FunctionContext> {
+    shared_ptr<FunctionContext> enclosing;
+
+    // id -> how many times it is assigned in function (args counted once)
+    map<string, int> locals;
+    vector<UpvalueDescriptor> upvalues;
+};
+
+struct ConstantPool {
+    // canonical literal text -> pooled constant, identical literals of module share one entry
+    map<string, shared_ptr<InstructionConstantOperrand>> entries;
+    vector<shared_ptr<InstructionConstantOperrand>> constants;
+};
+
+// tables of function being generated, shared by generators of its IF blocks
+struct CodeTablesBuilder {
+    shared_ptr<CodeTables> tables = make_shared<CodeTables>();
+
+    // literal key (same as constant pool) -> index in constants, name -> index in names
+    map<string, uint32_t> literals;
+    map<string, uint32_t> names;
+};
+
 class BytecodeGenerator {
     public:
         vector<Instruction> bytecode;
@@ -15,10 +41,49 @@ class BytecodeGenerator {
         bool addAnd;
         
         BlockNode* root;
-        BytecodeGenerator(BlockNode* root);
+
+        FunctionContext* context;
+        shared_ptr<map<string, int>> globals;
+        shared_ptr<ConstantPool> constants;
+        shared_ptr<CodeTablesBuilder> tables;
+
+        // paths of `using` in module, in order, compiler links them before module
+        shared_ptr<vector<string>> imports;
+
+        // source file of module, for allocation sites
+        string path;
+
+        // --eager-compile: function bodies are generated with module, otherwise on first call
+        bool eager = false;
+
+        BytecodeGenerator(BlockNode* root, string path = "");
+        BytecodeGenerator(BlockNode* root, FunctionContext* context, shared_ptr<map<string, int>> globals, shared_ptr<ConstantPool> constants, shared_ptr<CodeTablesBuilder> tables);
         
         void visitNode(AstNode* node);
         vector<Instruction> generate();
+
+        shared_ptr<InstructionOperrand> getOperrandFromNode(AstNode* node);
+        shared_ptr<InstructionFunctionOperrand> compileFunction(FnDefineNode* fnDefine, bool isMethod = false);
+        shared_ptr<FunctionContext> functionContext(FnDefineNode* fnDefine, bool isMethod, FunctionContext* enclosing);
+
+        // upvalues of function body which is not generated yet, resolved like emitGet/emitSet would do it
+        void resolveNames(AstNode* node, FunctionContext* function);
+        void resolveName(string id, FunctionContext* function, bool isSet);
+        shared_ptr<InstructionConstantOperrand> getConstant(AstNode* node);
+
+        const AllocationSite* getSite(Token* token);
+
+        // entries of tables, index is argument of instruction
+        uint32_t addConstant(shared_ptr<InstructionOperrand> operrand, const AllocationSite* site = nullptr);
+        uint32_t addLiteral(LiteralNode* literal);
+        uint32_t addName(string id);
+        uint32_t addBranch(IfStatement statement);
+
+        int resolveUpvalue(FunctionContext* function, string id);
+        bool isVisible(FunctionContext* function, string id);
+
+        void emitGet(string id);
+        void emitSet(string id);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,14 +2,81 @@
 #define COMPILER_H
 
 #include <vector>
+#include <map>
+#include <set>
+#include <exception>
+#include <ostream>
+#include <mutex>
+#include <future>
 
 #include "../../include/fvm.h"
 
 using namespace std;
 
+// module compiled on its own: top level is function without arguments, `using` only lists modules to run before it
+struct CompiledModule {
+    shared_ptr<FuncDeclaration> body;
+    vector<string> imports;
+
+    // compile error, thrown when module is linked, so first error in link order is reported
+    exception_ptr error;
+};
+
+// top level definition of module removed by tree shaking, program never reads its name
+struct ShakenDefinition {
+    string module;
+    string name;
+
+    // function, object or array
+    string kind;
+};
+
+// modules compiled in this process by canonical path, compilers of --jobs share them; module is only read after
+// it is compiled, code which VMs change while running (feedback of instructions, jitted functions) is safe to share
+struct ModuleRegistry {
+    mutex lock;
+    map<string, shared_future<CompiledModule>> modules;
+};
+
 class Compiler {
+    private:
+        // canonical path -> module, every module is compiled once per program
+        map<string, CompiledModule> modules;
+
+        // file of module through registry and --module-cache, does not touch modules, so runs on any thread
+        CompiledModule loadModule(string path, string canonical);
+        CompiledModule readModule(string path, string canonical);
+
+        // modules reachable from paths are compiled on threads, every thread takes next module from shared queue
+        void compileModules(const vector<string>& paths, string program);
+
+        CompiledModule& import(string path);
+        void collectModules(string path, set<string>& visited, vector<CompiledModule*>& order);
     public:
-        vector<Instruction> compile(string code);
+        // --module-cache: directory where compiled modules are kept between runs, empty - only memory
+        string moduleCache;
+
+        // threads compiling modules, 0 - one per core
+        size_t threads = 0;
+
+        // set when several programs are compiled in one process (--jobs), null - modules of this compiler only
+        shared_ptr<ModuleRegistry> registry;
+
+        // --eager-compile: bodies of functions are generated with module, not on first call
+        bool eager = false;
+
+        // --no-tree-shake turns it off: unread functions and literals of modules are not defined at startup
+        bool treeShake = true;
+        vector<ShakenDefinition> shaken;
+
+        // --tree-shake-report
+        void printShakeReport(ostream& out);
+
+        // top level of module is function without arguments, path is only used for allocation sites of --heap-profile;
+        // modules of `using` are linked before program, each once, dependencies first
+        shared_ptr<FuncDeclaration> compile(string code, string path = "");
+
+        CompiledModule compileModule(string code, string path);
 };
 
 #endif
@@ -0,0 +1,78 @@
+#ifndef CPPEMITTER_H
+#define CPPEMITTER_H
+
+#include <vector>
+#include <map>
+#include <string>
+
+#include "../../include/fvm.h"
+
+using namespace std;
+
+// values of typed function, booleans are kept as doubles (false - 0.0, true - 1.0)
+enum CppValueType {
+    CPP_NUMBER,
+    CPP_BOOL,
+
+    // closure which is being called, only usable by CALL (recursion)
+    CPP_SELF,
+};
+
+struct CppValue {
+    // C++ expression (literal, temporary or local variable)
+    string expression;
+    CppValueType type;
+};
+
+struct CppTypedState {
+    vector<CppValue> stack;
+
+    // id -> C++ variable
+    map<string, CppValue> locals;
+};
+
+// Ahead-of-time backend (--emit-cpp): every block becomes C++ function which calls FVM::execute for its
+// instructions with IF as native branch, functions over numbers get typed body on plain doubles
+class CppEmitter {
+    private:
+        // statements of setup(), they fill code[], functions[] and tables[]
+        string functionsSetup;
+        string tablesSetup;
+        string instructionsSetup;
+
+        string prototypes;
+        string definitions;
+
+        size_t instructions = 0;
+        size_t blocks = 0;
+
+        map<FuncDeclaration*, int> functions;
+        map<CodeTables*, int> tables;
+
+        // typed function being emitted
+        FuncDeclaration* declaration = nullptr;
+        int declarationId = 0;
+        map<int, CppValueType> upvalueTypes;
+        size_t temporaries = 0;
+        size_t locals = 0;
+        bool hasReturnType = false;
+        bool assumedNumberReturn = false;
+        CppValueType returnType = CPP_NUMBER;
+
+        string operrand(shared_ptr<InstructionOperrand> operrand);
+        size_t instruction(const Instruction& code);
+        int function(shared_ptr<FuncDeclaration> declaration);
+        int table(CodeTables& tables);
+
+        string block(const vector<Instruction>& bytecode, CodeTables& tables, bool& returned);
+        string blockFunction(const vector<Instruction>& bytecode, CodeTables& tables);
+
+        string temporary();
+        bool typedBlock(const vector<Instruction>& bytecode, CppTypedState& state, string indent, string& out, bool& returned);
+        string typedFunction(FuncDeclaration* declaration, int id);
+    public:
+        // translation unit with main(), built against runtime of femic (src/fvm.cpp and others)
+        string emit(shared_ptr<FuncDeclaration> program, string source);
+};
+
+#endif
@@ -138,6 +138,7 @@ struct FnDefineNode : AstNode {
 
 struct ArrayNode : AstNode {
     vector<AstNode*> elements;
+    Token* token;
 
     ArrayNode() = default;
 
@@ -148,6 +149,7 @@ struct ArrayNode : AstNode {
 
 struct ObjectNode : AstNode {
     map<AstNode*, AstNode*> fields;
+    Token* token;
 
     ObjectNode() = default;
 
@@ -159,6 +161,7 @@ struct ObjectNode : AstNode {
 struct IndexationNode : AstNode {
     AstNode* index;
     AstNode* where;
+    Token* token;
 
     IndexationNode() = default;
 
@@ -179,11 +182,23 @@ struct IfStatementNode : AstNode {
     }
 };
 
+struct ForInNode : AstNode {
+    IdentifierNode* id;
+    AstNode* iterable;
+    BlockNode* block;
+
+    ForInNode() = default;
+
+    string tostr() override {
+        return "[ for in: " + id->tostr() + " | " + iterable->tostr() + " ]";
+    }
+};
+
 
 class Parser {
     private:
         vector<Token*> _tokens;
-        int _position;
+        size_t _position;
 
         vector<TokenType> unaryOperationsTokens;
         vector<TokenType> binaryOperationsTokens;
@@ -204,12 +219,14 @@ class Parser {
         IdentifierNode* parseIdentifier();
 
         IfStatementNode* parseIfStatement();
+        ForInNode* parseForIn();
         ParenthisizedNode* parseParenthisized(bool onlyAtom = false, bool noParenthisized = false);
         LiteralNode* parseLiteral();
         BlockNode* parseBlock();
 
         AstNode* prioritable(AstNode* left = nullptr);
         AstNode* parseBinaryOperation(AstNode* left);
+        AstNode* sum();
 
         ConditionNode* parseCondition(AstNode* left);
 
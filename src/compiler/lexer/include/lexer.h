@@ -12,7 +12,7 @@ string getTokenTypeString(int type);
 
 class Lexer {
     private:
-        array<pair<string, TokenType>, 39> _tokenTypesPatterns;
+        array<pair<string, TokenType>, 48> _tokenTypesPatterns;
 
         vector<Token*> _tokens;
         string _code;
@@ -33,12 +33,19 @@ enum TokenType {
     RETURN,
     DELAY,
     OUTPUT,
+    YIELD,
 
     ASSIGN, 
     PLUS,
     MINUS, 
     MUL, 
     DIV, 
+    MOD,
+    SHIFT_LEFT,
+    SHIFT_RIGHT,
+    BIT_AND,
+    BIT_OR,
+    BIT_XOR,
     EQ, 
     NOTEQ, 
     BIGGER, 
@@ -51,6 +58,9 @@ enum TokenType {
     IF,
     ELSE,
 
+    FOR,
+    IN,
+
     BEGIN,
     END,
 
@@ -65,6 +75,9 @@ class Token {
     public:
         string value;
 
+        // 1-based source line, set by lexer
+        int line = 0;
+
         Token(string value, TokenType type, int position, int endPosition);
         Token() = default;
         
@@ -52,6 +52,18 @@ string getTokenTypeString(int type) {
             return "DIV";
         case MUL:
             return "MUL";
+        case MOD:
+            return "MOD";
+        case SHIFT_LEFT:
+            return "SHIFT_LEFT";
+        case SHIFT_RIGHT:
+            return "SHIFT_RIGHT";
+        case BIT_AND:
+            return "BIT_AND";
+        case BIT_OR:
+            return "BIT_OR";
+        case BIT_XOR:
+            return "BIT_XOR";
         case DEF:
             return "DEF";
         case EQ:
@@ -82,6 +94,10 @@ string getTokenTypeString(int type) {
             return "IF";
         case ELSE:
             return "ELSE";
+        case FOR:
+            return "FOR";
+        case IN:
+            return "IN";
         case END:
             return "END";
         case RETURN:
@@ -90,6 +106,8 @@ string getTokenTypeString(int type) {
             return "DELAY";
         case OUTPUT:
             return "OUTPUT";
+        case YIELD:
+            return "YIELD";
         case USING:
             return "USING";
         default:
@@ -105,12 +123,12 @@ Lexer::Lexer(string code) {
     _code = code;
 
     _tokenTypesPatterns = {
-        make_pair("\".+?\"", STRING),
-        make_pair("\'.+?\'", STRING),
+        make_pair("\".*?\"", STRING),
+        make_pair("\'.*?\'", STRING),
 
-        make_pair("true", TRUE),
-        make_pair("false", FALSE),
-        make_pair("null", NULLT),
+        make_pair("\\btrue\\b", TRUE),
+        make_pair("\\bfalse\\b", FALSE),
+        make_pair("\\bnull\\b", NULLT),
 
         make_pair(";", SEMICOLON),
         make_pair("\\s+", WHITESPACE),
@@ -131,10 +149,14 @@ Lexer::Lexer(string code) {
         make_pair("\\-", MINUS),
         make_pair("\\/", DIV),
         make_pair("\\*", MUL),
+        make_pair("%", MOD),
 
         make_pair("!=", NOTEQ),
         make_pair("==", EQ),
 
+        make_pair("<<", SHIFT_LEFT),
+        make_pair(">>", SHIFT_RIGHT),
+
         make_pair(">=", BIGGER_OR_EQ),
         make_pair("<=", SMALLER_OR_EQ),
 
@@ -143,21 +165,29 @@ Lexer::Lexer(string code) {
         make_pair(">", BIGGER),
         make_pair("<", SMALLER),
 
+        make_pair("&&", BIT_AND),
+        make_pair("\\|", BIT_OR),
+        make_pair("\\^", BIT_XOR),
+
         make_pair("&", AND),
         make_pair("\\?", OR),
 
         make_pair(":", BEGIN),
-        make_pair("end", END),
-        make_pair("fn", DEF),
+        make_pair("\\bend\\b", END),
+        make_pair("\\bfn\\b", DEF),
         
-        make_pair("if", IF),
-        make_pair("else", ELSE),
+        make_pair("\\bif\\b", IF),
+        make_pair("\\belse\\b", ELSE),
+
+        make_pair("\\bfor\\b", FOR),
+        make_pair("\\bin\\b", IN),
 
-        make_pair("return", RETURN),
-        make_pair("delay", DELAY),
-        make_pair("output", OUTPUT),
+        make_pair("\\breturn\\b", RETURN),
+        make_pair("\\bdelay\\b", DELAY),
+        make_pair("\\boutput\\b", OUTPUT),
+        make_pair("\\byield\\b", YIELD),
 
-        make_pair("using", USING),
+        make_pair("\\busing\\b", USING),
 
         make_pair("[a-zA-Z_][a-zA-Z0-9_]*", ID),
         make_pair("[+-]?([0-9]*[.])?[0-9]+", NUMBER),
@@ -218,6 +248,17 @@ vector<Token*> Lexer::tokenize(bool logs) {
 
     sort(tokens.begin(), tokens.end(), compareTokens);
 
+    int line = 1;
+    size_t scanned = 0;
+
+    for (Token* token: tokens) {
+        for (; scanned < (size_t)token->getPosition(); ++scanned) {
+            if (_code[scanned] == '\n') line++;
+        }
+
+        token->line = line;
+    }
+
     for (Token* token: tokens) {
         if (token->getType() == STRING) {
             token->value = token->value.substr(1, token->value.length() - 2);
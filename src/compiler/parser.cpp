@@ -18,13 +18,20 @@ Parser::Parser(vector<Token*> tokens) {
         DELAY,
         OUTPUT,
         USING,
+        YIELD,
     };
 
     binaryOperationsTokens = {
         MUL,
         DIV,
+        MOD,
         PLUS, 
         MINUS,
+        SHIFT_LEFT,
+        SHIFT_RIGHT,
+        BIT_AND,
+        BIT_OR,
+        BIT_XOR,
     };
 
     conditionTokens = {
@@ -85,7 +92,7 @@ bool Parser::match(vector<TokenType> tokenTypes) {
 }
 
 bool Parser::lookMatch(vector<TokenType> tokenTypes, int offset) {
-    int position = _position + offset;
+    size_t position = _position + offset;
 
     if (position >= _tokens.size()) return false;
     
@@ -160,6 +167,7 @@ AstNode* Parser::parseExpression(bool onlyAtom, bool noParenthisized) {
     };
     if (match({ LOBJECT_BRACKET }) && !node) node = parseObject();
     if (match({ IF }) && !node) node = parseIfStatement();
+    if (match({ FOR }) && !node) node = parseForIn();
     if (match({ LBRACKET }) && !node) {
         if (!noParenthisized) node = parseParenthisized(onlyAtom, noParenthisized);
         else {
@@ -182,7 +190,7 @@ AstNode* Parser::parseExpression(bool onlyAtom, bool noParenthisized) {
 
 
 ObjectNode* Parser::parseObject() {
-    eat({ LOBJECT_BRACKET });
+    Token* token = eat({ LOBJECT_BRACKET });
 
     map<AstNode*, AstNode*> fields;
 
@@ -199,6 +207,7 @@ ObjectNode* Parser::parseObject() {
 
     ObjectNode* node = new ObjectNode();
     node->fields = fields;
+    node->token = token;
 
     return node;
 }
@@ -207,7 +216,7 @@ IndexationNode* Parser::parseIndexation(AstNode* where) {
     bool isSquarable = false;
     if (match({ LSQUARE_BRACKET })) isSquarable = true;
 
-    eat({ LSQUARE_BRACKET, DOT });
+    Token* token = eat({ LSQUARE_BRACKET, DOT });
 
     AstNode* index = isSquarable ? parseExpression() : parseIdentifier();
 
@@ -216,6 +225,7 @@ IndexationNode* Parser::parseIndexation(AstNode* where) {
     IndexationNode* node = new IndexationNode();
     node->index = index;
     node->where = where;
+    node->token = token;
 
     if (auto identifier = dynamic_cast<IdentifierNode*>(index)) {
         LiteralNode* literal = new LiteralNode();
@@ -253,7 +263,7 @@ AssignmentNode* Parser::parseAssignment(AstNode* id) {
 }
 
 ArrayNode* Parser::parseArray() {
-    eat({ LSQUARE_BRACKET });
+    Token* token = eat({ LSQUARE_BRACKET });
 
     vector<AstNode*> elements;
 
@@ -275,6 +285,7 @@ ArrayNode* Parser::parseArray() {
 
     ArrayNode* node = new ArrayNode();
     node->elements = elements;
+    node->token = token;
 
     return node;
 }
@@ -303,6 +314,26 @@ IfStatementNode* Parser::parseIfStatement() {
     return statement;
 }
 
+ForInNode* Parser::parseForIn() {
+    eat({ FOR });
+
+    if (!match({ ID })) throw runtime_error("Syntax error, after for needs variable");
+
+    IdentifierNode* id = parseIdentifier();
+    eat({ IN });
+
+    AstNode* iterable = parseExpression();
+
+    if (!iterable) throw runtime_error("Syntax error, after in needs value to iterate");
+
+    ForInNode* statement = new ForInNode();
+    statement->id = id;
+    statement->iterable = iterable;
+    statement->block = parseBlock();
+
+    return statement;
+}
+
 ParenthisizedNode* Parser::parseParenthisized(bool onlyAtom, bool noParenthisized)  {
     eat({ LBRACKET });
 
@@ -337,7 +368,7 @@ UnaryOperationNode* Parser::parseUnaryOperation() {
 }
 
 BlockNode* Parser::parseBlock() {
-    Token* begin = eat({ BEGIN });
+    eat({ BEGIN });
 
     vector<AstNode*> blockNodes = {};
     BlockNode* block = new BlockNode();
@@ -355,7 +386,7 @@ BlockNode* Parser::parseBlock() {
         if (match({ SEMICOLON })) eat({ SEMICOLON });
     }
 
-    Token* end = eat({ END });
+    eat({ END });
 
     block->nodes = blockNodes;
 
@@ -389,6 +420,27 @@ AstNode* Parser::parseBinaryOperation(AstNode* left) {
 
             continue;
         }
+
+        // shifts and bitwise operators take whole sum as right operrand
+        if (match({ SHIFT_LEFT, SHIFT_RIGHT, BIT_AND, BIT_OR, BIT_XOR })) {
+            if (!isParsed) left = prioritable(left);
+
+            BinaryOperationNode* bin = new BinaryOperationNode();
+            bin->left = left;
+            bin->operatorToken = eat({ SHIFT_LEFT, SHIFT_RIGHT, BIT_AND, BIT_OR, BIT_XOR });
+            bin->right = sum();
+
+            left = bin;
+
+            isParsed = true;
+
+            while (lbrackets > 0) {
+                eat({ RBRACKET });
+                lbrackets--;
+            }
+
+            continue;
+        }
         break;
     }
 
@@ -397,6 +449,21 @@ AstNode* Parser::parseBinaryOperation(AstNode* left) {
     return left;
 };
 
+AstNode* Parser::sum() {
+    AstNode* left = prioritable();
+
+    while (match({ PLUS, MINUS })) {
+        BinaryOperationNode* bin = new BinaryOperationNode();
+        bin->left = left;
+        bin->operatorToken = eat({ PLUS, MINUS });
+        bin->right = prioritable();
+
+        left = bin;
+    }
+
+    return left;
+}
+
 AstNode* Parser::prioritable(AstNode* receivedLeft) {
     int lbrackets = 0;
     while (match({ LBRACKET })) {
@@ -408,10 +475,10 @@ AstNode* Parser::prioritable(AstNode* receivedLeft) {
     if (!left) left = parseExpression(true, true);
 
     while (true) {
-        if (match({ MUL, DIV })) {
+        if (match({ MUL, DIV, MOD })) {
             BinaryOperationNode* bin = new BinaryOperationNode();
             bin->left = left;
-            bin->operatorToken = eat({ MUL, DIV });
+            bin->operatorToken = eat({ MUL, DIV, MOD });
             bin->right = parseExpression(true, true);
 
             left = bin;
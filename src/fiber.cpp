@@ -0,0 +1,560 @@
+#include <set>
+
+#include "include/fiber.h"
+#include "include/persistent.h"
+#include "include/jit.h"
+#include "include/generator.h"
+#include "include/typedArray.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <ucontext.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// virtual size of stack of coroutine, memory is taken only for pages it uses
+const size_t FIBER_STACK_SIZE = 8 * 1024 * 1024;
+
+// scheduler of thread and its queue, other threads (program) put fibers to shared queue
+thread_local FiberScheduler* currentScheduler = nullptr;
+thread_local size_t currentQueue = 0;
+
+// fiber which runs on this thread, null for program
+thread_local Fiber* currentFiber = nullptr;
+
+shared_ptr<UpvalueCell> transferCell(shared_ptr<UpvalueCell> cell, FVM* target, FiberCopies& copies) {
+    auto known = copies.cells.find(cell.get());
+    if (known != copies.cells.end()) return known->second;
+
+    shared_ptr<UpvalueCell> copy = makePooled<UpvalueCell>();
+    copies.cells[cell.get()] = copy;
+
+    copy->value = transfer(cell->value, target, copies);
+
+    return copy;
+}
+
+shared_ptr<InstructionOperrand> transfer(shared_ptr<InstructionOperrand> value, FVM* target, FiberCopies& copies) {
+    // rope is joined by thread which made it, other thread only reads its text
+    if (auto text = dynamic_cast<InstructionStringOperrand*>(value.get())) text->text();
+
+    // typed arrays hold no references, but mutable ones must not be shared between threads
+    auto typed = dynamic_pointer_cast<InstructionTypedArrayOperrand>(value);
+
+    if (!value || (!value->hasReferences() && (!typed || typed->frozen))) return value;
+
+    auto known = copies.values.find(value.get());
+    if (known != copies.values.end()) return known->second;
+
+    if (typed) {
+        shared_ptr<InstructionOperrand> copy = typed->copy(false);
+        copies.values[value.get()] = copy;
+
+        return copy;
+    }
+
+    // body of generator runs on stack of its VM
+    if (dynamic_pointer_cast<InstructionGeneratorOperrand>(value)) throw runtime_error("FVM: GENERATOR CANNOT BE PASSED TO OTHER FIBER");
+
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) {
+        auto elements = makePooled<OperrandVector>(array->operrand->size());
+        auto copy = makePooled<InstructionArrayOperrand>(elements);
+
+        copy->site = array->site;
+        copies.values[value.get()] = copy;
+
+        for (size_t i = 0; i < elements->size(); ++i) (*elements)[i] = transfer((*array->operrand)[i], target, copies);
+
+        if (target) target->gc.track(copy);
+
+        return copy;
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(value)) {
+        auto fields = makePooled<OperrandMap>();
+        auto copy = makePooled<InstructionObjectOperrand>(fields);
+
+        copy->site = object->site;
+        copies.values[value.get()] = copy;
+
+        for (auto& field: *object->operrand) fields->insert({ field.first, transfer(field.second, target, copies) });
+
+        if (target) target->gc.track(copy);
+
+        return copy;
+    } else if (auto function = dynamic_pointer_cast<InstructionFunctionOperrand>(value)) {
+        auto copy = makePooled<InstructionFunctionOperrand>(function->operrand);
+        copies.values[value.get()] = copy;
+
+        for (shared_ptr<UpvalueCell>& cell: function->upvalues) copy->upvalues.push_back(transferCell(cell, target, copies));
+
+        if (target) target->gc.track(copy);
+
+        return copy;
+    } else if (auto array = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(value)) {
+        // frozen collections cannot form cycles, only functions inside them are copied
+        vector<shared_ptr<InstructionOperrand>> elements;
+        array->operrand.forEach([&](shared_ptr<InstructionOperrand> element) { elements.push_back(transfer(element, target, copies)); });
+
+        auto copy = makePooled<InstructionFrozenArrayOperrand>(PersistentVector(elements), true);
+        copies.values[value.get()] = copy;
+
+        return copy;
+    } else if (auto object = dynamic_pointer_cast<InstructionFrozenObjectOperrand>(value)) {
+        PersistentMap fields;
+        object->operrand.forEach([&](string key, shared_ptr<InstructionOperrand> field) { fields = fields.set(key, transfer(field, target, copies)); });
+
+        auto copy = makePooled<InstructionFrozenObjectOperrand>(fields, true);
+        copies.values[value.get()] = copy;
+
+        return copy;
+    }
+
+    return value;
+}
+
+void adoptInto(shared_ptr<InstructionOperrand> value, FVM* target, set<InstructionOperrand*>& seen) {
+    if (!value || !value->hasReferences() || !seen.insert(value.get()).second) return;
+
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) {
+        for (shared_ptr<InstructionOperrand>& element: *array->operrand) adoptInto(element, target, seen);
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(value)) {
+        for (auto& field: *object->operrand) adoptInto(field.second, target, seen);
+    } else if (auto function = dynamic_pointer_cast<InstructionFunctionOperrand>(value)) {
+        for (shared_ptr<UpvalueCell>& cell: function->upvalues) adoptInto(cell->value, target, seen);
+    } else if (auto array = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(value)) {
+        // frozen collections are not tracked, only functions inside them
+        array->operrand.forEach([&](shared_ptr<InstructionOperrand> element) { adoptInto(element, target, seen); });
+        return;
+    } else if (auto object = dynamic_pointer_cast<InstructionFrozenObjectOperrand>(value)) {
+        object->operrand.forEach([&](string key, shared_ptr<InstructionOperrand> field) { adoptInto(field, target, seen); });
+        return;
+    }
+
+    target->gc.track(value);
+}
+
+void adopt(shared_ptr<InstructionOperrand> value, FVM* target) {
+    set<InstructionOperrand*> seen;
+    adoptInto(value, target, seen);
+}
+
+void Fiber::run() {
+    try {
+        vector<shared_ptr<InstructionOperrand>> args;
+
+        result = task ? task(vm.get()) : vm->call(function, args);
+    } catch (...) {
+        error = current_exception();
+    }
+}
+
+#ifdef _WIN32
+
+struct FiberContext {
+    function<void()> body;
+    bool returned = false;
+
+    void* handle = nullptr;
+    // fiber which resumed context, and where context was suspended (it can be suspended by fiber running on its stack)
+    void* caller = nullptr;
+    void* suspended = nullptr;
+
+    ~FiberContext() { if (handle) DeleteFiber(handle); };
+};
+
+void WINAPI contextEntry(void* parameter) {
+    FiberContext* context = static_cast<FiberContext*>(parameter);
+
+    context->body();
+    context->returned = true;
+
+    SwitchToFiber(context->caller);
+}
+
+shared_ptr<FiberContext> makeContext(function<void()> body) {
+    shared_ptr<FiberContext> context = make_shared<FiberContext>();
+    context->body = body;
+
+    context->handle = CreateFiberEx(64 * 1024, FIBER_STACK_SIZE, 0, contextEntry, context.get());
+    if (!context->handle) throw runtime_error("FVM: CANNOT ALLOCATE STACK OF COROUTINE");
+
+    return context;
+}
+
+void resumeContext(FiberContext* context) {
+    if (!IsThreadAFiber()) ConvertThreadToFiber(nullptr);
+
+    context->caller = GetCurrentFiber();
+    SwitchToFiber(context->suspended ? context->suspended : context->handle);
+}
+
+void suspendContext(FiberContext* context) {
+    context->suspended = GetCurrentFiber();
+    SwitchToFiber(context->caller);
+}
+
+#else
+
+struct FiberContext {
+    function<void()> body;
+    bool returned = false;
+
+    ucontext_t context;
+    ucontext_t caller;
+    void* stack = nullptr;
+
+    ~FiberContext() { if (stack) munmap(stack, FIBER_STACK_SIZE); };
+};
+
+// context which is started now, makecontext passes only int arguments
+thread_local FiberContext* startingContext = nullptr;
+
+// returns to caller by uc_link
+void contextEntry() {
+    FiberContext* context = startingContext;
+
+    context->body();
+    context->returned = true;
+}
+
+shared_ptr<FiberContext> makeContext(function<void()> body) {
+    shared_ptr<FiberContext> context = make_shared<FiberContext>();
+    context->body = body;
+
+    // pages are taken when stack grows to them, lowest one stops overflow
+    context->stack = mmap(nullptr, FIBER_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+
+    if (context->stack == MAP_FAILED) {
+        context->stack = nullptr;
+        throw runtime_error("FVM: CANNOT ALLOCATE STACK OF COROUTINE");
+    }
+
+    mprotect(context->stack, 4096, PROT_NONE);
+
+    getcontext(&context->context);
+    context->context.uc_stack.ss_sp = context->stack;
+    context->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    context->context.uc_link = &context->caller;
+
+    makecontext(&context->context, contextEntry, 0);
+
+    return context;
+}
+
+void resumeContext(FiberContext* context) {
+    startingContext = context;
+    swapcontext(&context->caller, &context->context);
+}
+
+void suspendContext(FiberContext* context) {
+    swapcontext(&context->context, &context->caller);
+}
+
+#endif
+
+bool contextReturned(FiberContext* context) {
+    return context->returned;
+}
+
+FiberScheduler::FiberScheduler(size_t threads) {
+    for (size_t i = 0; i <= threads; ++i) queues.push_back(make_unique<FiberQueue>());
+    for (size_t i = 0; i < threads; ++i) workers.push_back(thread(&FiberScheduler::work, this, i));
+}
+
+FiberScheduler::~FiberScheduler() {
+    shutdown();
+}
+
+void FiberScheduler::submit(shared_ptr<Fiber> fiber) {
+    size_t queue = currentScheduler == this ? currentQueue : queues.size() - 1;
+
+    {
+        lock_guard<mutex> guard(queues[queue]->lock);
+        queues[queue]->fibers.push_back(fiber);
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        queued++;
+        live++;
+    }
+
+    changed.notify_all();
+}
+
+shared_ptr<Fiber> FiberScheduler::take(size_t queue) {
+    FiberQueue& fibers = *queues[queue];
+    lock_guard<mutex> guard(fibers.lock);
+
+    if (fibers.fibers.empty()) return nullptr;
+
+    shared_ptr<Fiber> fiber;
+
+    // owner takes newest fiber (its data is still in cache), thieves take oldest
+    if (queue == currentQueue) {
+        fiber = fibers.fibers.back();
+        fibers.fibers.pop_back();
+    } else {
+        fiber = fibers.fibers.front();
+        fibers.fibers.pop_front();
+    }
+
+    return fiber;
+}
+
+bool FiberScheduler::runOne() {
+    FiberQueue& own = *queues[currentQueue];
+    shared_ptr<Fiber> fiber;
+
+    // suspended fibers first, they hold stacks
+    {
+        lock_guard<mutex> guard(lock);
+
+        if (!own.resumed.empty()) {
+            fiber = own.resumed.front();
+            own.resumed.pop_front();
+        }
+    }
+
+    if (!fiber) {
+        fiber = take(currentQueue);
+        for (size_t i = 1; !fiber && i < queues.size(); ++i) fiber = take((currentQueue + i) % queues.size());
+
+        if (!fiber) return false;
+
+        lock_guard<mutex> guard(lock);
+        queued--;
+    }
+
+    resume(fiber);
+
+    return true;
+}
+
+void FiberScheduler::resume(shared_ptr<Fiber> fiber) {
+    if (fiber->state == FIBER_PENDING) {
+        fiber->state = FIBER_RUNNING;
+        fiber->home = currentQueue;
+
+        Fiber* started = fiber.get();
+        fiber->context = makeContext([started]() { started->run(); });
+    }
+
+    // thread locals of VM go with fiber
+    HeapAccount* account = currentAccount;
+    size_t* allocations = opcodeAllocations;
+    int opcode = currentOpcode;
+
+    currentAccount = fiber->account;
+    opcodeAllocations = fiber->allocations;
+    currentOpcode = fiber->opcode;
+    currentFiber = fiber.get();
+
+    resumeContext(fiber->context.get());
+
+    currentFiber = nullptr;
+    fiber->account = currentAccount;
+    fiber->allocations = opcodeAllocations;
+    fiber->opcode = currentOpcode;
+
+    currentAccount = account;
+    opcodeAllocations = allocations;
+    currentOpcode = opcode;
+
+    if (!contextReturned(fiber->context.get())) return;
+
+    fiber->context.reset();
+
+    {
+        lock_guard<mutex> guard(lock);
+
+        fiber->state = FIBER_DONE;
+        live--;
+
+        wake(fiber->joiners);
+    }
+
+    changed.notify_all();
+}
+
+void FiberScheduler::suspend(Fiber* fiber) {
+    suspendContext(fiber->context.get());
+}
+
+void FiberScheduler::wake(FiberWaitList& waiting) {
+    for (shared_ptr<Fiber>& fiber: waiting) queues[fiber->home]->resumed.push_back(fiber);
+
+    waiting.clear();
+}
+
+void FiberScheduler::work(size_t index) {
+    currentScheduler = this;
+    currentQueue = index;
+
+    FiberQueue& own = *queues[index];
+
+    while (true) {
+        auto now = chrono::steady_clock::now();
+
+        if (!own.timers.empty() && own.timers.top().deadline <= now) {
+            lock_guard<mutex> guard(lock);
+
+            while (!own.timers.empty() && own.timers.top().deadline <= now) {
+                own.resumed.push_back(own.timers.top().fiber);
+                own.timers.pop();
+            }
+        }
+
+        if (runOne()) continue;
+
+        unique_lock<mutex> guard(lock);
+        auto ready = [&]() { return queued > 0 || !own.resumed.empty() || (stopping && live == 0); };
+
+        if (own.timers.empty()) changed.wait(guard, ready);
+        else changed.wait_until(guard, own.timers.top().deadline, ready);
+
+        if (stopping && live == 0) return;
+    }
+}
+
+void FiberScheduler::join(Fiber* fiber) {
+    block([&]() { return fiber->state == FIBER_DONE; }, fiber->joiners);
+}
+
+void FiberScheduler::block(function<bool()> ready, FiberWaitList& waiting) {
+    Fiber* fiber = currentFiber;
+
+    if (!fiber) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, ready);
+
+        return;
+    }
+
+    while (true) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (ready()) return;
+
+            waiting.push_back(fiber->shared_from_this());
+        }
+
+        // notify() puts fiber to resumed of this thread, it is taken only after suspend
+        suspend(fiber);
+    }
+}
+
+void FiberScheduler::notify(FiberWaitList& waiting) {
+    {
+        lock_guard<mutex> guard(lock);
+        wake(waiting);
+    }
+
+    changed.notify_all();
+}
+
+void FiberScheduler::sleep(double seconds) {
+    Fiber* fiber = currentFiber;
+
+    if (!fiber) {
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        return;
+    }
+
+    auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    queues[fiber->home]->timers.push({ deadline, fiber->shared_from_this() });
+
+    suspend(fiber);
+}
+
+void FiberScheduler::shutdown() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+
+    changed.notify_all();
+
+    for (thread& worker: workers) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+size_t fiberThreadsOf(FVM* vm) {
+    return vm->fiberThreads ? vm->fiberThreads : max(1u, thread::hardware_concurrency());
+}
+
+shared_ptr<Fiber> makeFiber(FVM* vm) {
+    if (!vm->fibers) {
+        vm->fibers = make_shared<FiberScheduler>(fiberThreadsOf(vm));
+        vm->outputLock = make_shared<mutex>();
+    }
+
+    shared_ptr<Fiber> fiber = make_shared<Fiber>();
+    fiber->vm = make_unique<FVM>(false);
+
+    FVM* child = fiber->vm.get();
+    child->fiber = fiber.get();
+    child->fibers = vm->fibers;
+    child->fiberThreads = vm->fiberThreads;
+    child->parallelThreshold = vm->parallelThreshold;
+    child->out = vm->out;
+    child->outputLock = vm->outputLock;
+    child->gc.nurserySize = vm->gc.nurserySize;
+
+    // --max-heap counts fibers too
+    child->heap->release();
+    child->heap = vm->heap;
+    child->heap->references++;
+
+    if (vm->jit) {
+        child->jit = make_shared<Jit>();
+        child->jit->threshold = vm->jit->threshold;
+        child->jit->verify = vm->jit->verify;
+    }
+
+    return fiber;
+}
+
+shared_ptr<InstructionOperrand> spawnFiber(FVM* vm, shared_ptr<InstructionOperrand> value) {
+    auto function = dynamic_pointer_cast<InstructionFunctionOperrand>(value);
+    if (!function) throw runtime_error("FVM: spawn() EXPECTED FUNCTION");
+    if (!function->operrand->argsIds.empty()) throw runtime_error("FVM: FUNCTION OF spawn() MUST NOT HAVE ARGUMENTS, CAPTURE THEM INSTEAD");
+
+    shared_ptr<Fiber> fiber = makeFiber(vm);
+
+    FiberCopies copies;
+    fiber->function = static_pointer_cast<InstructionFunctionOperrand>(transfer(function, fiber->vm.get(), copies));
+
+    vm->fibers->submit(fiber);
+
+    return makePooled<InstructionFiberOperrand>(fiber);
+}
+
+shared_ptr<InstructionOperrand> joinFiber(FVM* vm, shared_ptr<InstructionOperrand> value) {
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) {
+        auto results = makePooled<OperrandVector>();
+
+        for (shared_ptr<InstructionOperrand>& element: *array->operrand) results->push_back(joinFiber(vm, element));
+
+        auto joined = makePooled<InstructionArrayOperrand>(results);
+        vm->gc.track(joined);
+
+        return joined;
+    }
+
+    auto handle = dynamic_pointer_cast<InstructionFiberOperrand>(value);
+    if (!handle) throw runtime_error("FVM: join() EXPECTED FIBER OR ARRAY OF FIBERS");
+
+    Fiber* fiber = handle->operrand.get();
+    vm->fibers->join(fiber);
+
+    if (fiber->error) rethrow_exception(fiber->error);
+
+    // fiber is done, its heap is only read here
+    FiberCopies copies;
+    return transfer(fiber->result, vm, copies);
+}
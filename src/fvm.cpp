@@ -5,12 +5,263 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#include <mutex>
 #include <math.h>
 
 #include "include/fvm.h"
+#include "include/persistent.h"
+#include "include/builtins.h"
+#include "include/profiler.h"
+#include "include/jit.h"
+#include "include/fiber.h"
+#include "include/generator.h"
+#include "include/typedArray.h"
 
 using namespace std;
 
+const size_t SIZE_CLASS = 16;
+const size_t MAX_POOLED_SIZE = 512;
+const size_t CHUNK_SIZE = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct MemoryPool {
+    FreeBlock* freeLists[MAX_POOLED_SIZE / SIZE_CLASS] = {};
+
+    size_t allocations = 0;
+    size_t chunks = 0;
+};
+
+// blocks freed on other thread go to its own free lists, chunks are never returned so it is safe
+thread_local MemoryPool pool;
+
+thread_local HeapAccount* currentAccount = nullptr;
+
+const size_t HEADER_SIZE = sizeof(HeapAccount*);
+
+thread_local int currentOpcode = -1;
+thread_local size_t* opcodeAllocations = nullptr;
+
+void chargeMemory(HeapAccount* account, size_t size) {
+    size_t live = account->liveBytes.fetch_add(size, memory_order_relaxed) + size;
+
+    if (account->limit && live > account->limit) {
+        account->liveBytes.fetch_sub(size, memory_order_relaxed);
+        throw runtime_error("FVM: HEAP LIMIT OF " + to_string(account->limit) + " BYTES EXCEEDED (LIVE " + to_string(live - size) + " BYTES, REQUESTED " + to_string(size) + ")");
+    }
+
+    if (account->limit && live > account->pressureBytes) account->underPressure = true;
+
+    if (live > account->peakBytes.load(memory_order_relaxed)) account->peakBytes.store(live, memory_order_relaxed);
+}
+
+void* allocateBlock(size_t size) {
+    if (size > MAX_POOLED_SIZE) return ::operator new(size);
+
+    size_t sizeClass = (size + SIZE_CLASS - 1) / SIZE_CLASS - 1;
+    FreeBlock* block = pool.freeLists[sizeClass];
+
+    if (block) {
+        pool.freeLists[sizeClass] = block->next;
+        return block;
+    }
+
+    size_t blockSize = (sizeClass + 1) * SIZE_CLASS;
+    char* chunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+    pool.chunks++;
+
+    for (size_t offset = blockSize; offset + blockSize <= CHUNK_SIZE; offset += blockSize) {
+        FreeBlock* free = reinterpret_cast<FreeBlock*>(chunk + offset);
+        free->next = pool.freeLists[sizeClass];
+        pool.freeLists[sizeClass] = free;
+    }
+
+    return chunk;
+}
+
+void* allocateMemory(size_t size) {
+    if (opcodeAllocations && currentOpcode >= 0) opcodeAllocations[currentOpcode]++;
+
+    pool.allocations++;
+
+    HeapAccount* account = currentAccount;
+    size += HEADER_SIZE;
+
+    if (account) {
+        chargeMemory(account, size);
+        account->references.fetch_add(1, memory_order_relaxed);
+    }
+
+    char* block = static_cast<char*>(allocateBlock(size));
+    *reinterpret_cast<HeapAccount**>(block) = account;
+
+    return block + HEADER_SIZE;
+}
+
+void freeBlock(void* memory, size_t size) {
+    if (size > MAX_POOLED_SIZE) {
+        ::operator delete(memory);
+        return;
+    }
+
+    size_t sizeClass = (size + SIZE_CLASS - 1) / SIZE_CLASS - 1;
+
+    FreeBlock* block = static_cast<FreeBlock*>(memory);
+    block->next = pool.freeLists[sizeClass];
+    pool.freeLists[sizeClass] = block;
+}
+
+void freeMemory(void* memory, size_t size) {
+    char* block = static_cast<char*>(memory) - HEADER_SIZE;
+    size += HEADER_SIZE;
+
+    HeapAccount* account = *reinterpret_cast<HeapAccount**>(block);
+
+    freeBlock(block, size);
+
+    if (account) {
+        account->liveBytes.fetch_sub(size, memory_order_relaxed);
+        account->release();
+    }
+}
+
+InstructionStringOperrand::InstructionStringOperrand(string operrand) {
+    flat = move(operrand);
+    length = flat.size();
+
+    charge();
+}
+
+InstructionStringOperrand::InstructionStringOperrand(shared_ptr<InstructionStringOperrand> left, shared_ptr<InstructionStringOperrand> right) {
+    length = left->length + right->length;
+
+    this->left = left;
+    this->right = right;
+}
+
+InstructionStringOperrand::InstructionStringOperrand(shared_ptr<InstructionStringOperrand> source, size_t offset, size_t length) {
+    this->source = source;
+    this->offset = offset;
+    this->length = length;
+}
+
+InstructionStringOperrand::~InstructionStringOperrand() {
+    // s := s + part in long loop makes rope as deep as number of parts, it is released in loop instead of recursion
+    // of destructors
+    vector<shared_ptr<InstructionStringOperrand>> parts;
+    if (left) parts = { move(left), move(right) };
+
+    while (!parts.empty()) {
+        shared_ptr<InstructionStringOperrand> part = move(parts.back());
+        parts.pop_back();
+
+        if (part.use_count() == 1 && part->left) {
+            parts.push_back(move(part->left));
+            parts.push_back(move(part->right));
+        }
+    }
+
+    if (account) {
+        account->liveBytes.fetch_sub(charged, memory_order_relaxed);
+        account->release();
+    }
+}
+
+string_view InstructionStringOperrand::text() {
+    if (source) return string_view(source->flat).substr(offset, length);
+    if (!left) return flat;
+
+    flat.reserve(length);
+
+    // parts from left to right without recursion, parts which are ropes themselves are walked through
+    vector<InstructionStringOperrand*> parts = { right.get(), left.get() };
+
+    while (!parts.empty()) {
+        InstructionStringOperrand* part = parts.back();
+        parts.pop_back();
+
+        if (part->left) {
+            parts.push_back(part->right.get());
+            parts.push_back(part->left.get());
+        } else flat += part->text();
+    }
+
+    left = nullptr;
+    right = nullptr;
+
+    charge();
+
+    return flat;
+}
+
+void InstructionStringOperrand::charge() {
+    if (flat.capacity() <= 15 || flat.capacity() == charged) return;
+
+    if (!account) {
+        if (!currentAccount) return;
+
+        account = currentAccount;
+        account->references.fetch_add(1, memory_order_relaxed);
+    }
+
+    chargeMemory(account, flat.capacity() - charged);
+    charged = flat.capacity();
+}
+
+shared_ptr<InstructionStringOperrand> concatStrings(shared_ptr<InstructionStringOperrand> left, shared_ptr<InstructionStringOperrand> right) {
+    if (right->length == 0) return left;
+    if (left->length == 0) return right;
+
+    // short result fits into small string buffer, node of rope would only add indirection
+    if (left->length + right->length <= 15) {
+        string joined(left->text());
+        joined += right->text();
+
+        return makePooled<InstructionStringOperrand>(joined);
+    }
+
+    return makePooled<InstructionStringOperrand>(left, right);
+}
+
+shared_ptr<InstructionOperrand> sliceString(shared_ptr<InstructionOperrand> value, shared_ptr<InstructionOperrand> from, shared_ptr<InstructionOperrand> to) {
+    auto text = dynamic_pointer_cast<InstructionStringOperrand>(value);
+    if (!text) throw runtime_error("FVM: slice() EXPECTED STRING");
+
+    int64_t begin;
+    int64_t end;
+
+    if (!isNumberTag(from->tag) || !isNumberTag(to->tag) || !toInteger(from.get(), begin) || !toInteger(to.get(), end) || begin < 0 || end < 0) {
+        throw runtime_error("FVM: slice() EXPECTED NON-NEGATIVE INTEGER INDEXES");
+    }
+
+    size_t first = min((size_t)begin, text->length);
+    size_t last = max(first, min((size_t)end, text->length));
+
+    if (last - first <= 15) return makePooled<InstructionStringOperrand>(string(text->text().substr(first, last - first)));
+
+    // slice of slice points into the same flat text
+    if (text->source) return makePooled<InstructionStringOperrand>(text->source, text->offset + first, last - first);
+
+    text->text();
+
+    return makePooled<InstructionStringOperrand>(text, first, last - first);
+}
+
+shared_ptr<InstructionBoolOperrand> boolOperrand(bool value) {
+    static shared_ptr<InstructionBoolOperrand> trueOperrand = make_shared<InstructionBoolOperrand>(true);
+    static shared_ptr<InstructionBoolOperrand> falseOperrand = make_shared<InstructionBoolOperrand>(false);
+
+    return value ? trueOperrand : falseOperrand;
+}
+
+shared_ptr<InstructionNullOperrand> nullOperrand() {
+    static shared_ptr<InstructionNullOperrand> null = make_shared<InstructionNullOperrand>();
+
+    return null;
+}
+
 string opcodeToString(Bytecode opcode) {
     switch (opcode) {
         case F_PUSH:
@@ -19,6 +270,12 @@ string opcodeToString(Bytecode opcode) {
             return "SETENV";
         case F_GETENV:
             return "GETGLOBAL";
+        case F_SETUPVAL:
+            return "SETUPVAL";
+        case F_GETUPVAL:
+            return "GETUPVAL";
+        case F_MAKE_CLOSURE:
+            return "MAKE_CLOSURE";
         case F_CALL:
             return "CALL";
         case F_RETURN:
@@ -41,6 +298,8 @@ string opcodeToString(Bytecode opcode) {
             return "NOTEQ";
         case F_AND:
             return "AND";
+        case F_OR:
+            return "OR";
         case F_BIGGER:
             return "BIGGER";
         case F_SMALLER:
@@ -55,8 +314,50 @@ string opcodeToString(Bytecode opcode) {
             return "SETINDEX";
         case F_LOADIFST:
             return "LOADIF";
+        case F_NEW_ARRAY:
+            return "NEW_ARRAY";
+        case F_NEW_OBJECT:
+            return "NEW_OBJECT";
+        case F_CLONE:
+            return "CLONE";
+        case F_FOR_IN:
+            return "FOR_IN";
+        case F_YIELD:
+            return "YIELD";
         case F_IF:
             return "IF";
+        case F_MOD:
+            return "MOD";
+        case F_SHL:
+            return "SHL";
+        case F_SHR:
+            return "SHR";
+        case F_BIT_AND:
+            return "BIT_AND";
+        case F_BIT_OR:
+            return "BIT_OR";
+        case F_BIT_XOR:
+            return "BIT_XOR";
+        case F_ADD_NUM:
+            return "ADD_NUM";
+        case F_SUB_NUM:
+            return "SUB_NUM";
+        case F_MUL_NUM:
+            return "MUL_NUM";
+        case F_DIV_NUM:
+            return "DIV_NUM";
+        case F_EQ_NUM:
+            return "EQ_NUM";
+        case F_NOTEQ_NUM:
+            return "NOTEQ_NUM";
+        case F_BIGGER_NUM:
+            return "BIGGER_NUM";
+        case F_SMALLER_NUM:
+            return "SMALLER_NUM";
+        case F_BIGGER_OR_EQ_NUM:
+            return "BIGGER_OR_EQ_NUM";
+        case F_SMALLER_OR_EQ_NUM:
+            return "SMALLER_OR_EQ_NUM";
         default:
             break;
     }
@@ -64,12 +365,159 @@ string opcodeToString(Bytecode opcode) {
     return "unknown";
 };
 
+Bytecode genericOpcode(Bytecode opcode) {
+    switch (opcode) {
+        case F_ADD_NUM: return F_ADD;
+        case F_SUB_NUM: return F_SUB;
+        case F_MUL_NUM: return F_MUL;
+        case F_DIV_NUM: return F_DIV;
+        case F_EQ_NUM: return F_EQ;
+        case F_NOTEQ_NUM: return F_NOTEQ;
+        case F_BIGGER_NUM: return F_BIGGER;
+        case F_SMALLER_NUM: return F_SMALLER;
+        case F_BIGGER_OR_EQ_NUM: return F_BIGGER_OR_EQ;
+        case F_SMALLER_OR_EQ_NUM: return F_SMALLER_OR_EQ;
+        default: return opcode;
+    }
+}
+
+Bytecode quickenedOpcode(Bytecode opcode) {
+    switch (opcode) {
+        case F_ADD: return F_ADD_NUM;
+        case F_SUB: return F_SUB_NUM;
+        case F_MUL: return F_MUL_NUM;
+        case F_DIV: return F_DIV_NUM;
+        case F_EQ: return F_EQ_NUM;
+        case F_NOTEQ: return F_NOTEQ_NUM;
+        case F_BIGGER: return F_BIGGER_NUM;
+        case F_SMALLER: return F_SMALLER_NUM;
+        case F_BIGGER_OR_EQ: return F_BIGGER_OR_EQ_NUM;
+        case F_SMALLER_OR_EQ: return F_SMALLER_OR_EQ_NUM;
+        default: return opcode;
+    }
+}
+
+// numeric executions in a row before generic instruction is quickened
+const uint8_t QUICKEN_AFTER = 8;
+// instruction which keeps getting other types stays generic
+const uint8_t MAX_DEOPTS = 4;
+
+ArgumentKind argumentKind(Bytecode opcode) {
+    switch (opcode) {
+        case F_PUSH:
+        case F_MAKE_CLOSURE:
+        case F_NEW_ARRAY:
+        case F_NEW_OBJECT:
+        case F_CLONE:
+        case F_SETINDEX:
+            return ARGUMENT_CONSTANT;
+        case F_GETENV:
+        case F_SETENV:
+            return ARGUMENT_NAME;
+        case F_IF:
+        case F_FOR_IN:
+            return ARGUMENT_BRANCH;
+        case F_GETUPVAL:
+        case F_SETUPVAL:
+            return ARGUMENT_IMMEDIATE;
+        default:
+            return ARGUMENT_NONE;
+    }
+}
+
+// argument of arithmetic and comparisons: low byte - numeric executions in a row, next byte - deopts
+uint8_t feedbackOf(const Instruction& code) { return code.argument() & 0xFF; }
+uint8_t deoptsOf(const Instruction& code) { return (code.argument() >> 8) & 0xFF; }
+
+void setFeedback(Instruction& code, uint8_t feedback, uint8_t deopts) { code.setArgument(feedback | (deopts << 8)); }
+
+void recordFeedback(Instruction& code, bool numbers) {
+    uint8_t deopts = deoptsOf(code);
+
+    if (!numbers || deopts >= MAX_DEOPTS) {
+        setFeedback(code, 0, deopts);
+        return;
+    }
+
+    uint8_t feedback = feedbackOf(code) + 1;
+
+    if (feedback >= QUICKEN_AFTER) {
+        code.setCode(quickenedOpcode(code.code()));
+        feedback = 0;
+    }
+
+    setFeedback(code, feedback, deopts);
+}
+
+// two numbers on top of stack, checked by tag
+bool topNumbers(vector<shared_ptr<InstructionOperrand>>& stack, double& left, double& right) {
+    size_t size = stack.size();
+    if (size < 2) return false;
+
+    InstructionOperrand* rightOperrand = stack[size - 1].get();
+    InstructionOperrand* leftOperrand = stack[size - 2].get();
+
+    if (!rightOperrand || !leftOperrand || !isNumberTag(rightOperrand->tag) || !isNumberTag(leftOperrand->tag)) return false;
+
+    left = static_cast<InstructionNumberOperrand*>(leftOperrand)->operrand;
+    right = static_cast<InstructionNumberOperrand*>(rightOperrand)->operrand;
+
+    return true;
+}
+
 bool isDoubleInt(double trouble) {
    double absolute = abs(trouble);
 
    return absolute == floor(absolute);
 }
 
+// integers of numbers are exact up to 2^53
+bool toInteger(InstructionOperrand* operrand, int64_t& integer) {
+    double value = static_cast<InstructionNumberOperrand*>(operrand)->operrand;
+
+    if (operrand->tag != TAG_INT && (abs(value) > 9007199254740992.0 || !isDoubleInt(value))) return false;
+
+    integer = value;
+
+    return true;
+}
+
+double integerOperation(Bytecode opcode, InstructionOperrand* left, InstructionOperrand* right) {
+    if (!isNumberTag(left->tag) || !isNumberTag(right->tag)) throw runtime_error("FVM: " + opcodeToString(opcode) + " ERROR! OPERRANDS MUST BE A NUMBERS");
+
+    int64_t a;
+    int64_t b;
+
+    if (opcode == F_MOD) {
+        double divisor = static_cast<InstructionNumberOperrand*>(right)->operrand;
+        if (divisor == 0) throw runtime_error("FVM: MOD ERROR! DIVISION BY ZERO");
+
+        // remainder has sign of left operrand, fractions use fmod
+        if (left->tag == TAG_INT && right->tag == TAG_INT) return (int64_t)static_cast<InstructionNumberOperrand*>(left)->operrand % (int64_t)divisor;
+
+        return fmod(static_cast<InstructionNumberOperrand*>(left)->operrand, divisor);
+    }
+
+    if (!toInteger(left, a) || !toInteger(right, b)) throw runtime_error("FVM: " + opcodeToString(opcode) + " ERROR! OPERRANDS MUST BE INTEGERS");
+
+    switch (opcode) {
+        case F_SHL:
+        case F_SHR:
+            if (b < 0) throw runtime_error("FVM: SHIFT COUNT MUST BE A NON-NEGATIVE INTEGER");
+
+            // left shift is multiplication, result over int32 becomes number; right shift keeps sign
+            if (opcode == F_SHL) return ldexp((double)a, min(b, (int64_t)2048));
+
+            return b >= 64 ? (a < 0 ? -1 : 0) : a >> b;
+        case F_BIT_AND:
+            return a & b;
+        case F_BIT_OR:
+            return a | b;
+        default:
+            return a ^ b;
+    }
+}
+
 bool binaryNumbersCondition(shared_ptr<InstructionOperrand> one, shared_ptr<InstructionOperrand> two, Bytecode opcode) {
     auto oneCasted = dynamic_pointer_cast<InstructionNumberOperrand>(one);
     auto twoCasted = dynamic_pointer_cast<InstructionNumberOperrand>(two);
@@ -84,342 +532,899 @@ bool binaryNumbersCondition(shared_ptr<InstructionOperrand> one, shared_ptr<Inst
     return false;
 }
 
-FVM::FVM(bool logs) {
-    this->logs = logs;
+void mergeScope(shared_ptr<Scope> scope, shared_ptr<Scope> parent) {
+    if (parent == nullptr) return;
+
+    for (auto v: scope->members) {
+        auto parentMember = parent->members.find(v.first);
+        if (parentMember == parent->members.end()) continue;
+
+        if (!v.second.isLocal || parentMember->second.cell != v.second.cell) {
+            parentMember->second = v.second;
+        }
+    }
+}
+
+shared_ptr<UpvalueCell> captureMember(shared_ptr<Scope> scope, UpvalueDescriptor upvalue) {
+    auto member = scope->members.find(upvalue.id);
+
+    if (member == scope->members.end()) {
+        // not defined yet (function declared below or recursion), share cell and wait for SETENV
+        ScopeMember placeholder(nullptr);
+        placeholder.cell = makePooled<UpvalueCell>();
+
+        scope->members[upvalue.id] = placeholder;
+
+        return placeholder.cell;
+    }
+
+    if (member->second.cell) return member->second.cell;
+
+    if (upvalue.isMutable) {
+        member->second.cell = makePooled<UpvalueCell>(member->second.value);
+        return member->second.cell;
+    }
+
+    return makePooled<UpvalueCell>(member->second.value);
+}
+
+mutex allocationSitesMutex;
+map<pair<string, int>, AllocationSite*> allocationSites;
+
+const AllocationSite* internAllocationSite(string file, int line) {
+    lock_guard<mutex> lock(allocationSitesMutex);
+
+    AllocationSite*& site = allocationSites[{ file, line }];
+    if (!site) site = new AllocationSite(file, line);
+
+    return site;
+}
+
+// entry of constant table which is argument of instruction, null when index is out of table
+InstructionOperrand* constantOf(const Instruction& code, CodeTables& tables) {
+    return code.argument() < tables.constants.size() ? tables.constants[code.argument()].get() : nullptr;
 }
 
-bool FVM::run(vector<Instruction> bytecode, shared_ptr<Scope> scope, shared_ptr<Scope> parent) {
-    if (logs) cout << getBytecodeString(bytecode) << endl;
+// nested literals of constant are cloned at same site
+shared_ptr<InstructionOperrand> cloneConstant(shared_ptr<InstructionOperrand> constant, bool isFlat, FVM* vm, const AllocationSite* site) {
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(constant)) {
+        auto elements = makePooled<OperrandVector>(*array->operrand);
+
+        if (!isFlat) {
+            for (shared_ptr<InstructionOperrand>& element: *elements) element = cloneConstant(element, false, vm, site);
+        }
+
+        auto clone = makePooled<InstructionArrayOperrand>(elements);
+        vm->gc.track(clone);
+
+        if (vm->profiler) {
+            clone->site = site;
+            vm->profiler->recordAllocation(site, clone->heapSize());
+        }
+
+        return clone;
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(constant)) {
+        auto fields = makePooled<OperrandMap>(*object->operrand);
+
+        if (!isFlat) {
+            for (auto& field: *fields) field.second = cloneConstant(field.second, false, vm, site);
+        }
+
+        auto clone = makePooled<InstructionObjectOperrand>(fields);
+        vm->gc.track(clone);
+
+        if (vm->profiler) {
+            clone->site = site;
+            vm->profiler->recordAllocation(site, clone->heapSize());
+        }
 
+        return clone;
+    }
+
+    // scalars are immutable, can be shared
+    return constant;
+}
+
+BlockGuard::BlockGuard(FVM* vm, shared_ptr<Scope>& scope, shared_ptr<Scope>& parent, shared_ptr<InstructionFunctionOperrand>& closure) : frames(vm->frames) {
     if (scope != nullptr && parent != nullptr) {
         for (pair<string, ScopeMember> member: parent->members) {
             if (scope->members.find(member.first) == scope->members.end()) scope->members.insert(member);
         }
     }
 
-    for (Instruction code: bytecode) {
-        switch (code.code) {
-            case F_PUSH:
-                {
-                    bool hasVal = code.operrand.has_value();
-                    shared_ptr<InstructionOperrand> val = code.operrand.value();
-                    if (!hasVal) throw runtime_error("FVM: NO OPERRAND FOR PUSH");
-
-                    push(code.operrand.value());
-                }
-                break;
-            case F_INDEXATION:
-                {
-                    shared_ptr<InstructionOperrand> index = pop();
-                    shared_ptr<InstructionOperrand> where = pop();
-
-                    if (auto casted = dynamic_pointer_cast<InstructionArrayOperrand>(where)) {
-                        if (auto indexCasted = dynamic_pointer_cast<InstructionNumberOperrand>(index)) {
-                            double indexOperrand = indexCasted->operrand;
-                            if (!isDoubleInt(indexOperrand)) throw runtime_error("FVM: ARRAY INDEX MUST BE A INTEGER");
-
-                            shared_ptr<vector<shared_ptr<InstructionOperrand>>> elements = casted->operrand;
-                            if (elements->size() - 1 >= indexOperrand) {
-                                shared_ptr<InstructionOperrand> val;
-
-                                try {
-                                    val = elements->at(indexOperrand);
-                                }
-                                catch(const std::exception& e) {
-                                    val = make_shared<InstructionNullOperrand>();  
-                                }
-
-                                push(val);
-                            } else push(make_shared<InstructionNullOperrand>());
-                        } else throw runtime_error("FVM: ARRAY CAN BE INDEXED ONLY WITH INTEGERS");
-                    } else if (auto casted = dynamic_pointer_cast<InstructionObjectOperrand>(where)) {
-                        if (auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index)) {
-                            shared_ptr<map<string, shared_ptr<InstructionOperrand>>> fields = casted->operrand;
-                            shared_ptr<InstructionOperrand> val;
-
-                            try {
-                                val = fields->at(indexCasted->operrand);
-                            }
-                            catch(const std::exception& e) {
-                                val = make_shared<InstructionNullOperrand>();
-                            }
-
-                            push(val);
-                        } else throw runtime_error("FVM: INDEX FOR OBJECT INDEXATION MUST BE A STRING");
-                    } else throw runtime_error("FVM: UNABLE TO INDEX UNKNOWN OPERRAND");
-                }
-                break;
-            case F_SETINDEX:
-                {
-                    shared_ptr<InstructionOperrand> index = pop();
-                    shared_ptr<InstructionOperrand> value = pop();
-                    shared_ptr<InstructionOperrand> where = pop();
+    // VM which ran before this block continues with its own after it
+    previousAllocations = opcodeAllocations;
+    opcodeAllocations = vm->allocStats ? vm->allocationsByOpcode.data() : nullptr;
+
+    previousAccount = currentAccount;
+    currentAccount = vm->heap;
+
+    frames.push_back({ scope.get(), closure.get() });
+}
+
+BlockGuard::~BlockGuard() {
+    opcodeAllocations = previousAllocations;
+    currentAccount = previousAccount;
+    frames.pop_back();
+}
+
+FVM::FVM(bool logs, bool allocStats) {
+    this->logs = logs;
+    this->allocStats = allocStats;
+    this->globals = makePooled<Scope>();
+
+    executedByOpcode.resize(F_OPCODES_COUNT);
+    allocationsByOpcode.resize(F_OPCODES_COUNT);
+
+    heap = new HeapAccount();
+
+    registerBuiltins(globals);
+}
+
+FVM::~FVM() {
+    // fibers which were not joined still run, program waits for them
+    if (fibers && !fiber) fibers->shutdown();
+
+    // suspended generators are unwound while VM still works, generators freed later do nothing
+    for (Generator* generator: vector<Generator*>(generators.begin(), generators.end())) {
+        generator->cancel();
+        generator->vm = nullptr;
+    }
+
+    generators.clear();
+
+    // program is finished, nothing is reachable anymore, cycles left by it are broken here
+    vmStack.clear();
+    gc.collect(this, true, false);
+
+    // blocks still alive (globals are freed after this destructor) keep account until they are freed
+    heap->release();
+}
+
+size_t FVM::memoryUsage() {
+    return heap->liveBytes.load(memory_order_relaxed);
+}
+
+size_t FVM::peakMemoryUsage() {
+    return heap->peakBytes.load(memory_order_relaxed);
+}
+
+void FVM::printMemoryStats() {
+    *out << "[ MEMORY ]" << endl;
+    *out << "  > live: " << memoryUsage() << " bytes | peak: " << peakMemoryUsage() << " bytes";
+    if (heap->limit) *out << " | limit: " << heap->limit << " bytes";
+    *out << endl;
+}
+
+bool FVM::run(vector<Instruction>& bytecode, CodeTables& tables, shared_ptr<Scope> scope, shared_ptr<Scope> parent, shared_ptr<InstructionFunctionOperrand> closure) {
+    if (logs) *out << getBytecodeString(bytecode, tables) << endl;
+
+    BlockGuard block(this, scope, parent, closure);
+
+    for (Instruction& code: bytecode) {
+        if (execute(code, tables, scope, parent, closure)) return true;
+    }
+
+    mergeScope(scope, parent);
+
+    return false;
+}
 
-                    if (auto casted = dynamic_pointer_cast<InstructionArrayOperrand>(where)) {
-                        if (auto indexCasted = dynamic_pointer_cast<InstructionNumberOperrand>(index)) {
-                            shared_ptr<vector<shared_ptr<InstructionOperrand>>> elements = casted->operrand;
-                            (*elements)[indexCasted->operrand] = value;
+bool FVM::execute(Instruction& code, CodeTables& tables, shared_ptr<Scope>& scope, shared_ptr<Scope>& parent, shared_ptr<InstructionFunctionOperrand>& closure) {
+    if (gc.pending) gc.collectPending(this);
+
+    if (heap->underPressure) {
+        heap->underPressure = false;
+        gc.collect(this, true);
+
+        // next forced collection only after half of remaining headroom is used
+        size_t live = heap->liveBytes.load(memory_order_relaxed);
+        heap->pressureBytes = max(heap->limit / 4 * 3, live + (heap->limit - min(live, heap->limit)) / 2);
+    }
+
+    Bytecode opcode = code.code();
+
+    if (allocStats) {
+        currentOpcode = opcode;
+        executedByOpcode[opcode]++;
+    }
+
+    dispatch:
+    switch (opcode) {
+        case F_PUSH:
+            {
+                if (code.argument() >= tables.constants.size()) throw runtime_error("FVM: NO OPERRAND FOR PUSH");
+
+                push(tables.constants[code.argument()]);
+            }
+            break;
+        case F_INDEXATION:
+            {
+                shared_ptr<InstructionOperrand> index = pop();
+                shared_ptr<InstructionOperrand> where = pop();
+
+                if (auto casted = dynamic_pointer_cast<InstructionArrayOperrand>(where)) {
+                    // small integer index is a tag test, bigger integers are never in range
+                    if (index->tag == TAG_INT) {
+                        int64_t position = static_cast<InstructionNumberOperrand*>(index.get())->operrand;
+                        OperrandVector& elements = *casted->operrand;
+
+                        if (position >= 0 && position < (int64_t)elements.size()) push(elements[position]);
+                        else push(nullOperrand());
+                    } else if (index->tag == TAG_NUMBER) {
+                        if (!isDoubleInt(static_cast<InstructionNumberOperrand*>(index.get())->operrand)) throw runtime_error("FVM: ARRAY INDEX MUST BE A INTEGER");
+
+                        push(nullOperrand());
+                    } else throw runtime_error("FVM: ARRAY CAN BE INDEXED ONLY WITH INTEGERS");
+                } else if (auto casted = dynamic_pointer_cast<InstructionObjectOperrand>(where)) {
+                    if (auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index)) {
+                        shared_ptr<OperrandMap> fields = casted->operrand;
+                        shared_ptr<InstructionOperrand> val;
+
+                        try {
+                            val = fields->at(string(indexCasted->text()));
                         }
-                    } else if (auto casted = dynamic_pointer_cast<InstructionObjectOperrand>(where)) {
-                        if (auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index)) {
-                            shared_ptr<map<string, shared_ptr<InstructionOperrand>>> fields = casted->operrand;
-                            (*fields)[indexCasted->operrand] = value;
+                        catch(const std::exception& e) {
+                            val = nullOperrand();
                         }
+
+                        push(val);
+                    } else throw runtime_error("FVM: INDEX FOR OBJECT INDEXATION MUST BE A STRING");
+                } else if (auto casted = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(where)) {
+                    if (!isNumberTag(index->tag) || (index->tag == TAG_NUMBER && !isDoubleInt(static_cast<InstructionNumberOperrand*>(index.get())->operrand))) {
+                        throw runtime_error("FVM: ARRAY CAN BE INDEXED ONLY WITH INTEGERS");
                     }
-                }
-                break;
-            case F_IF:
-                {
-                    auto operrand = dynamic_pointer_cast<InstructionIfStatementLoadOperrand>(code.operrand.value());
-                    if (!operrand) throw runtime_error("FVM: NO OPERRAND FOR IF INSTRUCTION");
 
-                    IfStatement statement = operrand->operrand;
+                    double position = static_cast<InstructionNumberOperrand*>(index.get())->operrand;
 
-                    shared_ptr<InstructionOperrand> val = pop();
+                    shared_ptr<InstructionOperrand> val;
+                    if (index->tag == TAG_INT && position >= 0) val = casted->operrand.get(position);
 
-                    if (auto boolean = dynamic_pointer_cast<InstructionBoolOperrand>(val)) {
-                        vector<Instruction> bytecode = statement.bytecode;
-                        if (!boolean->operrand) bytecode = statement.elseBytecode;
+                    push(val ? val : nullOperrand());
+                } else if (auto casted = dynamic_pointer_cast<InstructionFrozenObjectOperrand>(where)) {
+                    auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index);
+                    if (!indexCasted) throw runtime_error("FVM: INDEX FOR OBJECT INDEXATION MUST BE A STRING");
 
-                        if (!bytecode.empty()) {
-                            shared_ptr<Scope> newScope = make_shared<Scope>();
+                    shared_ptr<InstructionOperrand> val = casted->operrand.get(string(indexCasted->text()));
 
-                            if (run(bytecode, newScope, scope)) return true ;
-                        }
-                    }
-                }
-                break;
-            case F_DELAY:
-                {
-                    auto val = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
-                    if (!val) throw runtime_error("FVM: DELAY ERROR, NO NUMBER IN STACK");
+                    push(val ? val : nullOperrand());
+                } else if (auto casted = dynamic_cast<InstructionTypedArrayOperrand*>(where.get())) {
+                    // only the element is boxed, numbers stay where they are
+                    int64_t position;
+                    if (!isNumberTag(index->tag) || !toInteger(index.get(), position)) throw runtime_error("FVM: ARRAY CAN BE INDEXED ONLY WITH INTEGERS");
 
-                    this_thread::sleep_for(chrono::duration<double>(val->operrand));
-                }
-                break;
-            case F_RETURN:
-                {
-                    if (vmStack.empty()) push(make_shared<InstructionNullOperrand>());
+                    if (position >= 0 && position < (int64_t)casted->size()) push(casted->get(position));
+                    else push(nullOperrand());
+                } else throw runtime_error("FVM: UNABLE TO INDEX UNKNOWN OPERRAND");
+            }
+            break;
+        case F_SETINDEX:
+            {
+                shared_ptr<InstructionOperrand> index = pop();
+                shared_ptr<InstructionOperrand> value = pop();
+                shared_ptr<InstructionOperrand> where = pop();
+
+                if (auto casted = dynamic_pointer_cast<InstructionArrayOperrand>(where)) {
+                    if (isNumberTag(index->tag)) {
+                        double indexOperrand = static_cast<InstructionNumberOperrand*>(index.get())->operrand;
+                        if (index->tag != TAG_INT || indexOperrand < 0) throw runtime_error("FVM: ARRAY INDEX MUST BE A NON-NEGATIVE INTEGER");
 
-                    for (auto v: scope->members) {
-                        if (parent != nullptr && parent->members.find(v.first) != parent->members.end() && !v.second.isLocal) {
-                            parent->members[v.first] = v.second;
+                        shared_ptr<OperrandVector> elements = casted->operrand;
+                        size_t position = indexOperrand;
+
+                        // writing past the end grows array, gap is filled with null
+                        if (position >= elements->size()) {
+                            size_t before = profiler ? casted->heapSize() : 0;
+
+                            elements->resize(position + 1, nullOperrand());
+
+                            if (profiler) profiler->recordGrowth(tables.sites[code.argument()], casted->heapSize() - before);
                         }
+
+                        (*elements)[position] = value;
                     }
+                } else if (auto casted = dynamic_pointer_cast<InstructionObjectOperrand>(where)) {
+                    if (auto indexCasted = dynamic_pointer_cast<InstructionStringOperrand>(index)) {
+                        shared_ptr<OperrandMap> fields = casted->operrand;
+
+                        if (profiler && fields->find(string(indexCasted->text())) == fields->end()) {
+                            size_t before = casted->heapSize();
+                            (*fields)[string(indexCasted->text())] = value;
+                            profiler->recordGrowth(tables.sites[code.argument()], casted->heapSize() - before);
+                        } else (*fields)[string(indexCasted->text())] = value;
+                    }
+                } else if (dynamic_pointer_cast<InstructionFrozenArrayOperrand>(where) || dynamic_pointer_cast<InstructionFrozenObjectOperrand>(where)) {
+                    throw runtime_error("FVM: FROZEN COLLECTION CANNOT BE MODIFIED, USE with()");
+                } else if (auto casted = dynamic_cast<InstructionTypedArrayOperrand*>(where.get())) {
+                    if (casted->frozen) throw runtime_error("FVM: FROZEN TYPED ARRAY CANNOT BE MODIFIED");
+
+                    int64_t position;
+                    if (!isNumberTag(index->tag) || !toInteger(index.get(), position)) throw runtime_error("FVM: ARRAY INDEX MUST BE A NON-NEGATIVE INTEGER");
 
-                    return true;
+                    // length is fixed, so writing past the end is an error instead of growth
+                    if (position < 0 || position >= (int64_t)casted->size()) throw runtime_error("FVM: INDEX " + to_string(position) + " IS OUT OF TYPED ARRAY OF SIZE " + to_string(casted->size()));
+
+                    casted->set(position, value);
                 }
-                break;
-            case F_CALL:
-                {
-                    shared_ptr<InstructionFunctionOperrand> func = dynamic_pointer_cast<InstructionFunctionOperrand>(pop());
-                    if (!func) break;
+            }
+            break;
+        case F_IF:
+            {
+                if (code.argument() >= tables.branches.size()) throw runtime_error("FVM: NO OPERRAND FOR IF INSTRUCTION");
 
-                    vector<shared_ptr<InstructionOperrand>> args;
+                IfStatement& statement = tables.branches[code.argument()];
+
+                shared_ptr<InstructionOperrand> val = pop();
 
-                    FuncDeclaration funcDeclar = func->operrand;
-                    string funcName = funcDeclar.id;
+                if (auto boolean = dynamic_pointer_cast<InstructionBoolOperrand>(val)) {
+                    // branch is run in place, so its instructions keep what they were quickened to
+                    vector<Instruction>& bytecode = boolean->operrand ? statement.bytecode : statement.elseBytecode;
 
-                    int argsNum = funcDeclar.argsIds.size();
+                    if (!bytecode.empty()) {
+                        shared_ptr<Scope> newScope = makePooled<Scope>();
 
-                    for (size_t i = 0; i < argsNum; ++i) {
-                        shared_ptr<InstructionOperrand> arg = pop();
-                        args.push_back(arg);
+                        if (run(bytecode, tables, newScope, scope, closure)) return true ;
                     }
+                }
+            }
+            break;
+        case F_FOR_IN:
+            {
+                if (code.argument() >= tables.branches.size()) throw runtime_error("FVM: NO OPERRAND FOR FOR_IN INSTRUCTION");
 
-                    shared_ptr<Scope> newScope = make_shared<Scope>();
+                vector<Instruction>& body = tables.branches[code.argument()].bytecode;
 
-                    for (size_t i = 0; i < argsNum; ++i) {
-                        shared_ptr<InstructionOperrand> arg = args.at(i);
-                        string id = funcDeclar.argsIds.at(i);
-                        
-                        newScope->members.insert({ id, ScopeMember(arg, true) });
-                    }
+                if (forIn([&]() { return run(body, tables, makePooled<Scope>(), scope, closure); })) return true;
+            }
+            break;
+        case F_YIELD:
+            {
+                shared_ptr<InstructionOperrand> val = pop();
+                if (!generator) throw runtime_error("FVM: yield OUTSIDE OF GENERATOR");
 
-                    run(funcDeclar.bytecode, newScope, funcDeclar.scope);
-                }
-                break;
-            case F_SETENV:
-                {
-                    auto adr = dynamic_pointer_cast<InstructionStringOperrand>(code.operrand.value());
-                    auto val = pop();
+                generator->yield(val);
+            }
+            break;
+        case F_DELAY:
+            {
+                auto val = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                if (!val) throw runtime_error("FVM: DELAY ERROR, NO NUMBER IN STACK");
+
+                // fiber is suspended until its timer, thread runs other fibers meanwhile
+                if (fiber) fibers->sleep(val->operrand);
+                else this_thread::sleep_for(chrono::duration<double>(val->operrand));
+            }
+            break;
+        case F_RETURN:
+            {
+                if (vmStack.empty()) push(nullOperrand());
+
+                mergeScope(scope, parent);
+
+                return true;
+            }
+            break;
+        case F_CALL:
+            {
+                shared_ptr<InstructionOperrand> callable = pop();
 
-                    if (adr) {
-                        scope->members[adr->operrand] = ScopeMember(val);
+                if (auto native = dynamic_pointer_cast<InstructionNativeFunctionOperrand>(callable)) {
+                    vector<shared_ptr<InstructionOperrand>> args;
+
+                    for (int i = 0; i < native->argsNum; ++i) {
+                        args.push_back(pop());
                     }
-                    else throw runtime_error("FVM: FOR SETVAR EXPECTED ADDRESS (OPERRAND 1)");
+
+                    push(native->operrand(this, args));
+                    break;
                 }
-                break;
-            case F_GETENV:
-                {
-                    auto adr = dynamic_pointer_cast<InstructionStringOperrand>(code.operrand.value());
-                    if (adr) {
-                        try {
-                            ScopeMember val = scope->members.at(adr->operrand);
-                            push(val.value);
-                        }
-                        catch (const exception& e) {
-                            throw runtime_error("FVM: BY ADDRESS " + adr->operrand + " NOT FINDED ANYTHING");
-                        }
-                        
-                    } else throw runtime_error("FVM: FOR GETVAR EXPECTED ADDERS (OPERRAND)");
+
+                shared_ptr<InstructionFunctionOperrand> func = dynamic_pointer_cast<InstructionFunctionOperrand>(callable);
+                if (!func) break;
+
+                vector<shared_ptr<InstructionOperrand>> args;
+
+                size_t argsNum = func->operrand->argsIds.size();
+
+                for (size_t i = 0; i < argsNum; ++i) {
+                    shared_ptr<InstructionOperrand> arg = pop();
+                    args.push_back(arg);
                 }
-                break;
-            case F_OUTPUT:
-                {
-                    shared_ptr<InstructionOperrand> val = pop();
-                    cout << "OUTPUT: " + val->tostring() << endl;
+
+                if (jit && jit->tryCall(this, func, args)) break;
+
+                callFunction(func, args);
+            }
+            break;
+        case F_NEW_ARRAY:
+            {
+                auto count = dynamic_cast<InstructionNumberOperrand*>(constantOf(code, tables));
+                if (!count) throw runtime_error("FVM: FOR NEW_ARRAY EXPECTED ELEMENTS COUNT (OPERRAND)");
+
+                size_t elementsNum = count->operrand;
+                auto elements = makePooled<OperrandVector>(elementsNum);
+
+                for (size_t i = elementsNum; i > 0; --i) {
+                    (*elements)[i - 1] = pop();
                 }
-                break;
-            case F_EQ:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(one->isEq(two)));
+                auto array = makePooled<InstructionArrayOperrand>(elements);
+                gc.track(array);
+
+                if (profiler) {
+                    array->site = tables.sites[code.argument()];
+                    profiler->recordAllocation(array->site, array->heapSize());
                 }
-                break;
-            case F_NOTEQ:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(!(one->isEq(two))));
+                push(array);
+            }
+            break;
+        case F_NEW_OBJECT:
+            {
+                auto shape = dynamic_cast<InstructionShapeOperrand*>(constantOf(code, tables));
+                if (!shape) throw runtime_error("FVM: FOR NEW_OBJECT EXPECTED SHAPE (OPERRAND)");
+
+                auto fields = makePooled<OperrandMap>();
+                auto object = makePooled<InstructionObjectOperrand>(fields);
+                gc.track(object);
+
+                for (size_t i = shape->operrand.size(); i > 0; --i) {
+                    shared_ptr<InstructionOperrand> value = pop();
+
+                    if (auto method = dynamic_pointer_cast<InstructionFunctionOperrand>(value)) {
+                        vector<UpvalueDescriptor>& upvalues = method->operrand->upvalues;
+
+                        if (!upvalues.empty() && upvalues.front().isSelf && !method->upvalues.front()->value) {
+                            method->upvalues.front()->value = object;
+                        }
+                    }
+
+                    (*fields)[shape->operrand.at(i - 1)] = value;
                 }
-                break;
-            case F_BIGGER:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(binaryNumbersCondition(two, one, F_BIGGER)));
+                if (profiler) {
+                    object->site = tables.sites[code.argument()];
+                    profiler->recordAllocation(object->site, object->heapSize());
                 }
-                break;
-            case F_SMALLER:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(binaryNumbersCondition(two, one, F_SMALLER)));
+                push(object);
+            }
+            break;
+        case F_CLONE:
+            {
+                auto constant = dynamic_cast<InstructionConstantOperrand*>(constantOf(code, tables));
+                if (!constant) throw runtime_error("FVM: FOR CLONE EXPECTED CONSTANT (OPERRAND)");
+
+                push(cloneConstant(constant->operrand, constant->isFlat, this, tables.sites[code.argument()]));
+            }
+            break;
+        case F_MAKE_CLOSURE:
+            {
+                auto func = dynamic_cast<InstructionFunctionOperrand*>(constantOf(code, tables));
+                if (!func) throw runtime_error("FVM: NO FUNCTION FOR MAKE_CLOSURE");
+
+                shared_ptr<InstructionFunctionOperrand> newClosure = makePooled<InstructionFunctionOperrand>(func->operrand);
+
+                for (UpvalueDescriptor upvalue: func->operrand->upvalues) {
+                    if (upvalue.isSelf) newClosure->upvalues.push_back(makePooled<UpvalueCell>());
+                    else if (upvalue.fromParent) {
+                        if (!closure || upvalue.index >= closure->upvalues.size()) throw runtime_error("FVM: UPVALUE " + upvalue.id + " NOT CAPTURED BY ENCLOSING FUNCTION");
+
+                        newClosure->upvalues.push_back(closure->upvalues.at(upvalue.index));
+                    } else newClosure->upvalues.push_back(captureMember(scope, upvalue));
                 }
-                break;
-            case F_BIGGER_OR_EQ:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(binaryNumbersCondition(two, one, F_BIGGER_OR_EQ)));
+                gc.track(newClosure);
+
+                push(newClosure);
+            }
+            break;
+        case F_GETUPVAL:
+        case F_SETUPVAL:
+            {
+                // upvalue index is immediate
+                uint32_t index = code.argument();
+
+                if (!closure || index >= closure->upvalues.size()) throw runtime_error("FVM: UPVALUE ACCESS OUTSIDE OF CLOSURE");
+
+                UpvalueCell* cell = closure->upvalues[index].get();
+
+                if (opcode == F_SETUPVAL) {
+                    cell->value = pop();
+                    break;
                 }
-                break;
-            case F_SMALLER_OR_EQ:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
 
-                    push(make_shared<InstructionBoolOperrand>(binaryNumbersCondition(two, one, F_SMALLER_OR_EQ)));
+                if (!cell->value) throw runtime_error("FVM: CAPTURED VARIABLE " + closure->operrand->upvalues.at(index).id + " IS NOT DEFINED");
+
+                push(cell->value);
+            }
+            break;
+        case F_SETENV:
+            {
+                auto val = pop();
+
+                if (code.argument() < tables.names.size()) {
+                    const string& adr = tables.names[code.argument()];
+                    auto member = scope->members.find(adr);
+
+                    if (member != scope->members.end() && member->second.cell) member->second.cell->value = val;
+                    else scope->members[adr] = ScopeMember(val);
                 }
-                break;
-            case F_AND:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
-
-                    if (auto oneCasted = dynamic_pointer_cast<InstructionBoolOperrand>(one)) {
-                        if (auto twoCasted = dynamic_pointer_cast<InstructionBoolOperrand>(two)) {
-                            push(make_shared<InstructionBoolOperrand>(oneCasted->operrand == true && twoCasted->operrand == true));
-                        }
+                else throw runtime_error("FVM: FOR SETVAR EXPECTED ADDRESS (OPERRAND 1)");
+            }
+            break;
+        case F_GETENV:
+            {
+                if (code.argument() < tables.names.size()) {
+                    const string& adr = tables.names[code.argument()];
+                    auto member = scope->members.find(adr);
+
+                    if (member == scope->members.end() || !member->second.get()) throw runtime_error("FVM: BY ADDRESS " + adr + " NOT FINDED ANYTHING");
+
+                    push(member->second.get());
+                    
+                } else throw runtime_error("FVM: FOR GETVAR EXPECTED ADDERS (OPERRAND)");
+            }
+            break;
+        case F_OUTPUT:
+            {
+                shared_ptr<InstructionOperrand> val = pop();
+                string line = "OUTPUT: " + val->tostring() + "\n";
+
+                // fibers print whole lines
+                unique_lock<mutex> guard;
+                if (outputLock) guard = unique_lock<mutex>(*outputLock);
+
+                *out << line << flush;
+            }
+            break;
+        case F_EQ:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(one->isEq(two)));
+            }
+            break;
+        case F_NOTEQ:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(!(one->isEq(two))));
+            }
+            break;
+        case F_BIGGER:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(binaryNumbersCondition(two, one, F_BIGGER)));
+            }
+            break;
+        case F_SMALLER:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(binaryNumbersCondition(two, one, F_SMALLER)));
+            }
+            break;
+        case F_BIGGER_OR_EQ:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(binaryNumbersCondition(two, one, F_BIGGER_OR_EQ)));
+            }
+            break;
+        case F_SMALLER_OR_EQ:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                recordFeedback(code, isNumberTag(one->tag) && isNumberTag(two->tag));
+
+                push(boolOperrand(binaryNumbersCondition(two, one, F_SMALLER_OR_EQ)));
+            }
+            break;
+        case F_AND:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
+
+                if (auto oneCasted = dynamic_pointer_cast<InstructionBoolOperrand>(one)) {
+                    if (auto twoCasted = dynamic_pointer_cast<InstructionBoolOperrand>(two)) {
+                        push(boolOperrand(oneCasted->operrand == true && twoCasted->operrand == true));
                     }
                 }
-                break;
-            case F_OR:
-                {
-                    shared_ptr<InstructionOperrand> one = pop();
-                    shared_ptr<InstructionOperrand> two = pop();
+            }
+            break;
+        case F_OR:
+            {
+                shared_ptr<InstructionOperrand> one = pop();
+                shared_ptr<InstructionOperrand> two = pop();
 
-                    bool isFalse = false;
-                    if (auto casted = dynamic_pointer_cast<InstructionBoolOperrand>(two)) isFalse = !casted->operrand;
+                bool isFalse = false;
+                if (auto casted = dynamic_pointer_cast<InstructionBoolOperrand>(two)) isFalse = !casted->operrand;
 
-                    if (dynamic_pointer_cast<InstructionNullOperrand>(two) || isFalse) push(one);
-                    else push(two);
-                }
-                break;
-            case F_ADD:
-                {
-                    auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
-                    auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                if (dynamic_pointer_cast<InstructionNullOperrand>(two) || isFalse) push(one);
+                else push(two);
+            }
+            break;
+        case F_ADD:
+            {
+                shared_ptr<InstructionOperrand> right = pop();
+                shared_ptr<InstructionOperrand> left = pop();
 
-                    if (val1 && val2) push(make_shared<InstructionNumberOperrand>(val1->operrand + val2->operrand));
-                    else throw runtime_error("FVM: ADD ERROR! OPERRANDS MUST BE A NUMBERS");
-                }
-                break;
-            case F_SUB:
-                {
-                    auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
-                    auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(right);
+                auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(left);
 
-                    if (val1 && val2) push(make_shared<InstructionNumberOperrand>(val2->operrand - val1->operrand));
-                    else throw runtime_error("FVM: SUB ERROR! OPERRANDS MUST BE A NUMBERS");
+                recordFeedback(code, val1 && val2);
+
+                if (val1 && val2) push(makePooled<InstructionNumberOperrand>(val1->operrand + val2->operrand));
+                else {
+                    auto text1 = dynamic_pointer_cast<InstructionStringOperrand>(right);
+                    auto text2 = dynamic_pointer_cast<InstructionStringOperrand>(left);
+
+                    if (!text1 && !text2) throw runtime_error("FVM: ADD ERROR! OPERRANDS MUST BE A NUMBERS OR STRINGS");
+
+                    // other operrand is joined as it is printed by output
+                    if (!text1) text1 = makePooled<InstructionStringOperrand>(right->tostring());
+                    if (!text2) text2 = makePooled<InstructionStringOperrand>(left->tostring());
+
+                    push(concatStrings(text2, text1));
                 }
-                break;
-            case F_MUL:
-                {
-                    auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
-                    auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+            }
+            break;
+        case F_SUB:
+            {
+                auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+
+                recordFeedback(code, val1 && val2);
+
+                if (val1 && val2) push(makePooled<InstructionNumberOperrand>(val2->operrand - val1->operrand));
+                else throw runtime_error("FVM: SUB ERROR! OPERRANDS MUST BE A NUMBERS");
+            }
+            break;
+        case F_MUL:
+            {
+                auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+
+                recordFeedback(code, val1 && val2);
+
+                if (val1 && val2) push(makePooled<InstructionNumberOperrand>(val1->operrand * val2->operrand));
+                else throw runtime_error("FVM: MUL ERROR! OPERRANDS MUST BE A NUMBERS");
+            }
+            break;
+        case F_DIV:
+            {
+                auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+                auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
+
+                recordFeedback(code, val1 && val2);
+
+                if (val1 && val2) push(makePooled<InstructionNumberOperrand>(val2->operrand / val1->operrand));
+                else throw runtime_error("FVM: DIV ERROR! OPERRANDS MUST BE A NUMBERS");
+            }
+            break;
+        case F_MOD:
+        case F_SHL:
+        case F_SHR:
+        case F_BIT_AND:
+        case F_BIT_OR:
+        case F_BIT_XOR:
+            {
+                shared_ptr<InstructionOperrand> right = pop();
+                shared_ptr<InstructionOperrand> left = pop();
+
+                push(makePooled<InstructionNumberOperrand>(integerOperation(opcode, left.get(), right.get())));
+            }
+            break;
+        case F_ADD_NUM:
+        case F_SUB_NUM:
+        case F_MUL_NUM:
+        case F_DIV_NUM:
+        case F_EQ_NUM:
+        case F_NOTEQ_NUM:
+        case F_BIGGER_NUM:
+        case F_SMALLER_NUM:
+        case F_BIGGER_OR_EQ_NUM:
+        case F_SMALLER_OR_EQ_NUM:
+            {
+                double left;
+                double right;
+
+                if (!topNumbers(vmStack, left, right)) {
+                    // type miss: back to generic opcode, its handler does this execution (or throws), which is
+                    // counted once, under generic opcode
+                    Bytecode generic = genericOpcode(opcode);
 
-                    if (val1 && val2) push(make_shared<InstructionNumberOperrand>(val1->operrand * val2->operrand));
-                    else throw runtime_error("FVM: MUL ERROR! OPERRANDS MUST BE A NUMBERS");
+                    if (allocStats) {
+                        executedByOpcode[opcode]--;
+                        executedByOpcode[generic]++;
+                        currentOpcode = generic;
+                    }
+
+                    opcode = generic;
+                    code.setCode(opcode);
+                    setFeedback(code, 0, deoptsOf(code) + 1);
+
+                    goto dispatch;
                 }
-                break;
-            case F_DIV:
-                {
-                    auto val1 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
-                    auto val2 = dynamic_pointer_cast<InstructionNumberOperrand>(pop());
 
-                    if (val1 && val2) push(make_shared<InstructionNumberOperrand>(val2->operrand / val1->operrand));
-                    else throw runtime_error("FVM: DIV ERROR! OPERRANDS MUST BE A NUMBERS");
+                vmStack.pop_back();
+                shared_ptr<InstructionOperrand>& result = vmStack.back();
+
+                switch (opcode) {
+                    case F_ADD_NUM: result = makePooled<InstructionNumberOperrand>(left + right); break;
+                    case F_SUB_NUM: result = makePooled<InstructionNumberOperrand>(left - right); break;
+                    case F_MUL_NUM: result = makePooled<InstructionNumberOperrand>(left * right); break;
+                    case F_DIV_NUM: result = makePooled<InstructionNumberOperrand>(left / right); break;
+                    case F_EQ_NUM: result = boolOperrand(left == right); break;
+                    case F_NOTEQ_NUM: result = boolOperrand(left != right); break;
+                    case F_BIGGER_NUM: result = boolOperrand(left > right); break;
+                    case F_SMALLER_NUM: result = boolOperrand(left < right); break;
+                    case F_BIGGER_OR_EQ_NUM: result = boolOperrand(left >= right); break;
+                    default: result = boolOperrand(left <= right); break;
                 }
-                break;
-            default:
-                break;
-        }
+            }
+            break;
+        default:
+            break;
     }
 
-    for (auto v: scope->members) {
-        if (parent != nullptr && parent->members.find(v.first) != parent->members.end() && !v.second.isLocal) {
-            parent->members[v.first] = v.second;
-        }
+    return false;
+}
+
+void FVM::callFunction(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args) {
+    // body of generator runs when values are asked for
+    if (func->operrand->isGenerator) {
+        push(makeGenerator(this, func, args));
+        return;
     }
 
-    return false;
+    runFunction(func, args);
+}
+
+shared_ptr<InstructionOperrand> FVM::call(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args) {
+    size_t depth = vmStack.size();
+
+    if (!jit || !jit->tryCall(this, func, args)) callFunction(func, args);
+
+    return vmStack.size() > depth ? pop() : nullOperrand();
+}
+
+void FVM::runFunction(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args) {
+    shared_ptr<FuncDeclaration> funcDeclar = func->operrand;
+    funcDeclar->compileBody();
+
+    shared_ptr<Scope> newScope = makePooled<Scope>();
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        shared_ptr<InstructionOperrand> arg = args.at(i);
+        string id = funcDeclar->argsIds.at(i);
+
+        newScope->members.insert({ id, ScopeMember(arg, true) });
+    }
+
+    if (funcDeclar->compiled) funcDeclar->compiled(this, newScope, nullptr, func);
+    else run(funcDeclar->bytecode, *funcDeclar->tables, newScope, nullptr, func);
+}
+
+bool FVM::forIn(function<bool()> body) {
+    if (vmStack.empty()) throw runtime_error("FVM: for-in EXPECTED VALUE IN STACK");
+
+    // iterated value stays in stack while body runs, so collector sees it; its index is counted from start of
+    // stack of running generator, which moves when generator is suspended
+    auto base = [this]() { return generator ? generator->stackBase : 0; };
+
+    size_t slot = vmStack.size() - 1 - base();
+    shared_ptr<InstructionOperrand> iterable = vmStack.back();
+
+    bool returned = false;
+
+    auto iteration = [&](shared_ptr<InstructionOperrand> element) {
+        push(element);
+        returned = body();
+
+        // values left by statements of body
+        if (!returned) vmStack.resize(base() + slot + 1);
+    };
+
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(iterable)) {
+        // elements added by body are visited too
+        for (size_t i = 0; !returned && i < array->operrand->size(); ++i) iteration((*array->operrand)[i]);
+    } else if (auto frozen = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(iterable)) {
+        for (size_t i = 0; !returned && i < frozen->operrand.size(); ++i) iteration(frozen->operrand.get(i));
+    } else if (auto casted = dynamic_pointer_cast<InstructionGeneratorOperrand>(iterable)) {
+        Generator* iterated = casted->operrand.get();
+
+        while (!returned && iterated->resume()) iteration(iterated->value);
+    } else if (auto typed = dynamic_pointer_cast<InstructionTypedArrayOperrand>(iterable)) {
+        for (size_t i = 0; !returned && i < typed->size(); ++i) iteration(typed->get(i));
+    } else throw runtime_error("FVM: for-in EXPECTED ARRAY OR GENERATOR, GOT " + iterable->tostring());
+
+    // result of return is above it
+    vmStack.erase(vmStack.begin() + base() + slot);
+
+    return returned;
 }
 
 void FVM::push(shared_ptr<InstructionOperrand> operrand) {
-    vmStack.push(operrand);
+    vmStack.push_back(operrand);
 }
 
 shared_ptr<InstructionOperrand> FVM::pop() {
-    if (vmStack.empty() || vmStack.top() == nullptr) throw runtime_error("FVM: CANNOT POP FROM EMPTY STACK");
+    if (vmStack.empty() || vmStack.back() == nullptr) throw runtime_error("FVM: CANNOT POP FROM EMPTY STACK");
 
-    auto top = vmStack.top();
-    vmStack.pop();
+    auto top = vmStack.back();
+    vmStack.pop_back();
     return top;
 }
 
-string FVM::getBytecodeString(vector<Instruction> bytecode) {
+void FVM::printAllocStats() {
+    *out << "[ ALLOCATIONS ]" << endl;
+
+    size_t executed = 0;
+    size_t allocations = 0;
+
+    for (size_t opcode = 0; opcode < F_OPCODES_COUNT; ++opcode) {
+        if (executedByOpcode[opcode] == 0) continue;
+
+        executed += executedByOpcode[opcode];
+        allocations += allocationsByOpcode[opcode];
+
+        *out << "  > " << opcodeToString(Bytecode(opcode)) << " | executed: " << executedByOpcode[opcode] << " | allocations: " << allocationsByOpcode[opcode]
+            << " | per instruction: " << (double)allocationsByOpcode[opcode] / executedByOpcode[opcode] << endl;
+    }
+
+    *out << "  > TOTAL | executed: " << executed << " | allocations: " << allocations << " | pool chunks: " << pool.chunks << endl;
+}
+
+string FVM::getBytecodeString(vector<Instruction>& bytecode, CodeTables& tables) {
     string str = "";
 
     for (Instruction code: bytecode) {
+        Bytecode opcode = code.code();
+        uint32_t argument = code.argument();
+
+        // argument is decoded by table it points into
         string opStr;
-        string opStr2;
 
-        if (code.operrand.has_value()) {
-            opStr = code.operrand.value()->tostring();
+        switch (argumentKind(opcode)) {
+            case ARGUMENT_CONSTANT:
+                if (argument < tables.constants.size()) opStr = "#" + to_string(argument) + " " + tables.constants[argument]->tostring();
+                break;
+            case ARGUMENT_NAME:
+                if (argument < tables.names.size()) opStr = "$" + to_string(argument) + " " + tables.names[argument];
+                break;
+            case ARGUMENT_BRANCH:
+                opStr = "branch " + to_string(argument);
+                break;
+            case ARGUMENT_IMMEDIATE:
+                opStr = to_string(argument);
+                break;
+            default:
+                break;
         }
 
-        string opcodeName = opcodeToString(code.code);
+        string opcodeName = opcodeToString(opcode);
 
-        str += "\n  > " + to_string(code.code) + " | " + (opcodeName != "unknown" ? opcodeName : to_string(code.code)) + " " + opStr + " " + opStr2;
+        str += "\n  > " + to_string(opcode) + " | " + (opcodeName != "unknown" ? opcodeName : to_string(opcode)) + " " + opStr;
     }
 
     return "[ BYTECODE ]" + str;
-}
\ No newline at end of file
+}
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <chrono>
+
+#include "include/gc.h"
+#include "include/fvm.h"
+
+using namespace std;
+
+void GarbageCollector::track(shared_ptr<InstructionOperrand> operrand) {
+    nursery.push_back(operrand);
+
+    if (nursery.size() >= nurserySize) pending = true;
+}
+
+void GarbageCollector::sweep(vector<weak_ptr<InstructionOperrand>>& generation, vector<weak_ptr<InstructionOperrand>>* promoteTo, vector<shared_ptr<InstructionOperrand>>& garbage) {
+    vector<weak_ptr<InstructionOperrand>> survivors;
+
+    for (weak_ptr<InstructionOperrand>& tracked: generation) {
+        shared_ptr<InstructionOperrand> operrand = tracked.lock();
+
+        // already freed by reference counting
+        if (!operrand) continue;
+
+        if (operrand->gcMark == epoch) {
+            if (promoteTo) promoteTo->push_back(tracked);
+            else survivors.push_back(tracked);
+        } else garbage.push_back(operrand);
+    }
+
+    if (promoteTo) generation.clear();
+    else generation.swap(survivors);
+}
+
+void GarbageCollector::collect(FVM* vm, bool major, bool withRoots) {
+    auto start = chrono::steady_clock::now();
+
+    GcTracer tracer;
+    tracer.epoch = ++epoch;
+
+    if (withRoots) {
+        for (shared_ptr<InstructionOperrand>& operrand: vm->vmStack) tracer.mark(operrand.get());
+
+        vector<Scope*> scopes = { vm->globals.get() };
+
+        for (Frame& frame: vm->frames) {
+            scopes.push_back(frame.scope);
+            tracer.mark(frame.closure);
+        }
+
+        for (Scope* scope: scopes) {
+            if (!scope) continue;
+
+            for (auto& member: scope->members) tracer.mark(member.second.get().get());
+        }
+
+        // without write barrier old objects may point into nursery, minor collection keeps everything they reach
+        if (!major) {
+            for (weak_ptr<InstructionOperrand>& tracked: old) {
+                if (shared_ptr<InstructionOperrand> operrand = tracked.lock()) tracer.mark(operrand.get());
+            }
+        }
+    }
+
+    while (!tracer.worklist.empty()) {
+        InstructionOperrand* operrand = tracer.worklist.back();
+        tracer.worklist.pop_back();
+
+        operrand->trace(tracer);
+    }
+
+    vector<shared_ptr<InstructionOperrand>> garbage;
+
+    sweep(nursery, &old, garbage);
+    if (major) sweep(old, nullptr, garbage);
+
+    // garbage is held until all cycles are broken, then freed at once
+    for (shared_ptr<InstructionOperrand>& operrand: garbage) {
+        stats.bytesReclaimed += operrand->heapSize();
+        operrand->clearReferences();
+    }
+
+    stats.objectsReclaimed += garbage.size();
+    garbage.clear();
+
+    double pause = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    stats.totalPause += pause;
+    if (pause > stats.maxPause) stats.maxPause = pause;
+
+    if (major) {
+        stats.majorCollections++;
+        oldAfterMajor = old.size();
+    } else stats.minorCollections++;
+
+    pending = false;
+}
+
+void GarbageCollector::collectPending(FVM* vm) {
+    // old generation doubled since last full collection
+    bool major = old.size() > oldAfterMajor * 2 + nurserySize;
+
+    collect(vm, major);
+}
+
+size_t generationSize(vector<weak_ptr<InstructionOperrand>>& generation, size_t& objects) {
+    size_t bytes = 0;
+    objects = 0;
+
+    for (weak_ptr<InstructionOperrand>& tracked: generation) {
+        if (shared_ptr<InstructionOperrand> operrand = tracked.lock()) {
+            bytes += operrand->heapSize();
+            objects++;
+        }
+    }
+
+    return bytes;
+}
+
+void GarbageCollector::printStats(ostream& out) {
+    size_t collections = stats.minorCollections + stats.majorCollections;
+
+    size_t nurseryObjects, oldObjects;
+    size_t nurseryBytes = generationSize(nursery, nurseryObjects);
+    size_t oldBytes = generationSize(old, oldObjects);
+
+    out << "[ GC ]" << endl;
+    out << "  > collections | minor: " << stats.minorCollections << " | major: " << stats.majorCollections << endl;
+    out << "  > pause ms | total: " << stats.totalPause << " | max: " << stats.maxPause << " | average: " << (collections ? stats.totalPause / collections : 0) << endl;
+    out << "  > reclaimed cycles | objects: " << stats.objectsReclaimed << " | bytes: " << stats.bytesReclaimed << endl;
+    out << "  > heap | nursery: " << nurseryObjects << " objects, " << nurseryBytes << " bytes | old: " << oldObjects << " objects, " << oldBytes << " bytes" << endl;
+}
@@ -0,0 +1,183 @@
+#include <vector>
+#include <memory>
+#include <iterator>
+
+#include "include/fvm.h"
+#include "include/fiber.h"
+#include "include/generator.h"
+
+using namespace std;
+
+// thrown by yield of cancelled generator, unwinds its body
+struct GeneratorCancelled {};
+
+Generator::Generator(FVM* vm, shared_ptr<InstructionFunctionOperrand> function, vector<shared_ptr<InstructionOperrand>>& args) {
+    this->vm = vm;
+    this->function = function;
+    this->args = args;
+
+    vm->generators.insert(this);
+}
+
+Generator::Generator(FVM* vm, NativeGenerator native) {
+    this->vm = vm;
+    this->native = native;
+
+    vm->generators.insert(this);
+}
+
+Generator::~Generator() {
+    if (!vm) return;
+
+    vm->generators.erase(this);
+    cancel();
+}
+
+void Generator::body() {
+    // arguments are in scope of function from now on
+    vector<shared_ptr<InstructionOperrand>> arguments;
+    arguments.swap(args);
+
+    try {
+        vm->runFunction(function, arguments);
+    } catch (GeneratorCancelled&) {
+    } catch (...) {
+        error = current_exception();
+    }
+}
+
+bool Generator::resume() {
+    if (done) return false;
+
+    if (native) {
+        value = native();
+        done = value == nullptr;
+
+        return !done;
+    }
+
+    if (running) throw runtime_error("FVM: GENERATOR " + function->tostring() + " IS ALREADY RUNNING");
+
+    if (!context) context = makeContext([this]() { body(); });
+
+    // body continues over current stack and frames
+    stackBase = vm->vmStack.size();
+    size_t framesBase = vm->frames.size();
+
+    vm->vmStack.insert(vm->vmStack.end(), make_move_iterator(stack.begin()), make_move_iterator(stack.end()));
+    vm->frames.insert(vm->frames.end(), frames.begin(), frames.end());
+    stack.clear();
+    frames.clear();
+
+    Generator* previous = vm->generator;
+    int opcode = currentOpcode;
+
+    vm->generator = this;
+    running = true;
+
+    resumeContext(context.get());
+
+    running = false;
+    vm->generator = previous;
+    currentOpcode = opcode;
+
+    if (contextReturned(context.get())) {
+        done = true;
+        context.reset();
+        value = nullptr;
+
+        // result of return is not used
+        if (vm->vmStack.size() > stackBase) vm->vmStack.resize(stackBase);
+
+        if (error && !cancelled) {
+            exception_ptr thrown = error;
+            error = nullptr;
+
+            rethrow_exception(thrown);
+        }
+
+        return false;
+    }
+
+    stack.assign(make_move_iterator(vm->vmStack.begin() + stackBase), make_move_iterator(vm->vmStack.end()));
+    frames.assign(vm->frames.begin() + framesBase, vm->frames.end());
+    vm->vmStack.resize(stackBase);
+    vm->frames.resize(framesBase);
+
+    return true;
+}
+
+void Generator::yield(shared_ptr<InstructionOperrand> value) {
+    this->value = value;
+
+    suspendContext(context.get());
+
+    if (cancelled) throw GeneratorCancelled();
+}
+
+void Generator::cancel() {
+    if (!context || done || running) return;
+
+    cancelled = true;
+    resume();
+}
+
+void InstructionGeneratorOperrand::trace(GcTracer& tracer) {
+    Generator* generator = operrand.get();
+
+    tracer.mark(generator->function.get());
+    tracer.mark(generator->value.get());
+
+    for (shared_ptr<InstructionOperrand>& arg: generator->args) tracer.mark(arg.get());
+    for (shared_ptr<InstructionOperrand>& value: generator->stack) tracer.mark(value.get());
+
+    for (Frame& frame: generator->frames) {
+        tracer.mark(frame.closure);
+        if (!frame.scope) continue;
+
+        for (auto& member: frame.scope->members) tracer.mark(member.second.get().get());
+    }
+}
+
+void InstructionGeneratorOperrand::clearReferences() {
+    // running body is rooted by frames of VM, frames of suspended one are needed to unwind it
+    if (operrand->running) return;
+
+    operrand->stack.clear();
+    operrand->args.clear();
+    operrand->value = nullptr;
+}
+
+shared_ptr<InstructionOperrand> makeGenerator(FVM* vm, shared_ptr<InstructionFunctionOperrand> function, vector<shared_ptr<InstructionOperrand>>& args) {
+    auto generator = makePooled<InstructionGeneratorOperrand>(make_shared<Generator>(vm, function, args));
+    vm->gc.track(generator);
+
+    return generator;
+}
+
+shared_ptr<InstructionOperrand> makeRange(FVM* vm, shared_ptr<InstructionOperrand> from, shared_ptr<InstructionOperrand> to) {
+    auto start = dynamic_pointer_cast<InstructionNumberOperrand>(from);
+    auto end = dynamic_pointer_cast<InstructionNumberOperrand>(to);
+    if (!start || !end) throw runtime_error("FVM: range() EXPECTED NUMBERS");
+
+    double current = start->operrand;
+    double last = end->operrand;
+
+    auto generator = makePooled<InstructionGeneratorOperrand>(make_shared<Generator>(vm, [current, last]() mutable -> shared_ptr<InstructionOperrand> {
+        if (current >= last) return nullptr;
+
+        return makePooled<InstructionNumberOperrand>(current++);
+    }));
+    vm->gc.track(generator);
+
+    return generator;
+}
+
+shared_ptr<InstructionOperrand> nextValue(shared_ptr<InstructionOperrand> generator) {
+    auto casted = dynamic_pointer_cast<InstructionGeneratorOperrand>(generator);
+    if (!casted) throw runtime_error("FVM: next() EXPECTED GENERATOR");
+
+    if (!casted->operrand->resume()) return nullOperrand();
+
+    return casted->operrand->value;
+}
@@ -0,0 +1,72 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <string>
+#include <memory>
+#include <initializer_list>
+
+#include "fvm.h"
+
+using namespace std;
+
+// Runtime side of programs generated by --emit-cpp: generated functions call FVM::execute for generic
+// instructions, helpers below are for guards of typed (double) functions and for native IF
+
+inline UpvalueDescriptor aotUpvalue(string id, bool fromParent, size_t index, bool isMutable, bool isSelf) {
+    UpvalueDescriptor upvalue;
+    upvalue.id = id;
+    upvalue.fromParent = fromParent;
+    upvalue.index = index;
+    upvalue.isMutable = isMutable;
+    upvalue.isSelf = isSelf;
+
+    return upvalue;
+}
+
+// nested literals of constant pool
+inline shared_ptr<InstructionArrayOperrand> aotArray(initializer_list<shared_ptr<InstructionOperrand>> elements) {
+    return make_shared<InstructionArrayOperrand>(make_shared<OperrandVector>(elements));
+}
+
+inline shared_ptr<InstructionObjectOperrand> aotObject(initializer_list<pair<const string, shared_ptr<InstructionOperrand>>> fields) {
+    return make_shared<InstructionObjectOperrand>(make_shared<OperrandMap>(fields));
+}
+
+// true - argument is number, typed function can run
+inline bool aotNumberArgument(Scope* scope, const string& id, double& value) {
+    auto member = scope->members.find(id);
+    if (member == scope->members.end()) return false;
+
+    auto number = dynamic_cast<InstructionNumberOperrand*>(member->second.get().get());
+    if (!number) return false;
+
+    value = number->operrand;
+
+    return true;
+}
+
+inline bool aotNumberUpvalue(InstructionFunctionOperrand* closure, size_t index, double& value) {
+    if (!closure || index >= closure->upvalues.size()) return false;
+
+    auto number = dynamic_cast<InstructionNumberOperrand*>(closure->upvalues[index]->value.get());
+    if (!number) return false;
+
+    value = number->operrand;
+
+    return true;
+}
+
+// upvalue holds closure which is being called, so CALL of it is direct recursion
+inline bool aotSelfUpvalue(InstructionFunctionOperrand* closure, size_t index) {
+    return closure && index < closure->upvalues.size() && closure->upvalues[index]->value.get() == closure;
+}
+
+// condition of IF: 1 - true, 0 - false, -1 - not boolean (both branches are skipped)
+inline int aotCondition(FVM* vm) {
+    auto boolean = dynamic_pointer_cast<InstructionBoolOperrand>(vm->pop());
+    if (!boolean) return -1;
+
+    return boolean->operrand ? 1 : 0;
+}
+
+#endif
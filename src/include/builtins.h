@@ -0,0 +1,12 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "fvm.h"
+
+using namespace std;
+
+void defineNative(shared_ptr<Scope> scope, string id, int argsNum, function<shared_ptr<InstructionOperrand>(FVM*, vector<shared_ptr<InstructionOperrand>>)> native);
+
+void registerBuiltins(shared_ptr<Scope> scope);
+
+#endif
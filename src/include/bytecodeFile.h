@@ -0,0 +1,45 @@
+#ifndef BYTECODEFILE_H
+#define BYTECODEFILE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+
+#include "fvm.h"
+
+using namespace std;
+
+// Compiled program (.fmc): header with version and checksum, modules which must run before it (only in
+// --module-cache, programs are linked), then function table, function 0 is top level.
+// Every function has its code tables (constants, allocation sites, names, blocks of IF) and instruction words,
+// words are 4 bytes aligned in file, so they are copied from mapped file in one piece
+const char BYTECODE_MAGIC[4] = { 'F', 'M', 'C', '\0' };
+
+// bumped on every change of layout or opcodes
+const uint32_t BYTECODE_VERSION = 3;
+
+struct BytecodeHeader {
+    char magic[4];
+    uint32_t version;
+
+    // opcodes of femic which wrote file, other count means other instruction set
+    uint32_t opcodes;
+    uint32_t functions;
+
+    uint64_t payloadSize;
+    // FNV-1a of payload
+    uint64_t checksum;
+};
+
+uint64_t fnv1a(const char* data, size_t size);
+
+void writeBytecodeFile(ostream& out, shared_ptr<FuncDeclaration> program, const vector<string>& imports = {});
+
+// file starts with magic of compiled program
+bool isBytecodeFile(string path);
+
+// runtime error when file is broken, written by other version or for other opcodes
+shared_ptr<FuncDeclaration> loadBytecodeFile(string path, vector<string>* imports = nullptr);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "fvm.h"
+#include "fiber.h"
+
+using namespace std;
+
+// Queue of values between fibers. Bounded channel is lock-free ring (many senders and receivers, every slot has
+// sequence number which says whose turn it is), unbounded one is deque under mutex. Values are copied without
+// collector on send and given to collector of receiving VM on recv
+class Channel {
+    private:
+        struct Slot {
+            atomic<size_t> sequence;
+            shared_ptr<InstructionOperrand> value;
+        };
+
+        // 0 - unbounded
+        size_t capacity;
+
+        // at least 2: with one slot, value written in it (position + 1) and slot freed for next round
+        // (position + slotsCount) have the same sequence, so capacity is checked by sender itself
+        size_t slotsCount = 0;
+        unique_ptr<Slot[]> slots;
+        atomic<size_t> head { 0 };
+        atomic<size_t> tail { 0 };
+
+        mutex lock;
+        deque<shared_ptr<InstructionOperrand>> values;
+
+        atomic<bool> closed { false };
+    public:
+        // fibers and program which wait in send/recv, others wake them only when it is not 0
+        atomic<int> waiting { 0 };
+        FiberWaitList waiters;
+
+        Channel(size_t capacity);
+
+        // false if channel is full
+        bool trySend(shared_ptr<InstructionOperrand> value);
+        // false if channel is empty
+        bool tryRecv(shared_ptr<InstructionOperrand>& value);
+
+        void close() { closed = true; };
+        bool isClosed() { return closed; };
+};
+
+struct InstructionChannelOperrand : InstructionOperrand {
+    shared_ptr<Channel> operrand;
+
+    InstructionChannelOperrand(shared_ptr<Channel> operrand) { this->operrand = operrand; };
+
+    string tostring() override { return "channel"; };
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override { return toEq.get() == this; };
+};
+
+// channel(capacity): capacity 0 - unbounded
+shared_ptr<InstructionOperrand> makeChannel(shared_ptr<InstructionOperrand> capacity);
+
+// send(channel, value) waits while bounded channel is full, recv(channel) waits for value and gives null when channel
+// is closed and empty. Waiting fiber is suspended and its thread runs other fibers
+shared_ptr<InstructionOperrand> sendChannel(FVM* vm, shared_ptr<InstructionOperrand> channel, shared_ptr<InstructionOperrand> value);
+shared_ptr<InstructionOperrand> recvChannel(FVM* vm, shared_ptr<InstructionOperrand> channel);
+shared_ptr<InstructionOperrand> closeChannel(FVM* vm, shared_ptr<InstructionOperrand> channel);
+
+#endif
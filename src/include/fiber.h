@@ -0,0 +1,169 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <chrono>
+#include <queue>
+#include <map>
+
+#include "fvm.h"
+
+using namespace std;
+
+enum FiberState {
+    FIBER_PENDING,
+    FIBER_RUNNING,
+    FIBER_DONE,
+};
+
+struct Fiber;
+
+// fibers suspended until something happens (channel changes, fiber is done), guarded by lock of scheduler
+typedef vector<shared_ptr<Fiber>> FiberWaitList;
+
+// stack and saved registers of coroutine (fiber or generator), defined by platform in fiber.cpp
+struct FiberContext;
+
+// body runs on its own stack: resumeContext() runs it until suspendContext() from inside or until body returns
+shared_ptr<FiberContext> makeContext(function<void()> body);
+void resumeContext(FiberContext* context);
+void suspendContext(FiberContext* context);
+bool contextReturned(FiberContext* context);
+
+// work of fiber started by VM itself (chunk of parallel_map), runs on VM of fiber and gives its result
+typedef function<shared_ptr<InstructionOperrand>(FVM*)> FiberTask;
+
+// Function started by spawn(). Fiber has its own VM (operand stack, frames, collector) and shares heap account
+// of program; function, its upvalues and result are copied between VMs, so no value is reachable from two fibers
+struct Fiber : enable_shared_from_this<Fiber> {
+    unique_ptr<FVM> vm;
+    shared_ptr<InstructionFunctionOperrand> function;
+    // runs instead of function when it is set
+    FiberTask task;
+
+    atomic<int> state { FIBER_PENDING };
+
+    // set when done, value lives in heap of vm until join copies it
+    shared_ptr<InstructionOperrand> result;
+    exception_ptr error;
+
+    // suspended fiber is resumed by thread which started it (thread locals of allocator stay valid), its queue
+    size_t home = 0;
+    shared_ptr<FiberContext> context;
+
+    // thread locals of VM while fiber is suspended
+    HeapAccount* account = nullptr;
+    size_t* allocations = nullptr;
+    int opcode = -1;
+
+    FiberWaitList joiners;
+
+    void run();
+};
+
+struct InstructionFiberOperrand : InstructionOperrand {
+    shared_ptr<Fiber> operrand;
+
+    InstructionFiberOperrand(shared_ptr<Fiber> operrand) { this->operrand = operrand; };
+
+    string tostring() override { return "fiber"; };
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override { return toEq.get() == this; };
+};
+
+// M:N scheduler: fibers are coroutines on pool of threads, every thread has its own deque and steals from others
+// when it is empty. Fiber which waits (delay, join, channels) is suspended and its thread runs other fibers,
+// timers of delay are kept by thread of fiber, so thousands of delays can wait on one thread
+class FiberScheduler {
+    private:
+        struct FiberTimer {
+            chrono::steady_clock::time_point deadline;
+            shared_ptr<Fiber> fiber;
+
+            bool operator>(const FiberTimer& other) const { return deadline > other.deadline; };
+        };
+
+        struct FiberQueue {
+            mutex lock;
+            deque<shared_ptr<Fiber>> fibers;
+
+            // suspended fibers of this thread which can continue, they are not stolen (guarded by lock of scheduler)
+            deque<shared_ptr<Fiber>> resumed;
+            // used only by thread of queue
+            priority_queue<FiberTimer, vector<FiberTimer>, greater<FiberTimer>> timers;
+        };
+
+        // one per worker, last one takes fibers spawned outside of workers
+        vector<unique_ptr<FiberQueue>> queues;
+        vector<thread> workers;
+
+        // sleeping workers and program wait here, woken by spawn, resumed and finished fibers
+        mutex lock;
+        condition_variable changed;
+        size_t queued = 0;
+        // fibers which are not done, workers stop when program is finished and it is 0
+        size_t live = 0;
+        bool stopping = false;
+
+        shared_ptr<Fiber> take(size_t queue);
+
+        // one fiber which can continue or was not started yet (own queue, shared queue or other worker), false if
+        // there was none
+        bool runOne();
+        void work(size_t index);
+
+        void resume(shared_ptr<Fiber> fiber);
+        // back to thread, fiber must be in wait list or timers before it
+        void suspend(Fiber* fiber);
+        // fibers of list can continue, called under lock
+        void wake(FiberWaitList& waiting);
+    public:
+        FiberScheduler(size_t threads);
+        ~FiberScheduler();
+
+        void submit(shared_ptr<Fiber> fiber);
+        void join(Fiber* fiber);
+
+        // waits until ready() is true, ready is checked again after every notify() of waiting list. Fiber is
+        // suspended, program sleeps
+        void block(function<bool()> ready, FiberWaitList& waiting);
+        void notify(FiberWaitList& waiting);
+
+        // delay inside fiber
+        void sleep(double seconds);
+
+        // waits for all fibers and stops threads
+        void shutdown();
+};
+
+// values already copied to other VM, so shared cells and cycles stay shared and cycles
+struct FiberCopies {
+    map<InstructionOperrand*, shared_ptr<InstructionOperrand>> values;
+    map<UpvalueCell*, shared_ptr<UpvalueCell>> cells;
+};
+
+// copy of value owned by target VM, scalars and immutable collections without functions are shared as is.
+// Without target copy is not tracked by any collector, adopt() gives it to VM later
+shared_ptr<InstructionOperrand> transfer(shared_ptr<InstructionOperrand> value, FVM* target, FiberCopies& copies);
+void adopt(shared_ptr<InstructionOperrand> value, FVM* target);
+
+// fiber with its own VM on scheduler of vm (created by first fiber), function or task is set before submit
+shared_ptr<Fiber> makeFiber(FVM* vm);
+// threads of scheduler which vm uses or will use
+size_t fiberThreadsOf(FVM* vm);
+
+// spawn(function): function without arguments runs on fiber, its upvalues are copied
+shared_ptr<InstructionOperrand> spawnFiber(FVM* vm, shared_ptr<InstructionOperrand> function);
+
+// join(fiber) - its result, join(array of fibers) - array of results; error of fiber is thrown here
+shared_ptr<InstructionOperrand> joinFiber(FVM* vm, shared_ptr<InstructionOperrand> value);
+
+#endif
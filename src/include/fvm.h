@@ -1,6 +1,7 @@
 #ifndef FVM_H
 #define FVM_H
 
+#include <iostream>
 #include <stack>
 #include <vector>
 #include <any>
@@ -8,6 +9,14 @@
 #include <optional>
 #include <map>
 #include <variant>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <set>
+#include <string_view>
+
+#include "gc.h"
 
 using namespace std;
 
@@ -17,7 +26,11 @@ enum Bytecode {
     F_SETENV,
     F_GETENV,
 
+    F_SETUPVAL,
+    F_GETUPVAL,
+
     F_LOADIFST,
+    F_MAKE_CLOSURE,
     F_CALL,
     F_RETURN,
     F_DELAY,
@@ -29,6 +42,14 @@ enum Bytecode {
     F_DIV,
     F_SUB,
 
+    // integer operators, operrands are converted to 64 bit integers
+    F_MOD,
+    F_SHL,
+    F_SHR,
+    F_BIT_AND,
+    F_BIT_OR,
+    F_BIT_XOR,
+
     F_EQ,
     F_NOTEQ,
     F_BIGGER,
@@ -45,16 +66,147 @@ enum Bytecode {
 
     F_INDEXATION,
     F_SETINDEX,
+
+    F_NEW_ARRAY,
+    F_NEW_OBJECT,
+    F_CLONE,
+
+    // argument is branch with body of loop, iterated value is on stack
+    F_FOR_IN,
+    F_YIELD,
+
+    // quickened forms of arithmetic and comparisons, written over generic opcode when type feedback saw only numbers
+    F_ADD_NUM,
+    F_SUB_NUM,
+    F_MUL_NUM,
+    F_DIV_NUM,
+
+    F_EQ_NUM,
+    F_NOTEQ_NUM,
+    F_BIGGER_NUM,
+    F_SMALLER_NUM,
+    F_BIGGER_OR_EQ_NUM,
+    F_SMALLER_OR_EQ_NUM,
+
+    F_OPCODES_COUNT,
+};
+
+// live bytes of one FVM, blocks remember account they were charged to
+struct HeapAccount {
+    atomic<size_t> liveBytes { 0 };
+    atomic<size_t> peakBytes { 0 };
+
+    // --max-heap, 0 - no limit
+    size_t limit = 0;
+
+    // live bytes passed pressureBytes, VM runs full collection at next safepoint
+    atomic<size_t> pressureBytes { 0 };
+    atomic<bool> underPressure { false };
+
+    // owner VM and every live block hold reference, account is freed with last of them
+    atomic<size_t> references { 1 };
+
+    void release() { if (references.fetch_sub(1, memory_order_acq_rel) == 1) delete this; };
+};
+
+// account charged by allocations of this thread, set by running FVM
+extern thread_local HeapAccount* currentAccount;
+
+// --alloc-stats counters of running VM, fibers take them with their stacks when they are suspended
+extern thread_local int currentOpcode;
+extern thread_local size_t* opcodeAllocations;
+
+// every runtime value goes through this entry point: size classes with free lists, big blocks go to operator new
+void* allocateMemory(size_t size);
+void freeMemory(void* memory, size_t size);
+
+template <typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    // blocks are prefixed with 8 bytes account header
+    static_assert(alignof(T) <= 8, "pooled type must not need more than 8 bytes alignment");
+
+    PoolAllocator() = default;
+    template <typename U> PoolAllocator(const PoolAllocator<U>&) {};
+
+    T* allocate(size_t n) { return static_cast<T*>(allocateMemory(n * sizeof(T))); };
+    void deallocate(T* memory, size_t n) { freeMemory(memory, n * sizeof(T)); };
+
+    template <typename U> bool operator==(const PoolAllocator<U>&) const { return true; };
+    template <typename U> bool operator!=(const PoolAllocator<U>&) const { return false; };
 };
 
+template <typename T, typename... Args>
+shared_ptr<T> makePooled(Args&&... args) {
+    return allocate_shared<T>(PoolAllocator<T>(), forward<Args>(args)...);
+}
+
+struct InstructionOperrand;
+struct ScopeMember;
+
+typedef vector<shared_ptr<InstructionOperrand>, PoolAllocator<shared_ptr<InstructionOperrand>>> OperrandVector;
+typedef map<string, shared_ptr<InstructionOperrand>, less<string>, PoolAllocator<pair<const string, shared_ptr<InstructionOperrand>>>> OperrandMap;
+typedef map<string, ScopeMember, less<string>, PoolAllocator<pair<const string, ScopeMember>>> ScopeMembers;
+
+struct InstructionOperrand;
+
+struct GcTracer {
+    unsigned epoch;
+    vector<InstructionOperrand*> worklist;
+
+    // set by heap profiler: mark() only collects direct references of traced operrand
+    vector<InstructionOperrand*>* references = nullptr;
+
+    void mark(InstructionOperrand* operrand);
+};
+
+// cheap type test for hot paths, quickened opcodes check it instead of dynamic cast
+enum OperrandTag : uint8_t {
+    TAG_OTHER,
+
+    // number with fraction or out of small integer range
+    TAG_NUMBER,
+    // number which is integer in int32 range, array indexes and integer operators check only this tag
+    TAG_INT,
+};
+
+inline bool isNumberTag(OperrandTag tag) { return tag == TAG_NUMBER || tag == TAG_INT; }
+
 struct InstructionOperrand {
     any operrand;
 
+    // epoch of last collection that reached this operrand
+    unsigned gcMark = 0;
+
+    OperrandTag tag = TAG_OTHER;
+
+    virtual ~InstructionOperrand() = default;
+
     virtual string tostring() { return "unknown"; }; 
 
     virtual bool isEq(shared_ptr<InstructionOperrand> toEq) { return false; };
+
+    // operrands which can hold other heap values (and form cycles) are traced by collector
+    virtual bool hasReferences() { return false; };
+    virtual void trace(GcTracer& tracer) {};
+    virtual void clearReferences() {};
+
+    virtual size_t heapSize() { return sizeof(InstructionOperrand); };
 };
 
+inline void GcTracer::mark(InstructionOperrand* operrand) {
+    if (references) {
+        if (operrand) references->push_back(operrand);
+        return;
+    }
+
+    if (!operrand || !operrand->hasReferences() || operrand->gcMark == epoch) return;
+
+    operrand->gcMark = epoch;
+    worklist.push_back(operrand);
+}
+
 struct InstructionNullOperrand : InstructionOperrand {
     bool operrand = true;
 
@@ -74,7 +226,13 @@ struct InstructionNullOperrand : InstructionOperrand {
 struct InstructionNumberOperrand : InstructionOperrand {
     double operrand;
 
-    InstructionNumberOperrand(double operrand) { this->operrand = operrand; };
+    // results of arithmetic which leave int32 range are promoted to plain numbers here
+    InstructionNumberOperrand(double operrand) {
+        this->operrand = operrand;
+        this->tag = operrand >= -2147483648.0 && operrand <= 2147483647.0 && (double)(int32_t)operrand == operrand ? TAG_INT : TAG_NUMBER;
+    };
+
+    size_t heapSize() override { return sizeof(*this); };
 
     string tostring() override {
         return to_string(operrand);
@@ -86,17 +244,45 @@ struct InstructionNumberOperrand : InstructionOperrand {
     }
 };
 
+// Text is kept in one of three forms: flat (std::string, up to 15 chars inside the operrand itself), rope (two
+// strings joined by +, copied into flat text only when it is read) or slice (view into flat text of other string)
 struct InstructionStringOperrand : InstructionOperrand {
-    string operrand;
+    // text of flat string, rope gets it when it is read
+    string flat;
+
+    // parts of rope, null once it is flattened
+    shared_ptr<InstructionStringOperrand> left;
+    shared_ptr<InstructionStringOperrand> right;
+
+    // flat string which slice points into
+    shared_ptr<InstructionStringOperrand> source;
+    size_t offset = 0;
+
+    size_t length = 0;
 
-    InstructionStringOperrand(string operrand) { this->operrand = operrand; };
+    // text outside of small string buffer is charged separately
+    HeapAccount* account = nullptr;
+    size_t charged = 0;
+
+    InstructionStringOperrand(string operrand);
+    InstructionStringOperrand(shared_ptr<InstructionStringOperrand> left, shared_ptr<InstructionStringOperrand> right);
+    InstructionStringOperrand(shared_ptr<InstructionStringOperrand> source, size_t offset, size_t length);
+    ~InstructionStringOperrand();
+
+    // rope is joined into flat text on first call; that writes to operrand, so strings are read once before they
+    // are shared with other threads
+    string_view text();
+    // charges flat text outside of small string buffer to account of running VM
+    void charge();
+
+    size_t heapSize() override { return sizeof(*this) + (flat.capacity() > 15 ? flat.capacity() : 0); };
 
     string tostring() override  {
-        return operrand;
+        return string(text());
     }
 
     bool isEq(shared_ptr<InstructionOperrand> toEq) override {
-        if (auto casted = dynamic_pointer_cast<InstructionStringOperrand>(toEq)) return operrand == casted->operrand;
+        if (auto casted = dynamic_pointer_cast<InstructionStringOperrand>(toEq)) return text() == casted->text();
         return false;
     }
 };
@@ -117,35 +303,104 @@ struct InstructionBoolOperrand : InstructionOperrand {
     }
 };
 
-struct Instruction {
-    optional<shared_ptr<InstructionOperrand>> operrand;
-    Bytecode code;
+// immortal instances, comparisons and missing values never allocate
+shared_ptr<InstructionBoolOperrand> boolOperrand(bool value);
+shared_ptr<InstructionNullOperrand> nullOperrand();
+
+// false when number has fraction or is too big to be exact
+bool toInteger(InstructionOperrand* operrand, int64_t& integer);
 
-    Instruction(Bytecode code, 
-        optional<shared_ptr<InstructionOperrand>> operrand
-    ) { this->code = code; this->operrand = operrand; };
+// left + right without copying text of long strings
+shared_ptr<InstructionStringOperrand> concatStrings(shared_ptr<InstructionStringOperrand> left, shared_ptr<InstructionStringOperrand> right);
 
-    Instruction(Bytecode code) { this->code = code; };
+// slice(s, from, to): part of s from `from` up to `to` (not included, cut at end of s), shares text of s
+shared_ptr<InstructionOperrand> sliceString(shared_ptr<InstructionOperrand> value, shared_ptr<InstructionOperrand> from, shared_ptr<InstructionOperrand> to);
 
+// source line of instruction which creates or grows arrays and objects, reported by --heap-profile
+struct AllocationSite {
+    string file;
+    int line;
+
+    AllocationSite(string file, int line) { this->file = file; this->line = line; };
+
+    string tostring() const { return file + ":" + to_string(line); };
+};
+
+// one instance per file and line, never freed, so instructions and operrands keep plain pointer
+const AllocationSite* internAllocationSite(string file, int line);
+
+// 8 bit opcode and 24 bit argument. Argument is index into CodeTables of function (constants, names, branches),
+// upvalue index for GETUPVAL/SETUPVAL, and type feedback for arithmetic and comparisons.
+// Word is read and written whole (relaxed atomic, plain mov on x86): VMs of --jobs share code of modules and
+// quicken it at the same time, each of them sees opcode with its own argument, lost feedback only costs a deopt
+struct Instruction {
+    uint32_t word = 0;
+
+    Instruction(Bytecode code, uint32_t argument = 0) { word = (uint32_t)code | (argument << 8); };
     Instruction() = default;
+
+    Instruction(const Instruction& other) { word = other.load(); };
+    Instruction& operator=(const Instruction& other) { store(other.load()); return *this; };
+
+    uint32_t load() const { return __atomic_load_n(&word, __ATOMIC_RELAXED); };
+    void store(uint32_t value) { __atomic_store_n(&word, value, __ATOMIC_RELAXED); };
+
+    Bytecode code() const { return Bytecode(load() & 0xFF); };
+    uint32_t argument() const { return load() >> 8; };
+
+    void setCode(Bytecode code) { store((load() & ~0xFFu) | (uint32_t)code); };
+    void setArgument(uint32_t argument) { store((load() & 0xFF) | (argument << 8)); };
 };
 
-struct Scope;
+static_assert(sizeof(Instruction) == 4, "instruction must stay packed in 32 bits");
 
-struct FuncDeclaration {
-    vector<Instruction> bytecode;
-    vector<string> argsIds;
+// biggest argument, tables of one function cannot have more entries
+const uint32_t MAX_ARGUMENT = 0xFFFFFF;
+
+// what argument of opcode means
+enum ArgumentKind {
+    ARGUMENT_NONE,
+
+    // index into constants (and sites) of CodeTables
+    ARGUMENT_CONSTANT,
+    ARGUMENT_NAME,
+    ARGUMENT_BRANCH,
+
+    // upvalue index
+    ARGUMENT_IMMEDIATE,
+};
+
+ArgumentKind argumentKind(Bytecode opcode);
+
+struct UpvalueCell {
+    shared_ptr<InstructionOperrand> value;
+
+    UpvalueCell(shared_ptr<InstructionOperrand> value) { this->value = value; };
+    UpvalueCell() = default;
+};
+
+struct UpvalueDescriptor {
     string id;
 
-    bool isLambda;
+    // true - captured from upvalues of enclosing function, false - from scope where closure is created
+    bool fromParent = false;
+    size_t index = 0;
 
-    shared_ptr<Scope> scope;
+    // written by owner or by any closure, so owner and every closure capturing it share one cell
+    bool isMutable = false;
 
-    FuncDeclaration(vector<Instruction> bytecode, vector<string> argsIds, string id) { this->bytecode = bytecode; this->argsIds = argsIds, this->id = id; };
-    FuncDeclaration(vector<Instruction> bytecode, vector<string> argsIds) { this->bytecode = bytecode; this->argsIds = argsIds, this->isLambda = true; };
-    FuncDeclaration() = default;
+    // "self" of method, filled by NEW_OBJECT with created object
+    bool isSelf = false;
 };
 
+struct JitFunction;
+struct Scope;
+struct InstructionFunctionOperrand;
+class FVM;
+
+// body generated by --emit-cpp, has same contract as FVM::run (true - returned)
+typedef bool (*CompiledFunction)(FVM* vm, shared_ptr<Scope> scope, shared_ptr<Scope> parent, shared_ptr<InstructionFunctionOperrand> closure);
+
 struct IfStatement {
     vector<Instruction> bytecode;
     vector<Instruction> elseBytecode;
@@ -155,31 +410,109 @@ struct IfStatement {
     IfStatement() = default;
 };
 
+// operrands of instructions of one function (or top level of module), blocks of IF use tables of their function
+struct CodeTables {
+    // PUSH values, functions of MAKE_CLOSURE, and one entry per allocating instruction:
+    // element count of NEW_ARRAY, shape of NEW_OBJECT, constant of CLONE, null for SETINDEX
+    vector<shared_ptr<InstructionOperrand>> constants;
+    // allocation site of instruction which owns entry of constants with same index, null for others
+    vector<const AllocationSite*> sites;
+
+    // variables of GETENV/SETENV
+    vector<string> names;
+
+    // blocks of IF
+    vector<IfStatement> branches;
+};
+
+// entry of constant table which is argument of instruction, null when index is out of table
+InstructionOperrand* constantOf(const Instruction& code, CodeTables& tables);
+
+struct FuncDeclaration;
+
+// body of function which is generated on first call, set by compiler unless --eager-compile
+struct LazyFunctionBody {
+    virtual ~LazyFunctionBody() = default;
+
+    // fills bytecode and tables of declaration
+    virtual void compile(FuncDeclaration* declaration) = 0;
+};
+
+struct FuncDeclaration {
+    vector<Instruction> bytecode;
+    shared_ptr<CodeTables> tables;
+
+    shared_ptr<LazyFunctionBody> lazyBody;
+    once_flag bodyCompiled;
+
+    vector<string> argsIds;
+    vector<UpvalueDescriptor> upvalues;
+    string id;
+
+    bool isLambda = false;
+    // body has yield, call gives generator which runs body when values are asked for
+    bool isGenerator = false;
+
+    // --jit: interpreted calls so far, machine code after threshold, or rejected when bytecode is not supported;
+    // declarations of modules are shared by VMs of --jobs, jitted is read and published by atomic_load/atomic_store
+    atomic<size_t> calls { 0 };
+    shared_ptr<JitFunction> jitted;
+    atomic<bool> jitRejected { false };
+
+    // set in programs compiled ahead of time, bytecode is empty then
+    CompiledFunction compiled = nullptr;
+
+    FuncDeclaration(vector<Instruction> bytecode, vector<string> argsIds, string id) { this->bytecode = bytecode; this->argsIds = argsIds, this->id = id; };
+    FuncDeclaration(vector<Instruction> bytecode, vector<string> argsIds) { this->bytecode = bytecode; this->argsIds = argsIds, this->isLambda = true; };
+    FuncDeclaration() = default;
+
+    // bytecode and tables are ready after it, anything which reads them (run, JIT, serialization) calls it first
+    void compileBody() { if (lazyBody) call_once(bodyCompiled, [this]() { lazyBody->compile(this); }); };
+};
+
 struct InstructionFunctionOperrand : InstructionOperrand {
-    FuncDeclaration operrand;
+    shared_ptr<FuncDeclaration> operrand;
+    vector<shared_ptr<UpvalueCell>> upvalues;
 
-    InstructionFunctionOperrand(FuncDeclaration operrand) { this->operrand = operrand; };
+    InstructionFunctionOperrand(shared_ptr<FuncDeclaration> operrand) { this->operrand = operrand; };
     InstructionFunctionOperrand() = default;
 
     string tostring() override {
-        return !this->operrand.isLambda ? this->operrand.id : "function";
+        return !this->operrand->isLambda ? this->operrand->id : "function";
     }
+
+    bool hasReferences() override { return true; };
+
+    void trace(GcTracer& tracer) override {
+        for (shared_ptr<UpvalueCell> cell: upvalues) tracer.mark(cell->value.get());
+    };
+
+    void clearReferences() override { upvalues.clear(); };
+
+    size_t heapSize() override { return sizeof(*this) + upvalues.capacity() * sizeof(shared_ptr<UpvalueCell>) + upvalues.size() * sizeof(UpvalueCell); };
 };
 
-struct InstructionIfStatementLoadOperrand : InstructionOperrand {
-    IfStatement operrand;
+class FVM;
 
-    InstructionIfStatementLoadOperrand(IfStatement operrand) { this->operrand = operrand; };
+struct InstructionNativeFunctionOperrand : InstructionOperrand {
+    function<shared_ptr<InstructionOperrand>(FVM*, vector<shared_ptr<InstructionOperrand>>)> operrand;
+    int argsNum;
+    string id;
+
+    InstructionNativeFunctionOperrand(string id, int argsNum, function<shared_ptr<InstructionOperrand>(FVM*, vector<shared_ptr<InstructionOperrand>>)> operrand) { this->id = id; this->argsNum = argsNum; this->operrand = operrand; };
 
     string tostring() override {
-        return "IF";
+        return "native " + id;
     }
 };
 
 struct InstructionArrayOperrand : InstructionOperrand {
-    shared_ptr<vector<shared_ptr<InstructionOperrand>>> operrand;
+    shared_ptr<OperrandVector> operrand;
+
+    // set only with --heap-profile
+    const AllocationSite* site = nullptr;
 
-    InstructionArrayOperrand(shared_ptr<vector<shared_ptr<InstructionOperrand>>> operrand) { this->operrand = operrand; };
+    InstructionArrayOperrand(shared_ptr<OperrandVector> operrand) { this->operrand = operrand; };
     
     string tostring() override {
         string str = "array: ";
@@ -190,12 +523,24 @@ struct InstructionArrayOperrand : InstructionOperrand {
 
         return str;
     }
+
+    bool hasReferences() override { return true; };
+
+    void trace(GcTracer& tracer) override {
+        for (shared_ptr<InstructionOperrand>& op: *operrand) tracer.mark(op.get());
+    };
+
+    void clearReferences() override { operrand->clear(); };
+
+    size_t heapSize() override { return sizeof(*this) + sizeof(*operrand) + operrand->capacity() * sizeof(shared_ptr<InstructionOperrand>); };
 };
 
 struct InstructionObjectOperrand : InstructionOperrand {
-    shared_ptr<map<string, shared_ptr<InstructionOperrand>>> operrand;
+    shared_ptr<OperrandMap> operrand;
+
+    const AllocationSite* site = nullptr;
 
-    InstructionObjectOperrand(shared_ptr<map<string, shared_ptr<InstructionOperrand>>> fields) { this->operrand = fields; };
+    InstructionObjectOperrand(shared_ptr<OperrandMap> fields) { this->operrand = fields; };
 
     string tostring() override {
         string str = "object: \n";
@@ -206,36 +551,180 @@ struct InstructionObjectOperrand : InstructionOperrand {
  
         return str;
     }
+
+    bool hasReferences() override { return true; };
+
+    void trace(GcTracer& tracer) override {
+        for (auto& op: *operrand) tracer.mark(op.second.get());
+    };
+
+    void clearReferences() override { operrand->clear(); };
+
+    size_t heapSize() override {
+        size_t size = sizeof(*this) + sizeof(*operrand);
+
+        // red-black tree node: three links and color, then key and value
+        for (auto& op: *operrand) size += 4 * sizeof(void*) + sizeof(string) + op.first.capacity() + sizeof(shared_ptr<InstructionOperrand>);
+
+        return size;
+    };
+};
+
+struct InstructionShapeOperrand : InstructionOperrand {
+    vector<string> operrand;
+
+    InstructionShapeOperrand(vector<string> keys) { this->operrand = keys; };
+
+    string tostring() override {
+        string str = "shape: ";
+
+        for (string key: operrand) {
+            str += key + " ";
+        }
+
+        return str;
+    }
+};
+
+struct InstructionConstantOperrand : InstructionOperrand {
+    shared_ptr<InstructionOperrand> operrand;
+    int index;
+
+    // no nested arrays/objects, clone is one copy of elements
+    bool isFlat;
+
+    InstructionConstantOperrand(shared_ptr<InstructionOperrand> operrand, int index, bool isFlat) { this->operrand = operrand; this->index = index; this->isFlat = isFlat; };
+
+    string tostring() override {
+        return "const #" + to_string(index);
+    }
 };
 
 struct ScopeMember {
     shared_ptr<InstructionOperrand> value;
     bool isLocal;
 
+    // set when member is captured by closure as mutable, value lives in cell then
+    shared_ptr<UpvalueCell> cell;
+
     ScopeMember(shared_ptr<InstructionOperrand> value, bool isLocal = false) { this->value = value; this->isLocal = isLocal; };
     ScopeMember() = default;
+
+    shared_ptr<InstructionOperrand> get() { return cell ? cell->value : value; };
 };
 
 struct Scope {
-    map<string, ScopeMember> members;
+    ScopeMembers members;
+};
+
+struct Frame {
+    Scope* scope;
+    InstructionFunctionOperrand* closure;
+};
+
+// what run() does around block: members of parent are copied into scope, allocations are charged to VM,
+// scope and closure are roots for collector; used by ahead-of-time compiled code (--emit-cpp) too
+struct BlockGuard {
+    HeapAccount* previousAccount;
+    size_t* previousAllocations;
+    vector<Frame>& frames;
+
+    BlockGuard(FVM* vm, shared_ptr<Scope>& scope, shared_ptr<Scope>& parent, shared_ptr<InstructionFunctionOperrand>& closure);
+    ~BlockGuard();
 };
 
+// name of opcode for logs and statistics
+string opcodeToString(Bytecode opcode);
+
+// F_ADD_NUM -> F_ADD and so on, other opcodes are returned as is
+Bytecode genericOpcode(Bytecode opcode);
+
+// scope members which exist in parent are written back when block ends or returns
+void mergeScope(shared_ptr<Scope> scope, shared_ptr<Scope> parent);
+
+class HeapProfiler;
+class Jit;
+class FiberScheduler;
+struct Fiber;
+struct Generator;
+
 class FVM {
     public:
-        stack<shared_ptr<InstructionOperrand>> vmStack;
+        vector<shared_ptr<InstructionOperrand>> vmStack;
+
+        // active run() calls, roots for collector
+        vector<Frame> frames;
+
+        GarbageCollector gc;
+
+        // top level scope of program, builtins are defined here
+        shared_ptr<Scope> globals;
   
-        bool run(vector<Instruction> bytecode, shared_ptr<Scope> scope = make_shared<Scope>(), shared_ptr<Scope> parent = make_shared<Scope>());
-        FVM(bool logs);
+        bool run(vector<Instruction>& bytecode, CodeTables& tables, shared_ptr<Scope> scope = make_shared<Scope>(), shared_ptr<Scope> parent = make_shared<Scope>(), shared_ptr<InstructionFunctionOperrand> closure = nullptr);
+
+        // one instruction of block set up by BlockGuard, true - function returned; arithmetic and comparisons are quickened in place
+        bool execute(Instruction& code, CodeTables& tables, shared_ptr<Scope>& scope, shared_ptr<Scope>& parent, shared_ptr<InstructionFunctionOperrand>& closure);
+
+        FVM(bool logs, bool allocStats = false);
+        ~FVM();
 
         void push(shared_ptr<InstructionOperrand> operrand);
 
         shared_ptr<InstructionOperrand> pop();
 
-        string getBytecodeString(vector<Instruction> bytecode);
+        // runs function by interpreter, result (if returned) is pushed; generator function pushes generator
+        void callFunction(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args);
+        // call from native code (fibers, parallel_map), JIT is tried first; null if function did not return value
+        shared_ptr<InstructionOperrand> call(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args);
+
+        // body of function, generators run it when they are resumed
+        void runFunction(shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args);
+
+        // FOR_IN: body runs for every element of array or generator on top of stack, element is pushed before it;
+        // true - body returned
+        bool forIn(function<bool()> body);
+
+        string getBytecodeString(vector<Instruction>& bytecode, CodeTables& tables);
 
         void printStack();
+        void printAllocStats();
+
+        HeapAccount* heap;
+
+        // --heap-profile: containers remember their allocation site, allocations are counted per site
+        shared_ptr<HeapProfiler> profiler;
+
+        // --jit: hot numeric functions are compiled to machine code
+        shared_ptr<Jit> jit;
+
+        // live bytes of values, containers and scopes created by this VM
+        size_t memoryUsage();
+        size_t peakMemoryUsage();
+        void printMemoryStats();
 
         bool logs;
+
+        // OUTPUT and statistics, --jobs gives every script its own buffer
+        ostream* out = &cout;
+
+        // spawn(): scheduler is created by first fiber and shared with VMs of all fibers, they share out under outputLock
+        shared_ptr<FiberScheduler> fibers;
+        shared_ptr<mutex> outputLock;
+        // --fiber-threads, 0 - one per core
+        size_t fiberThreads = 0;
+        // --parallel-threshold, smaller arrays are not split between fibers
+        size_t parallelThreshold = 1000;
+        // fiber which runs on this VM, null for program
+        Fiber* fiber = nullptr;
+
+        // generator whose body runs now, and all generators of VM (suspended ones are unwound by destructor)
+        Generator* generator = nullptr;
+        set<Generator*> generators;
+
+        // executed instructions and allocations made by them, per opcode
+        bool allocStats;
+        vector<size_t> executedByOpcode;
+        vector<size_t> allocationsByOpcode;
 };
 
 #endif
\ No newline at end of file
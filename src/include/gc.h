@@ -0,0 +1,53 @@
+#ifndef GC_H
+#define GC_H
+
+#include <vector>
+#include <memory>
+#include <ostream>
+
+using namespace std;
+
+class FVM;
+struct InstructionOperrand;
+
+struct GcStats {
+    size_t minorCollections = 0;
+    size_t majorCollections = 0;
+
+    double totalPause = 0;
+    double maxPause = 0;
+
+    size_t objectsReclaimed = 0;
+    size_t bytesReclaimed = 0;
+};
+
+// Reference counting frees acyclic garbage, collector finds cycles: tracked operrands which are alive
+// but not reachable from roots (stack, frames, globals) get their references cleared
+class GarbageCollector {
+    private:
+        unsigned epoch = 0;
+
+        size_t oldAfterMajor = 0;
+
+        void sweep(vector<weak_ptr<InstructionOperrand>>& generation, vector<weak_ptr<InstructionOperrand>>* promoteTo, vector<shared_ptr<InstructionOperrand>>& garbage);
+    public:
+        vector<weak_ptr<InstructionOperrand>> nursery;
+        vector<weak_ptr<InstructionOperrand>> old;
+
+        // --gc-nursery: tracked allocations between minor collections
+        size_t nurserySize = 10000;
+
+        bool pending = false;
+
+        GcStats stats;
+
+        void track(shared_ptr<InstructionOperrand> operrand);
+        void collect(FVM* vm, bool major = false, bool withRoots = true);
+
+        // minor or major collection, whichever is due
+        void collectPending(FVM* vm);
+
+        void printStats(ostream& out);
+};
+
+#endif
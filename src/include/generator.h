@@ -0,0 +1,80 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <vector>
+#include <memory>
+#include <exception>
+#include <functional>
+
+#include "fvm.h"
+#include "fiber.h"
+
+using namespace std;
+
+// body of generator made by VM itself (range), gives next value or null when finished
+typedef function<shared_ptr<InstructionOperrand>()> NativeGenerator;
+
+// Call of function with yield. Body runs on its own stack (coroutine like fiber, but on the same VM and thread):
+// resume() runs it until next yield or until it returns, so values are produced one by one when they are asked for
+struct Generator {
+    // null after VM is destroyed
+    FVM* vm;
+    shared_ptr<InstructionFunctionOperrand> function;
+    // until body is started
+    vector<shared_ptr<InstructionOperrand>> args;
+
+    NativeGenerator native;
+
+    shared_ptr<FiberContext> context;
+
+    // operand stack and frames of body while it is suspended, they are moved to VM when it is resumed
+    vector<shared_ptr<InstructionOperrand>> stack;
+    vector<Frame> frames;
+    // where stack of body starts in stack of VM while it runs
+    size_t stackBase = 0;
+
+    // last yielded value
+    shared_ptr<InstructionOperrand> value;
+
+    bool running = false;
+    bool done = false;
+    // suspended body is unwound when generator is not needed anymore
+    bool cancelled = false;
+    exception_ptr error;
+
+    Generator(FVM* vm, shared_ptr<InstructionFunctionOperrand> function, vector<shared_ptr<InstructionOperrand>>& args);
+    Generator(FVM* vm, NativeGenerator native);
+    ~Generator();
+
+    // false when body returned, value is next element otherwise; error of body is thrown here
+    bool resume();
+    // called by YIELD inside body
+    void yield(shared_ptr<InstructionOperrand> value);
+    void cancel();
+
+    void body();
+};
+
+struct InstructionGeneratorOperrand : InstructionOperrand {
+    shared_ptr<Generator> operrand;
+
+    InstructionGeneratorOperrand(shared_ptr<Generator> operrand) { this->operrand = operrand; };
+
+    string tostring() override { return "generator"; };
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override { return toEq.get() == this; };
+
+    bool hasReferences() override { return true; };
+    void trace(GcTracer& tracer) override;
+    void clearReferences() override;
+};
+
+shared_ptr<InstructionOperrand> makeGenerator(FVM* vm, shared_ptr<InstructionFunctionOperrand> function, vector<shared_ptr<InstructionOperrand>>& args);
+
+// range(from, to): numbers from `from` up to `to` (not included), one by one
+shared_ptr<InstructionOperrand> makeRange(FVM* vm, shared_ptr<InstructionOperrand> from, shared_ptr<InstructionOperrand> to);
+
+// next(generator): next value, null when generator is finished
+shared_ptr<InstructionOperrand> nextValue(shared_ptr<InstructionOperrand> generator);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <memory>
+#include <map>
+
+#include "fvm.h"
+
+using namespace std;
+
+// types of values inside machine code, numbers and booleans are kept as doubles (false - 0.0, true - 1.0)
+enum JitType {
+    JIT_NUMBER,
+    JIT_BOOL,
+
+    // closure which is being called, only usable by CALL (recursion)
+    JIT_SELF,
+};
+
+// machine code of FuncDeclaration, specialized for argument and upvalue types seen when it was compiled
+struct JitFunction {
+    void* code = nullptr;
+    size_t size = 0;
+
+    vector<JitType> argsTypes;
+    JitType returnType = JIT_NUMBER;
+
+    // upvalue index -> type it must have for machine code to run
+    map<int, JitType> upvalueTypes;
+
+    ~JitFunction();
+};
+
+struct JitStats {
+    size_t compiled = 0;
+    size_t rejected = 0;
+
+    size_t nativeCalls = 0;
+    size_t guardFailures = 0;
+    size_t verifiedCalls = 0;
+};
+
+// Baseline template JIT: every opcode of hot function is translated to fixed x86-64 sequence over
+// frame slots, functions with unsupported opcodes or operrand types stay in interpreter
+class Jit {
+    private:
+        // interpreter half of --jit-verify is running, calls are not sent to machine code
+        bool verifying = false;
+
+        shared_ptr<JitFunction> compile(InstructionFunctionOperrand* closure, vector<shared_ptr<InstructionOperrand>>& args);
+    public:
+        // --jit-threshold: interpreted calls of function before it is compiled
+        size_t threshold = 100;
+
+        // --jit-verify: every call from interpreter to machine code is run by interpreter too, results must match
+        bool verify = false;
+
+        JitStats stats;
+
+        // true - function was run by machine code and result is pushed
+        bool tryCall(FVM* vm, shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args);
+
+        void printStats(ostream& out);
+};
+
+// machine code is x86-64 System V (Linux, macOS), elsewhere --jit keeps interpreter
+bool jitSupported();
+
+#endif
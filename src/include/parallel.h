@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <memory>
+
+#include "fvm.h"
+
+using namespace std;
+
+// parallel_map(array, function): array of function(element) in order of elements. Parts of array run on fibers
+// (own VMs on pool of threads), arrays smaller than --parallel-threshold run on calling VM
+shared_ptr<InstructionOperrand> parallelMap(FVM* vm, shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> function);
+
+// parallel_reduce(array, function, init): first part is folded from init by function(result, element), other parts
+// from their first element, then results of parts are folded in order, so function must be associative
+shared_ptr<InstructionOperrand> parallelReduce(FVM* vm, shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> function, shared_ptr<InstructionOperrand> init);
+
+#endif
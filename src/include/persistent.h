@@ -0,0 +1,144 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+
+#include "fvm.h"
+
+using namespace std;
+
+// radix balanced 32-way trie with tail, every update copies only path to changed leaf
+struct PersistentVectorNode {
+    vector<shared_ptr<PersistentVectorNode>, PoolAllocator<shared_ptr<PersistentVectorNode>>> children;
+    OperrandVector values;
+};
+
+class PersistentVector {
+    private:
+        shared_ptr<PersistentVectorNode> root;
+        shared_ptr<PersistentVectorNode> tail;
+        size_t count;
+        int shift;
+
+        size_t tailOffset() const;
+        const OperrandVector& leafFor(size_t index) const;
+
+        shared_ptr<PersistentVectorNode> pushTail(int level, shared_ptr<PersistentVectorNode> parent, shared_ptr<PersistentVectorNode> tailNode) const;
+        shared_ptr<PersistentVectorNode> assocNode(int level, shared_ptr<PersistentVectorNode> node, size_t index, shared_ptr<InstructionOperrand> value) const;
+    public:
+        PersistentVector();
+        PersistentVector(const vector<shared_ptr<InstructionOperrand>>& values);
+
+        size_t size() const { return count; };
+
+        shared_ptr<InstructionOperrand> get(size_t index) const;
+
+        PersistentVector set(size_t index, shared_ptr<InstructionOperrand> value) const;
+        PersistentVector push(shared_ptr<InstructionOperrand> value) const;
+
+        void forEach(function<void(shared_ptr<InstructionOperrand>)> callback) const;
+};
+
+// hash array mapped trie, 5 bits of key hash per level
+struct PersistentMapNode;
+
+struct PersistentMapEntry {
+    string key;
+    size_t hash;
+    shared_ptr<InstructionOperrand> value;
+
+    shared_ptr<PersistentMapNode> child;
+};
+
+struct PersistentMapNode {
+    uint32_t bitmap = 0;
+    vector<PersistentMapEntry, PoolAllocator<PersistentMapEntry>> entries;
+
+    // all hash bits are used, entries with same hash stored in list
+    bool isCollision = false;
+};
+
+class PersistentMap {
+    private:
+        shared_ptr<PersistentMapNode> root;
+        size_t count;
+    public:
+        PersistentMap();
+
+        size_t size() const { return count; };
+
+        shared_ptr<InstructionOperrand> get(string key) const;
+
+        PersistentMap set(string key, shared_ptr<InstructionOperrand> value) const;
+
+        void forEach(function<void(string, shared_ptr<InstructionOperrand>)> callback) const;
+};
+
+struct InstructionFrozenArrayOperrand : InstructionOperrand {
+    PersistentVector operrand;
+
+    // holds functions (directly or nested), only then collector has to look inside
+    bool containsReferences;
+
+    InstructionFrozenArrayOperrand(PersistentVector operrand, bool containsReferences) { this->operrand = operrand; this->containsReferences = containsReferences; };
+
+    bool hasReferences() override { return containsReferences; };
+
+    void trace(GcTracer& tracer) override {
+        operrand.forEach([&tracer](shared_ptr<InstructionOperrand> op) { tracer.mark(op.get()); });
+    };
+
+    // trie nodes may be shared with other versions, counted as if owned
+    size_t heapSize() override { return sizeof(*this) + operrand.size() * sizeof(shared_ptr<InstructionOperrand>); };
+
+    string tostring() override {
+        string str = "frozen array: ";
+
+        operrand.forEach([&str](shared_ptr<InstructionOperrand> op) {
+            str += op->tostring() + " ";
+        });
+
+        return str;
+    }
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override {
+        return toEq.get() == this;
+    };
+};
+
+struct InstructionFrozenObjectOperrand : InstructionOperrand {
+    PersistentMap operrand;
+
+    bool containsReferences;
+
+    InstructionFrozenObjectOperrand(PersistentMap operrand, bool containsReferences) { this->operrand = operrand; this->containsReferences = containsReferences; };
+
+    bool hasReferences() override { return containsReferences; };
+
+    void trace(GcTracer& tracer) override {
+        operrand.forEach([&tracer](string key, shared_ptr<InstructionOperrand> op) { tracer.mark(op.get()); });
+    };
+
+    size_t heapSize() override { return sizeof(*this) + operrand.size() * sizeof(PersistentMapEntry); };
+
+    string tostring() override {
+        string str = "frozen object: \n";
+
+        operrand.forEach([&str](string key, shared_ptr<InstructionOperrand> op) {
+            str += key + ": " + op->tostring() + " \n";
+        });
+
+        return str;
+    }
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override {
+        return toEq.get() == this;
+    };
+};
+
+shared_ptr<InstructionOperrand> freeze(shared_ptr<InstructionOperrand> value);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include "fvm.h"
+
+using namespace std;
+
+struct SiteAllocations {
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+    // SETINDEX which appended elements or added fields
+    size_t growths = 0;
+    size_t growthBytes = 0;
+};
+
+// live values of one type created at one site
+struct HeapGroup {
+    string type;
+    string site;
+
+    size_t count = 0;
+    size_t shallowBytes = 0;
+
+    // bytes freed if every value of group was gone, nested values of same group are counted once
+    size_t retainedBytes = 0;
+
+    // value of group with biggest retained size
+    string preview;
+};
+
+struct HeapSnapshot {
+    size_t objects = 0;
+    size_t bytes = 0;
+
+    // biggest retained size first
+    vector<HeapGroup> groups;
+};
+
+class HeapProfiler {
+    public:
+        // whole run, freed values included
+        map<const AllocationSite*, SiteAllocations> sites;
+
+        void recordAllocation(const AllocationSite* site, size_t bytes);
+        void recordGrowth(const AllocationSite* site, size_t bytes);
+
+        // values reachable from stack, frames and globals with retained sizes from dominator tree
+        HeapSnapshot takeSnapshot(FVM* vm);
+
+        void writeText(ostream& out, HeapSnapshot& snapshot);
+        void writeJson(ostream& out, HeapSnapshot& snapshot);
+};
+
+#endif
@@ -1,11 +1,92 @@
 #ifndef RUNNER_H
 #define RUNNER_H
 
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+
 using namespace std;
 
+struct RunnerOptions {
+    // --alloc-stats: print allocations made by each opcode after run
+    bool allocStats = false;
+
+    // --gc-stats: print collector pauses, reclaimed bytes and heap size after run
+    bool gcStats = false;
+    // --gc-nursery=N: tracked allocations between minor collections
+    size_t gcNursery = 10000;
+
+    // --max-heap=N[K|M|G]: runtime error when live bytes of VM go over limit, 0 - no limit
+    size_t maxHeap = 0;
+    // --memory-stats: print live and peak bytes after run
+    bool memoryStats = false;
+
+    // --heap-profile[=FILE]: after run write live values grouped by type and allocation site, JSON if FILE ends with .json
+    bool heapProfile = false;
+    string heapProfilePath;
+
+    // --jit: compile hot numeric functions to machine code
+    bool jit = false;
+    // --jit-threshold=N: interpreted calls of function before it is compiled
+    size_t jitThreshold = 100;
+    // --jit-verify: run every compiled call by interpreter too, stop on different result, print JIT statistics
+    bool jitVerify = false;
+
+    // --emit-cpp FILE: write program as C++ source (built with runtime of femic) instead of running it
+    string emitCpp;
+
+    // --module-cache=DIR: keep compiled modules of `using` in DIR, found again by path and content
+    string moduleCache;
+    // --compile-threads=N: threads compiling modules of `using`, 0 - one per core
+    size_t compileThreads = 0;
+    // --eager-compile: generate bodies of functions with program, not on their first call
+    bool eagerCompile = false;
+
+    // --no-tree-shake: keep definitions of modules which program never reads
+    bool treeShake = true;
+    // --tree-shake-report: print definitions removed from modules
+    bool treeShakeReport = false;
+
+    // --compile: write compiled program (.fmc) instead of running it, -o FILE sets its path
+    bool compile = false;
+    string output;
+
+    // --fiber-threads=N: threads running fibers of spawn(), 0 - one per core
+    size_t fiberThreads = 0;
+
+    // --parallel-threshold=N: parallel_map/parallel_reduce of smaller arrays run on calling VM
+    size_t parallelThreshold = 1000;
+
+    // --jobs N: scripts run at the same time, each in its own VM, output is printed per script in order, 0 - one per core
+    size_t jobs = 1;
+};
+
+struct ModuleRegistry;
+
 class Runner {
     public:
-        void run(string path);
+        RunnerOptions options;
+
+        // output of program and its errors
+        ostream* out = &cout;
+        ostream* err = &cerr;
+
+        // modules shared with other runners of --jobs
+        shared_ptr<ModuleRegistry> registry;
+
+        Runner(RunnerOptions options);
+        Runner() = default;
+
+        // false if program failed with error
+        bool run(string path);
+
+        // false if program failed to compile
+        bool emitCpp(string path);
+        bool compile(string path);
 };
 
-#endif
\ No newline at end of file
+// runs scripts one by one, or --jobs of them at the same time; 1 if any of them failed
+int runScripts(RunnerOptions options, vector<string> paths);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+enum CompareOp {
+    COMPARE_LT,
+    COMPARE_LE,
+    COMPARE_GT,
+    COMPARE_GE,
+    COMPARE_EQ,
+    COMPARE_NE,
+};
+
+// Loops over contiguous numbers of typed arrays. Set is chosen once by CPU the program runs on: AVX2, SSE2 (every
+// x86-64) or plain C++. Sums and dot products add in four lanes in every set, so results do not depend on CPU.
+// min/max expect at least one element, compare writes 1 where comparison is true and 0 elsewhere
+struct SimdKernels {
+    const char* name;
+
+    double (*sumF64)(const double* values, size_t count);
+    int64_t (*sumI64)(const int64_t* values, size_t count);
+
+    double (*minF64)(const double* values, size_t count);
+    double (*maxF64)(const double* values, size_t count);
+    int64_t (*minI64)(const int64_t* values, size_t count);
+    int64_t (*maxI64)(const int64_t* values, size_t count);
+
+    double (*dotF64)(const double* left, const double* right, size_t count);
+
+    void (*scaleF64)(const double* values, double factor, double* out, size_t count);
+    void (*addF64)(const double* left, const double* right, double* out, size_t count);
+    void (*addI64)(const int64_t* left, const int64_t* right, int64_t* out, size_t count);
+
+    void (*compareF64)(const double* values, CompareOp op, double value, double* out, size_t count);
+    void (*compareI64)(const int64_t* values, CompareOp op, int64_t value, int64_t* out, size_t count);
+};
+
+const SimdKernels& simdKernels();
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef TYPED_ARRAY_H
+#define TYPED_ARRAY_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "fvm.h"
+
+using namespace std;
+
+typedef vector<double, PoolAllocator<double>> Float64Vector;
+typedef vector<int64_t, PoolAllocator<int64_t>> Int64Vector;
+
+// Numbers stored one after another instead of as boxed elements, so builtins below run over them with SIMD kernels.
+// Length is fixed when array is created, elements are boxed only when they are read
+struct InstructionTypedArrayOperrand : InstructionOperrand {
+    // set by freeze(), frozen array is shared with other fibers instead of copied
+    bool frozen = false;
+
+    virtual size_t size() = 0;
+    virtual shared_ptr<InstructionOperrand> get(size_t index) = 0;
+    virtual void set(size_t index, shared_ptr<InstructionOperrand> value) = 0;
+    virtual shared_ptr<InstructionTypedArrayOperrand> copy(bool frozen) = 0;
+
+    bool isEq(shared_ptr<InstructionOperrand> toEq) override { return toEq.get() == this; };
+};
+
+struct InstructionFloat64ArrayOperrand : InstructionTypedArrayOperrand {
+    Float64Vector operrand;
+
+    InstructionFloat64ArrayOperrand(size_t size) : operrand(size) {};
+
+    size_t heapSize() override { return sizeof(*this) + operrand.capacity() * sizeof(double); };
+
+    string tostring() override;
+
+    size_t size() override { return operrand.size(); };
+    shared_ptr<InstructionOperrand> get(size_t index) override;
+    void set(size_t index, shared_ptr<InstructionOperrand> value) override;
+    shared_ptr<InstructionTypedArrayOperrand> copy(bool frozen) override;
+};
+
+struct InstructionInt64ArrayOperrand : InstructionTypedArrayOperrand {
+    Int64Vector operrand;
+
+    InstructionInt64ArrayOperrand(size_t size) : operrand(size) {};
+
+    size_t heapSize() override { return sizeof(*this) + operrand.capacity() * sizeof(int64_t); };
+
+    string tostring() override;
+
+    size_t size() override { return operrand.size(); };
+    // numbers are doubles, so elements above 2^53 are read rounded
+    shared_ptr<InstructionOperrand> get(size_t index) override;
+    void set(size_t index, shared_ptr<InstructionOperrand> value) override;
+    shared_ptr<InstructionTypedArrayOperrand> copy(bool frozen) override;
+};
+
+// Float64Array(x), Int64Array(x): zeroed array of size x or copy of numbers of array or typed array x
+shared_ptr<InstructionOperrand> makeFloat64Array(shared_ptr<InstructionOperrand> from);
+shared_ptr<InstructionOperrand> makeInt64Array(shared_ptr<InstructionOperrand> from);
+
+// sum(a), min(a), max(a): number, min and max of empty array are null
+shared_ptr<InstructionOperrand> typedSum(shared_ptr<InstructionOperrand> array);
+shared_ptr<InstructionOperrand> typedMin(shared_ptr<InstructionOperrand> array);
+shared_ptr<InstructionOperrand> typedMax(shared_ptr<InstructionOperrand> array);
+
+// dot(a, b), add(a, b): arrays of the same type and length; add makes new array
+shared_ptr<InstructionOperrand> typedDot(shared_ptr<InstructionOperrand> left, shared_ptr<InstructionOperrand> right);
+shared_ptr<InstructionOperrand> typedAdd(shared_ptr<InstructionOperrand> left, shared_ptr<InstructionOperrand> right);
+
+// scale(a, k): new array of elements multiplied by k, Int64Array scaled by fraction becomes Float64Array
+shared_ptr<InstructionOperrand> typedScale(shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> factor);
+
+// compare(a, op, value): mask of the same type, 1 where `element op value` is true and 0 elsewhere;
+// op is one of "<", "<=", ">", ">=", "==", "!="
+shared_ptr<InstructionOperrand> typedCompare(shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> op, shared_ptr<InstructionOperrand> value);
+
+#endif
@@ -0,0 +1,642 @@
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+
+#include "include/jit.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define FEMIRA_JIT 1
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// args (pointer to first argument, next ones at +8) and upvalues (by index)
+typedef double (*JitEntry)(const double* args, const double* upvalues);
+
+bool jitSupported() {
+#ifdef FEMIRA_JIT
+    return true;
+#else
+    return false;
+#endif
+}
+
+JitFunction::~JitFunction() {
+#ifdef FEMIRA_JIT
+    if (code) munmap(code, size);
+#endif
+}
+
+// Frame of compiled function:
+//   [rbp - 8]             saved r12 (upvalues pointer)
+//   [rbp - 16 - 8 * i]    slot i: locals first (arguments are locals 0..n-1), then operrand stack
+// stack grows to lower addresses, so arguments of CALL (first argument on top) lie in memory in order
+class JitAssembler {
+    public:
+        vector<uint8_t> code;
+
+        void bytes(initializer_list<uint8_t> values) { code.insert(code.end(), values); };
+
+        void int32(int32_t value) {
+            uint8_t raw[4];
+            memcpy(raw, &value, 4);
+            code.insert(code.end(), raw, raw + 4);
+        };
+
+        void int64(int64_t value) {
+            uint8_t raw[8];
+            memcpy(raw, &value, 8);
+            code.insert(code.end(), raw, raw + 8);
+        };
+
+        void patch32(size_t position, int32_t value) { memcpy(&code[position], &value, 4); };
+
+        // movsd xmm(reg), [rbp + offset]
+        void load(int reg, int32_t offset) { bytes({ 0xF2, 0x0F, 0x10, uint8_t(0x85 | reg << 3) }); int32(offset); };
+
+        // movsd [rbp + offset], xmm0
+        void store(int32_t offset) { bytes({ 0xF2, 0x0F, 0x11, 0x85 }); int32(offset); };
+
+        // movsd xmm0, [r12 + 8 * index]
+        void loadUpvalue(int index) { bytes({ 0xF2, 0x41, 0x0F, 0x10, 0x84, 0x24 }); int32(index * 8); };
+
+        // mov rax, bits of value; mov [rbp + offset], rax
+        void storeConstant(double value, int32_t offset) {
+            int64_t bits;
+            memcpy(&bits, &value, 8);
+
+            bytes({ 0x48, 0xB8 }); int64(bits);
+            bytes({ 0x48, 0x89, 0x85 }); int32(offset);
+        };
+
+        // addsd / subsd / mulsd / divsd xmm0, [rbp + offset]
+        void arithmetic(uint8_t opcode, int32_t offset) { bytes({ 0xF2, 0x0F, opcode, 0x85 }); int32(offset); };
+
+        // ucomisd xmm0, [rbp + offset]
+        void compare(int32_t offset) { bytes({ 0x66, 0x0F, 0x2E, 0x85 }); int32(offset); };
+
+        // setcc al (and second flag into cl, combined by and/or), xmm0 = al ? 1.0 : 0.0
+        void flagToDouble(uint8_t setcc, uint8_t secondSetcc = 0, uint8_t combine = 0) {
+            bytes({ 0x0F, setcc, 0xC0 });
+
+            if (secondSetcc) {
+                bytes({ 0x0F, secondSetcc, 0xC1 });
+                bytes({ combine, 0xC8 });
+            }
+
+            bytes({ 0x0F, 0xB6, 0xC0 });
+            bytes({ 0xF2, 0x0F, 0x2A, 0xC0 });
+        };
+
+        // andpd / orpd xmm0, xmm1: 1.0 and 0.0 differ only by set bits of 1.0
+        void bitwise(uint8_t opcode) { bytes({ 0x66, 0x0F, opcode, 0xC1 }); };
+
+        // xorpd xmm1, xmm1; ucomisd xmm0, xmm1; je rel32 - returns position of rel32
+        size_t jumpIfFalse() {
+            bytes({ 0x66, 0x0F, 0x57, 0xC9 });
+            bytes({ 0x66, 0x0F, 0x2E, 0xC1 });
+            bytes({ 0x0F, 0x84 }); int32(0);
+
+            return code.size() - 4;
+        };
+
+        size_t jump() {
+            bytes({ 0xE9 }); int32(0);
+
+            return code.size() - 4;
+        };
+
+        void bind(size_t position) { patch32(position, code.size() - (position + 4)); };
+
+        // lea rdi, [rbp + offset]; mov rsi, r12; call start of function
+        void callSelf(int32_t argsOffset) {
+            bytes({ 0x48, 0x8D, 0xBD }); int32(argsOffset);
+            bytes({ 0x4C, 0x89, 0xE6 });
+            bytes({ 0xE8 }); int32(-(int32_t)(code.size() + 4));
+        };
+
+        // push rbp; mov rbp, rsp; push r12; sub rsp, frame; mov r12, rsi - returns position of frame size
+        size_t prologue() {
+            bytes({ 0x55, 0x48, 0x89, 0xE5, 0x41, 0x54 });
+            bytes({ 0x48, 0x81, 0xEC }); int32(0);
+
+            size_t frame = code.size() - 4;
+
+            bytes({ 0x49, 0x89, 0xF4 });
+
+            return frame;
+        };
+
+        // movsd xmm0, [rdi + 8 * index]
+        void loadArgument(int index) { bytes({ 0xF2, 0x0F, 0x10, 0x87 }); int32(index * 8); };
+
+        // mov r12, [rbp - 8]; leave; ret
+        void epilogue() { bytes({ 0x4C, 0x8B, 0x65, 0xF8, 0xC9, 0xC3 }); };
+};
+
+struct JitLocal {
+    int slot;
+    JitType type;
+};
+
+struct JitState {
+    vector<JitType> stack;
+
+    // visible names, block scopes see names of parent, new names of block disappear after it like in interpreter
+    map<string, JitLocal> locals;
+};
+
+class JitCompilation {
+    private:
+        JitAssembler assembler;
+
+        InstructionFunctionOperrand* closure;
+        shared_ptr<JitFunction> function;
+
+        // operrands of compiled function
+        CodeTables* tables;
+
+        int maxLocals = 0;
+        int nextLocal = 0;
+        size_t maxDepth = 0;
+
+        bool hasReturnType = false;
+
+        // recursive call was compiled before any return, its result was taken as number
+        bool assumedNumberReturn = false;
+
+        int32_t localOffset(int slot) { return -16 - 8 * slot; };
+        int32_t stackOffset(size_t depth) { return -16 - 8 * (maxLocals + (int)depth); };
+
+        bool compileBlock(vector<Instruction>& bytecode, JitState& state, bool& returned);
+    public:
+        JitCompilation(InstructionFunctionOperrand* closure) { this->closure = closure; this->tables = closure->operrand->tables.get(); };
+
+        shared_ptr<JitFunction> compile(vector<shared_ptr<InstructionOperrand>>& args);
+};
+
+bool readValue(InstructionOperrand* operrand, JitType& type, double& value) {
+    if (auto number = dynamic_cast<InstructionNumberOperrand*>(operrand)) {
+        type = JIT_NUMBER;
+        value = number->operrand;
+
+        return true;
+    } else if (auto boolean = dynamic_cast<InstructionBoolOperrand*>(operrand)) {
+        type = JIT_BOOL;
+        value = boolean->operrand ? 1 : 0;
+
+        return true;
+    }
+
+    return false;
+}
+
+size_t countAssignments(vector<Instruction>& bytecode, CodeTables& tables) {
+    size_t count = 0;
+
+    for (Instruction& code: bytecode) {
+        if (code.code() == F_SETENV) count++;
+        else if (code.code() == F_IF && code.argument() < tables.branches.size()) {
+            IfStatement& statement = tables.branches[code.argument()];
+
+            count += countAssignments(statement.bytecode, tables) + countAssignments(statement.elseBytecode, tables);
+        }
+    }
+
+    return count;
+}
+
+bool JitCompilation::compileBlock(vector<Instruction>& bytecode, JitState& state, bool& returned) {
+    returned = false;
+
+    for (Instruction& code: bytecode) {
+        vector<JitType>& stack = state.stack;
+        size_t depth = stack.size();
+
+        // quickened arithmetic and comparisons compile as their generic form
+        Bytecode opcode = genericOpcode(code.code());
+        uint32_t argument = code.argument();
+
+        switch (opcode) {
+            case F_PUSH:
+                {
+                    if (argument >= tables->constants.size()) return false;
+
+                    JitType type;
+                    double value;
+
+                    if (!readValue(tables->constants[argument].get(), type, value)) return false;
+
+                    assembler.storeConstant(value, stackOffset(depth));
+                    stack.push_back(type);
+                }
+                break;
+            case F_GETENV:
+            case F_SETENV:
+                {
+                    if (argument >= tables->names.size()) return false;
+
+                    const string& id = tables->names[argument];
+                    auto local = state.locals.find(id);
+
+                    if (opcode == F_GETENV) {
+                        // interpreter would fail with unknown address
+                        if (local == state.locals.end()) return false;
+
+                        assembler.load(0, localOffset(local->second.slot));
+                        assembler.store(stackOffset(depth));
+                        stack.push_back(local->second.type);
+                        break;
+                    }
+
+                    if (depth == 0 || stack.back() == JIT_SELF) return false;
+
+                    JitType type = stack.back();
+                    int slot;
+
+                    if (local != state.locals.end()) {
+                        // one slot keeps one type
+                        if (local->second.type != type) return false;
+
+                        slot = local->second.slot;
+                    } else {
+                        if (nextLocal >= maxLocals) return false;
+
+                        slot = nextLocal++;
+                        state.locals[id] = { slot, type };
+                    }
+
+                    assembler.load(0, stackOffset(depth - 1));
+                    assembler.store(localOffset(slot));
+                    stack.pop_back();
+                }
+                break;
+            case F_GETUPVAL:
+                {
+                    if (argument >= closure->upvalues.size()) return false;
+
+                    int upvalueIndex = argument;
+                    InstructionOperrand* value = closure->upvalues.at(upvalueIndex)->value.get();
+
+                    JitType type;
+                    double ignored;
+
+                    if (value == closure) type = JIT_SELF;
+                    else if (!readValue(value, type, ignored)) return false;
+
+                    function->upvalueTypes[upvalueIndex] = type;
+
+                    if (type != JIT_SELF) {
+                        assembler.loadUpvalue(upvalueIndex);
+                        assembler.store(stackOffset(depth));
+                    }
+
+                    stack.push_back(type);
+                }
+                break;
+            case F_ADD:
+            case F_SUB:
+            case F_MUL:
+            case F_DIV:
+                {
+                    if (depth < 2 || stack[depth - 1] != JIT_NUMBER || stack[depth - 2] != JIT_NUMBER) return false;
+
+                    uint8_t sseOpcode = opcode == F_ADD ? 0x58 : opcode == F_SUB ? 0x5C : opcode == F_MUL ? 0x59 : 0x5E;
+
+                    // second popped operrand is left one
+                    assembler.load(0, stackOffset(depth - 2));
+                    assembler.arithmetic(sseOpcode, stackOffset(depth - 1));
+                    assembler.store(stackOffset(depth - 2));
+
+                    stack.pop_back();
+                }
+                break;
+            case F_BIGGER:
+            case F_SMALLER:
+            case F_BIGGER_OR_EQ:
+            case F_SMALLER_OR_EQ:
+                {
+                    if (depth < 2 || stack[depth - 1] != JIT_NUMBER || stack[depth - 2] != JIT_NUMBER) return false;
+
+                    // left > right is right < left, unordered (NaN) sets CF, so seta/setae give false
+                    bool swapped = opcode == F_SMALLER || opcode == F_SMALLER_OR_EQ;
+                    bool orEqual = opcode == F_BIGGER_OR_EQ || opcode == F_SMALLER_OR_EQ;
+
+                    assembler.load(0, stackOffset(swapped ? depth - 1 : depth - 2));
+                    assembler.compare(stackOffset(swapped ? depth - 2 : depth - 1));
+                    assembler.flagToDouble(orEqual ? 0x93 : 0x97);
+                    assembler.store(stackOffset(depth - 2));
+
+                    stack.pop_back();
+                    stack.back() = JIT_BOOL;
+                }
+                break;
+            case F_EQ:
+            case F_NOTEQ:
+                {
+                    if (depth < 2 || stack[depth - 1] == JIT_SELF || stack[depth - 2] == JIT_SELF) return false;
+
+                    if (stack[depth - 1] != stack[depth - 2]) {
+                        // number never equals boolean
+                        assembler.storeConstant(opcode == F_NOTEQ ? 1 : 0, stackOffset(depth - 2));
+                    } else {
+                        assembler.load(0, stackOffset(depth - 2));
+                        assembler.compare(stackOffset(depth - 1));
+
+                        // equal is ZF without PF (unordered)
+                        if (opcode == F_EQ) assembler.flagToDouble(0x94, 0x9B, 0x20);
+                        else assembler.flagToDouble(0x95, 0x9A, 0x08);
+
+                        assembler.store(stackOffset(depth - 2));
+                    }
+
+                    stack.pop_back();
+                    stack.back() = JIT_BOOL;
+                }
+                break;
+            case F_AND:
+            case F_OR:
+                {
+                    if (depth < 2) return false;
+
+                    JitType right = stack[depth - 1];
+                    JitType left = stack[depth - 2];
+
+                    // OR gives left operrand when it is not false or null, number always is
+                    if (opcode == F_OR && left == JIT_NUMBER) {
+                        stack.pop_back();
+                        break;
+                    }
+
+                    if (left != JIT_BOOL || right != JIT_BOOL) return false;
+
+                    assembler.load(0, stackOffset(depth - 2));
+                    assembler.load(1, stackOffset(depth - 1));
+                    assembler.bitwise(opcode == F_AND ? 0x54 : 0x56);
+                    assembler.store(stackOffset(depth - 2));
+
+                    stack.pop_back();
+                }
+                break;
+            case F_IF:
+                {
+                    // interpreter skips both branches for non boolean condition
+                    if (argument >= tables->branches.size() || depth == 0 || stack.back() != JIT_BOOL) return false;
+
+                    IfStatement& statement = tables->branches[argument];
+
+                    assembler.load(0, stackOffset(depth - 1));
+                    stack.pop_back();
+
+                    size_t toElse = assembler.jumpIfFalse();
+
+                    JitState thenState = state;
+                    bool thenReturned;
+
+                    if (!compileBlock(statement.bytecode, thenState, thenReturned)) return false;
+
+                    size_t toEnd = assembler.jump();
+                    assembler.bind(toElse);
+
+                    JitState elseState = state;
+                    bool elseReturned;
+
+                    if (!compileBlock(statement.elseBytecode, elseState, elseReturned)) return false;
+
+                    assembler.bind(toEnd);
+
+                    if (thenReturned && elseReturned) {
+                        returned = true;
+                        return true;
+                    }
+
+                    // values left by expression statements stay on stack, both ways must leave the same
+                    if (!thenReturned && !elseReturned && thenState.stack != elseState.stack) return false;
+
+                    state.stack = thenReturned ? elseState.stack : thenState.stack;
+                }
+                break;
+            case F_CALL:
+                {
+                    size_t argsNum = function->argsTypes.size();
+
+                    if (depth < argsNum + 1 || stack.back() != JIT_SELF) return false;
+
+                    // first argument is right under callee
+                    for (size_t i = 0; i < argsNum; ++i) {
+                        if (stack[depth - 2 - i] != function->argsTypes[i]) return false;
+                    }
+
+                    if (!hasReturnType) {
+                        hasReturnType = true;
+                        assumedNumberReturn = true;
+                        function->returnType = JIT_NUMBER;
+                    }
+
+                    assembler.callSelf(stackOffset(depth - 2));
+                    assembler.store(stackOffset(depth - 1 - argsNum));
+
+                    stack.resize(depth - 1 - argsNum);
+                    stack.push_back(function->returnType);
+                }
+                break;
+            case F_RETURN:
+                {
+                    // value under result would stay on interpreter stack, empty stack would give null
+                    if (depth != 1 || stack.back() == JIT_SELF) return false;
+
+                    if (!hasReturnType) {
+                        hasReturnType = true;
+                        function->returnType = stack.back();
+                    } else if (function->returnType != stack.back()) return false;
+
+                    assembler.load(0, stackOffset(0));
+                    assembler.epilogue();
+
+                    returned = true;
+                    return true;
+                }
+                break;
+            default:
+                return false;
+        }
+
+        maxDepth = max(maxDepth, state.stack.size());
+    }
+
+    return true;
+}
+
+shared_ptr<JitFunction> JitCompilation::compile(vector<shared_ptr<InstructionOperrand>>& args) {
+    FuncDeclaration* declaration = closure->operrand.get();
+
+    function = make_shared<JitFunction>();
+
+    JitState state;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        JitType type;
+        double ignored;
+
+        if (!readValue(args[i].get(), type, ignored)) return nullptr;
+
+        function->argsTypes.push_back(type);
+        state.locals[declaration->argsIds.at(i)] = { (int)i, type };
+    }
+
+    maxLocals = args.size() + countAssignments(declaration->bytecode, *tables);
+    nextLocal = args.size();
+
+    size_t frameSize = assembler.prologue();
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        assembler.loadArgument(i);
+        assembler.store(localOffset(i));
+    }
+
+    bool returned;
+
+    // falling out of function without return pushes nothing, interpreter keeps that
+    if (!compileBlock(declaration->bytecode, state, returned) || !returned) return nullptr;
+
+    if (assumedNumberReturn && function->returnType != JIT_NUMBER) return nullptr;
+
+    // saved r12 and slots, rsp stays 16 bytes aligned at calls
+    size_t slotsBytes = 8 * (maxLocals + maxDepth);
+    size_t frame = (slotsBytes + 8 + 15) / 16 * 16 - 8;
+
+    assembler.patch32(frameSize, frame);
+
+#ifdef FEMIRA_JIT
+    size_t size = (assembler.code.size() + 4095) / 4096 * 4096;
+
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+
+    memcpy(memory, assembler.code.data(), assembler.code.size());
+
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    function->code = memory;
+    function->size = size;
+
+    return function;
+#else
+    return nullptr;
+#endif
+}
+
+shared_ptr<JitFunction> Jit::compile(InstructionFunctionOperrand* closure, vector<shared_ptr<InstructionOperrand>>& args) {
+    if (!jitSupported()) return nullptr;
+
+    closure->operrand->compileBody();
+
+    return JitCompilation(closure).compile(args);
+}
+
+bool sameResult(shared_ptr<InstructionOperrand> first, shared_ptr<InstructionOperrand> second) {
+    auto firstNumber = dynamic_pointer_cast<InstructionNumberOperrand>(first);
+    auto secondNumber = dynamic_pointer_cast<InstructionNumberOperrand>(second);
+
+    if (firstNumber && secondNumber && isnan(firstNumber->operrand) && isnan(secondNumber->operrand)) return true;
+
+    return first->isEq(second);
+}
+
+struct VerifyingGuard {
+    bool& verifying;
+
+    VerifyingGuard(bool& verifying) : verifying(verifying) { verifying = true; };
+    ~VerifyingGuard() { verifying = false; };
+};
+
+bool Jit::tryCall(FVM* vm, shared_ptr<InstructionFunctionOperrand> func, vector<shared_ptr<InstructionOperrand>>& args) {
+    if (verifying) return false;
+
+    FuncDeclaration* declaration = func->operrand.get();
+
+    shared_ptr<JitFunction> compiled = atomic_load(&declaration->jitted);
+
+    if (!compiled) {
+        if (declaration->jitRejected || ++declaration->calls < threshold) return false;
+
+        compiled = compile(func.get(), args);
+
+        if (!compiled) {
+            declaration->jitRejected = true;
+            stats.rejected++;
+
+            return false;
+        }
+
+        // other VM can compile same function at the same time, both results are valid
+        atomic_store(&declaration->jitted, compiled);
+        stats.compiled++;
+    }
+
+    JitFunction* jitted = compiled.get();
+
+    // guards: machine code is valid only for types it was compiled with
+    vector<double> argsValues(args.size());
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        JitType type;
+
+        if (!readValue(args[i].get(), type, argsValues[i]) || type != jitted->argsTypes[i]) {
+            stats.guardFailures++;
+            return false;
+        }
+    }
+
+    vector<double> upvalues(func->upvalues.size());
+
+    for (auto& upvalue: jitted->upvalueTypes) {
+        InstructionOperrand* value = func->upvalues.at(upvalue.first)->value.get();
+        JitType type;
+
+        bool matches = upvalue.second == JIT_SELF ? value == func.get() : readValue(value, type, upvalues[upvalue.first]) && type == upvalue.second;
+
+        if (!matches) {
+            stats.guardFailures++;
+            return false;
+        }
+    }
+
+    double result = ((JitEntry)jitted->code)(argsValues.data(), upvalues.data());
+    stats.nativeCalls++;
+
+    shared_ptr<InstructionOperrand> value;
+
+    if (jitted->returnType == JIT_BOOL) value = boolOperrand(result != 0);
+    else value = makePooled<InstructionNumberOperrand>(result);
+
+    if (verify) {
+        {
+            VerifyingGuard guard(verifying);
+            vm->callFunction(func, args);
+        }
+
+        shared_ptr<InstructionOperrand> expected = vm->pop();
+
+        if (!sameResult(value, expected)) {
+            throw runtime_error("FVM: JIT RESULT OF " + declaration->id + " IS " + value->tostring() + ", INTERPRETER GAVE " + expected->tostring());
+        }
+
+        stats.verifiedCalls++;
+    }
+
+    vm->push(value);
+
+    return true;
+}
+
+void Jit::printStats(ostream& out) {
+    out << "[ JIT ]" << endl;
+    out << "  > functions | compiled: " << stats.compiled << " | rejected: " << stats.rejected << endl;
+    out << "  > calls | native: " << stats.nativeCalls << " | guard failures: " << stats.guardFailures << " | verified: " << stats.verifiedCalls << endl;
+}
@@ -1,16 +1,92 @@
 #include <iostream>
 #include <vector>
 #include <string.h>
+#include <algorithm>
 
 #include "include/runner.h"
+#include "include/jit.h"
 
 using namespace std;
 
+size_t parseSize(string str) {
+    size_t suffixPos;
+    double size = stod(str, &suffixPos);
+
+    string suffix = str.substr(suffixPos);
+
+    if (suffix == "K" || suffix == "k") size *= 1024;
+    else if (suffix == "M" || suffix == "m") size *= 1024 * 1024;
+    else if (suffix == "G" || suffix == "g") size *= 1024 * 1024 * 1024;
+    else if (!suffix.empty()) throw runtime_error("Unknown size suffix: " + suffix);
+
+    return size;
+}
+
 int main(int argc, char * argv[]) {
+    RunnerOptions options;
+    vector<string> paths;
+
     for (int i = 1; i < argc; ++i) {
-        Runner newRunner;
-        newRunner.run(argv[i]);
+        string arg = argv[i];
+
+        if (arg == "--alloc-stats") options.allocStats = true;
+        else if (arg == "--gc-stats") options.gcStats = true;
+        else if (arg.rfind("--gc-nursery=", 0) == 0) options.gcNursery = max(1, stoi(arg.substr(13)));
+        else if (arg.rfind("--max-heap=", 0) == 0) options.maxHeap = parseSize(arg.substr(11));
+        else if (arg == "--memory-stats") options.memoryStats = true;
+        else if (arg == "--heap-profile") options.heapProfile = true;
+        else if (arg.rfind("--heap-profile=", 0) == 0) {
+            options.heapProfile = true;
+            options.heapProfilePath = arg.substr(15);
+        }
+        else if (arg == "--jit") options.jit = true;
+        else if (arg.rfind("--jit-threshold=", 0) == 0) options.jitThreshold = max(1, stoi(arg.substr(16)));
+        else if (arg == "--jit-verify") options.jit = options.jitVerify = true;
+        else if (arg == "--emit-cpp" && i + 1 < argc) options.emitCpp = argv[++i];
+        else if (arg.rfind("--emit-cpp=", 0) == 0) options.emitCpp = arg.substr(11);
+        else if (arg == "--compile") options.compile = true;
+        else if (arg.rfind("--module-cache=", 0) == 0) options.moduleCache = arg.substr(15);
+        else if (arg.rfind("--compile-threads=", 0) == 0) options.compileThreads = max(1, stoi(arg.substr(18)));
+        else if (arg == "--eager-compile") options.eagerCompile = true;
+        else if (arg == "--no-tree-shake") options.treeShake = false;
+        else if (arg == "--tree-shake-report") options.treeShakeReport = true;
+        else if (arg.rfind("--fiber-threads=", 0) == 0) options.fiberThreads = max(1, stoi(arg.substr(16)));
+        else if (arg.rfind("--parallel-threshold=", 0) == 0) options.parallelThreshold = max(1, stoi(arg.substr(21)));
+        else if (arg == "--jobs" && i + 1 < argc) options.jobs = max(0, stoi(argv[++i]));
+        else if (arg.rfind("--jobs=", 0) == 0) options.jobs = max(0, stoi(arg.substr(7)));
+        else if (arg == "-o" && i + 1 < argc) options.output = argv[++i];
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+        else paths.push_back(arg);
+    }
+
+    if (!options.emitCpp.empty()) {
+        if (paths.size() != 1) {
+            cerr << "--emit-cpp expects one program" << endl;
+            return 1;
+        }
+
+        return Runner(options).emitCpp(paths.front()) ? 0 : 1;
+    }
+
+    if (options.compile) {
+        if (!options.output.empty() && paths.size() != 1) {
+            cerr << "-o expects one program" << endl;
+            return 1;
+        }
+
+        int status = 0;
+
+        for (string path: paths) {
+            if (!Runner(options).compile(path)) status = 1;
+        }
+
+        return status;
     }
 
-    return 0;
+    if (options.jit && !jitSupported()) cerr << "JIT is not supported on this platform, running interpreter" << endl;
+
+    return runScripts(options, paths);
 }
@@ -0,0 +1,198 @@
+#include <vector>
+#include <memory>
+#include <set>
+#include <algorithm>
+
+#include "include/fvm.h"
+#include "include/persistent.h"
+#include "include/fiber.h"
+#include "include/parallel.h"
+#include "include/typedArray.h"
+
+using namespace std;
+
+// result of one part, made by VM of its fiber from function and elements copied into it
+typedef function<shared_ptr<InstructionOperrand>(FVM*, shared_ptr<InstructionFunctionOperrand>, shared_ptr<InstructionArrayOperrand>, shared_ptr<InstructionOperrand>)> PartWork;
+
+// Function runs on copies in other VMs, so it must only read what it shares with program: captured variables which
+// hold data are not changed, captured collections and elements are frozen. Otherwise result would depend on how
+// array is split
+void checkShared(shared_ptr<InstructionOperrand> value, string name, set<InstructionOperrand*>& seen) {
+    auto typed = dynamic_pointer_cast<InstructionTypedArrayOperrand>(value);
+
+    if (!value || (!value->hasReferences() && !typed) || !seen.insert(value.get()).second) return;
+
+    if (typed) {
+        if (!typed->frozen) throw runtime_error("FVM: " + name + "() CANNOT SHARE MUTABLE ARRAY OR OBJECT WITH WORKERS, USE freeze() FIRST");
+    } else if (dynamic_pointer_cast<InstructionArrayOperrand>(value) || dynamic_pointer_cast<InstructionObjectOperrand>(value)) {
+        throw runtime_error("FVM: " + name + "() CANNOT SHARE MUTABLE ARRAY OR OBJECT WITH WORKERS, USE freeze() FIRST");
+    } else if (auto callback = dynamic_pointer_cast<InstructionFunctionOperrand>(value)) {
+        vector<UpvalueDescriptor>& upvalues = callback->operrand->upvalues;
+
+        for (size_t i = 0; i < callback->upvalues.size() && i < upvalues.size(); ++i) {
+            shared_ptr<InstructionOperrand> captured = callback->upvalues[i]->value;
+
+            // functions (and recursion) are captured before they are defined
+            if (upvalues[i].isMutable && !dynamic_pointer_cast<InstructionFunctionOperrand>(captured)) {
+                throw runtime_error("FVM: FUNCTION OF " + name + "() CAPTURES VARIABLE " + upvalues[i].id + " WHICH IS CHANGED");
+            }
+
+            checkShared(captured, name, seen);
+        }
+    } else if (auto array = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(value)) {
+        array->operrand.forEach([&](shared_ptr<InstructionOperrand> element) { checkShared(element, name, seen); });
+    } else if (auto object = dynamic_pointer_cast<InstructionFrozenObjectOperrand>(value)) {
+        object->operrand.forEach([&](string key, shared_ptr<InstructionOperrand> field) { checkShared(field, name, seen); });
+    }
+}
+
+shared_ptr<InstructionFunctionOperrand> callbackOf(shared_ptr<InstructionOperrand> value, string name, size_t argsNum) {
+    auto callback = dynamic_pointer_cast<InstructionFunctionOperrand>(value);
+    if (!callback) throw runtime_error("FVM: " + name + "() EXPECTED FUNCTION");
+    if (callback->operrand->argsIds.size() != argsNum) throw runtime_error("FVM: FUNCTION OF " + name + "() MUST HAVE " + to_string(argsNum) + " ARGUMENTS");
+
+    return callback;
+}
+
+// elements of array or frozen array, as array tracked by vm
+shared_ptr<InstructionArrayOperrand> elementsOf(FVM* vm, shared_ptr<InstructionOperrand> value, string name) {
+    auto elements = makePooled<OperrandVector>();
+
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) *elements = *array->operrand;
+    else if (auto frozen = dynamic_pointer_cast<InstructionFrozenArrayOperrand>(value)) {
+        frozen->operrand.forEach([&](shared_ptr<InstructionOperrand> element) { elements->push_back(element); });
+    } else throw runtime_error("FVM: " + name + "() EXPECTED ARRAY");
+
+    auto array = makePooled<InstructionArrayOperrand>(elements);
+    vm->gc.track(array);
+
+    return array;
+}
+
+// values stay in stack of vm while function runs, so collector sees them
+shared_ptr<InstructionOperrand> mapElements(FVM* vm, shared_ptr<InstructionFunctionOperrand> callback, shared_ptr<InstructionArrayOperrand> elements) {
+    auto results = makePooled<InstructionArrayOperrand>(makePooled<OperrandVector>());
+    vm->gc.track(results);
+
+    size_t base = vm->vmStack.size();
+    vm->push(callback);
+    vm->push(elements);
+    vm->push(results);
+
+    for (size_t i = 0; i < elements->operrand->size(); ++i) {
+        vector<shared_ptr<InstructionOperrand>> args = { (*elements->operrand)[i] };
+        results->operrand->push_back(vm->call(callback, args));
+    }
+
+    vm->vmStack.resize(base);
+
+    return results;
+}
+
+// without init (null pointer, not null of program) fold starts from first element, elements must not be empty then
+shared_ptr<InstructionOperrand> reduceElements(FVM* vm, shared_ptr<InstructionFunctionOperrand> callback, shared_ptr<InstructionArrayOperrand> elements, shared_ptr<InstructionOperrand> init) {
+    size_t first = init ? 0 : 1;
+
+    size_t base = vm->vmStack.size();
+    vm->push(callback);
+    vm->push(elements);
+    vm->push(init ? init : (*elements->operrand)[0]);
+
+    for (size_t i = first; i < elements->operrand->size(); ++i) {
+        vector<shared_ptr<InstructionOperrand>> args = { vm->vmStack[base + 2], (*elements->operrand)[i] };
+        vm->vmStack[base + 2] = vm->call(callback, args);
+    }
+
+    shared_ptr<InstructionOperrand> result = vm->vmStack[base + 2];
+    vm->vmStack.resize(base);
+
+    return result;
+}
+
+// small arrays and single thread give nothing but copies
+bool runsInParallel(FVM* vm, shared_ptr<InstructionArrayOperrand> elements) {
+    return elements->operrand->size() >= vm->parallelThreshold && fiberThreadsOf(vm) > 1;
+}
+
+// array of results of parts, in order; first error of part is thrown here
+shared_ptr<InstructionArrayOperrand> runParts(FVM* vm, shared_ptr<InstructionFunctionOperrand> callback, shared_ptr<InstructionArrayOperrand> elements, shared_ptr<InstructionOperrand> init, PartWork work) {
+    OperrandVector& all = *elements->operrand;
+
+    // several parts per thread, so threads which finish early take parts of others
+    size_t parts = min(all.size(), fiberThreadsOf(vm) * 4);
+    size_t partSize = (all.size() + parts - 1) / parts;
+
+    auto fibers = makePooled<OperrandVector>();
+
+    for (size_t begin = 0; begin < all.size(); begin += partSize) {
+        shared_ptr<Fiber> fiber = makeFiber(vm);
+        FVM* child = fiber->vm.get();
+
+        // one copy of function per fiber, cells it shares with its captured functions stay shared
+        FiberCopies copies;
+        auto partCallback = static_pointer_cast<InstructionFunctionOperrand>(transfer(callback, child, copies));
+
+        auto partElements = makePooled<OperrandVector>();
+        for (size_t i = begin; i < min(begin + partSize, all.size()); ++i) partElements->push_back(transfer(all[i], child, copies));
+
+        auto part = makePooled<InstructionArrayOperrand>(partElements);
+        child->gc.track(part);
+
+        // init is folded in once, by first part
+        shared_ptr<InstructionOperrand> partInit = init && begin == 0 ? transfer(init, child, copies) : nullptr;
+
+        fiber->task = [work, partCallback, part, partInit](FVM* child) { return work(child, partCallback, part, partInit); };
+
+        vm->fibers->submit(fiber);
+        fibers->push_back(makePooled<InstructionFiberOperrand>(fiber));
+    }
+
+    return static_pointer_cast<InstructionArrayOperrand>(joinFiber(vm, makePooled<InstructionArrayOperrand>(fibers)));
+}
+
+shared_ptr<InstructionOperrand> parallelMap(FVM* vm, shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> function) {
+    shared_ptr<InstructionFunctionOperrand> callback = callbackOf(function, "parallel_map", 1);
+    shared_ptr<InstructionArrayOperrand> elements = elementsOf(vm, array, "parallel_map");
+
+    // checked for small arrays too, so program does not change its behaviour with size of input
+    set<InstructionOperrand*> seen;
+    checkShared(callback, "parallel_map", seen);
+    for (shared_ptr<InstructionOperrand>& element: *elements->operrand) checkShared(element, "parallel_map", seen);
+
+    if (!runsInParallel(vm, elements)) return mapElements(vm, callback, elements);
+
+    shared_ptr<InstructionArrayOperrand> parts = runParts(vm, callback, elements, nullptr, [](FVM* child, shared_ptr<InstructionFunctionOperrand> partCallback, shared_ptr<InstructionArrayOperrand> part, shared_ptr<InstructionOperrand>) {
+        return mapElements(child, partCallback, part);
+    });
+
+    auto results = makePooled<OperrandVector>();
+    results->reserve(elements->operrand->size());
+
+    for (shared_ptr<InstructionOperrand>& part: *parts->operrand) {
+        OperrandVector& values = *static_pointer_cast<InstructionArrayOperrand>(part)->operrand;
+        results->insert(results->end(), values.begin(), values.end());
+    }
+
+    auto merged = makePooled<InstructionArrayOperrand>(results);
+    vm->gc.track(merged);
+
+    return merged;
+}
+
+shared_ptr<InstructionOperrand> parallelReduce(FVM* vm, shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> function, shared_ptr<InstructionOperrand> init) {
+    shared_ptr<InstructionFunctionOperrand> callback = callbackOf(function, "parallel_reduce", 2);
+    shared_ptr<InstructionArrayOperrand> elements = elementsOf(vm, array, "parallel_reduce");
+
+    set<InstructionOperrand*> seen;
+    checkShared(callback, "parallel_reduce", seen);
+    checkShared(init, "parallel_reduce", seen);
+    for (shared_ptr<InstructionOperrand>& element: *elements->operrand) checkShared(element, "parallel_reduce", seen);
+
+    if (!runsInParallel(vm, elements)) return reduceElements(vm, callback, elements, init);
+
+    shared_ptr<InstructionArrayOperrand> parts = runParts(vm, callback, elements, init, [](FVM* child, shared_ptr<InstructionFunctionOperrand> partCallback, shared_ptr<InstructionArrayOperrand> part, shared_ptr<InstructionOperrand> partInit) {
+        return reduceElements(child, partCallback, part, partInit);
+    });
+
+    return reduceElements(vm, callback, parts, nullptr);
+}
@@ -0,0 +1,313 @@
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "include/persistent.h"
+#include "include/typedArray.h"
+
+using namespace std;
+
+const int BITS = 5;
+const size_t WIDTH = 1 << BITS;
+const size_t MASK = WIDTH - 1;
+
+PersistentVector::PersistentVector() {
+    root = makePooled<PersistentVectorNode>();
+    tail = makePooled<PersistentVectorNode>();
+    count = 0;
+    shift = BITS;
+}
+
+PersistentVector::PersistentVector(const vector<shared_ptr<InstructionOperrand>>& values) : PersistentVector() {
+    count = values.size();
+
+    size_t offset = tailOffset();
+
+    tail->values.assign(values.begin() + offset, values.end());
+
+    // build full leaves directly and group them level by level instead of pushing one by one
+    vector<shared_ptr<PersistentVectorNode>> nodes;
+
+    for (size_t i = 0; i < offset; i += WIDTH) {
+        shared_ptr<PersistentVectorNode> leaf = makePooled<PersistentVectorNode>();
+        leaf->values.assign(values.begin() + i, values.begin() + i + WIDTH);
+
+        nodes.push_back(leaf);
+    }
+
+    while (nodes.size() > WIDTH) {
+        vector<shared_ptr<PersistentVectorNode>> parents;
+
+        for (size_t i = 0; i < nodes.size(); i += WIDTH) {
+            shared_ptr<PersistentVectorNode> parent = makePooled<PersistentVectorNode>();
+            parent->children.assign(nodes.begin() + i, nodes.begin() + min(i + WIDTH, nodes.size()));
+
+            parents.push_back(parent);
+        }
+
+        nodes = parents;
+        shift += BITS;
+    }
+
+    root->children.assign(nodes.begin(), nodes.end());
+}
+
+size_t PersistentVector::tailOffset() const {
+    if (count < WIDTH) return 0;
+
+    return ((count - 1) >> BITS) << BITS;
+}
+
+const OperrandVector& PersistentVector::leafFor(size_t index) const {
+    if (index >= tailOffset()) return tail->values;
+
+    PersistentVectorNode* node = root.get();
+
+    for (int level = shift; level > 0; level -= BITS) {
+        node = node->children.at((index >> level) & MASK).get();
+    }
+
+    return node->values;
+}
+
+shared_ptr<InstructionOperrand> PersistentVector::get(size_t index) const {
+    if (index >= count) return nullptr;
+
+    return leafFor(index).at(index & MASK);
+}
+
+shared_ptr<PersistentVectorNode> newPath(int level, shared_ptr<PersistentVectorNode> node) {
+    if (level == 0) return node;
+
+    shared_ptr<PersistentVectorNode> path = makePooled<PersistentVectorNode>();
+    path->children.push_back(newPath(level - BITS, node));
+
+    return path;
+}
+
+shared_ptr<PersistentVectorNode> PersistentVector::pushTail(int level, shared_ptr<PersistentVectorNode> parent, shared_ptr<PersistentVectorNode> tailNode) const {
+    size_t subIndex = ((count - 1) >> level) & MASK;
+
+    shared_ptr<PersistentVectorNode> node = makePooled<PersistentVectorNode>(*parent);
+    shared_ptr<PersistentVectorNode> toInsert;
+
+    if (level == BITS) toInsert = tailNode;
+    else if (subIndex < parent->children.size()) toInsert = pushTail(level - BITS, parent->children.at(subIndex), tailNode);
+    else toInsert = newPath(level - BITS, tailNode);
+
+    if (subIndex < node->children.size()) node->children[subIndex] = toInsert;
+    else node->children.push_back(toInsert);
+
+    return node;
+}
+
+PersistentVector PersistentVector::push(shared_ptr<InstructionOperrand> value) const {
+    PersistentVector result = *this;
+
+    if (count - tailOffset() < WIDTH) {
+        result.tail = makePooled<PersistentVectorNode>(*tail);
+        result.tail->values.push_back(value);
+        result.count++;
+
+        return result;
+    }
+
+    if ((count >> BITS) > ((size_t)1 << shift)) {
+        result.root = makePooled<PersistentVectorNode>();
+        result.root->children.push_back(root);
+        result.root->children.push_back(newPath(shift, tail));
+        result.shift += BITS;
+    } else result.root = pushTail(shift, root, tail);
+
+    result.tail = makePooled<PersistentVectorNode>();
+    result.tail->values.push_back(value);
+    result.count++;
+
+    return result;
+}
+
+shared_ptr<PersistentVectorNode> PersistentVector::assocNode(int level, shared_ptr<PersistentVectorNode> node, size_t index, shared_ptr<InstructionOperrand> value) const {
+    shared_ptr<PersistentVectorNode> copy = makePooled<PersistentVectorNode>(*node);
+
+    if (level == 0) copy->values[index & MASK] = value;
+    else {
+        size_t subIndex = (index >> level) & MASK;
+        copy->children[subIndex] = assocNode(level - BITS, node->children.at(subIndex), index, value);
+    }
+
+    return copy;
+}
+
+PersistentVector PersistentVector::set(size_t index, shared_ptr<InstructionOperrand> value) const {
+    if (index == count) return push(value);
+    if (index > count) throw runtime_error("FVM: FROZEN ARRAY INDEX OUT OF RANGE");
+
+    PersistentVector result = *this;
+
+    if (index >= tailOffset()) {
+        result.tail = makePooled<PersistentVectorNode>(*tail);
+        result.tail->values[index & MASK] = value;
+    } else result.root = assocNode(shift, root, index, value);
+
+    return result;
+}
+
+void PersistentVector::forEach(function<void(shared_ptr<InstructionOperrand>)> callback) const {
+    for (size_t i = 0; i < count; i += WIDTH) {
+        for (shared_ptr<InstructionOperrand> value: leafFor(i)) callback(value);
+    }
+}
+
+PersistentMap::PersistentMap() {
+    root = makePooled<PersistentMapNode>();
+    count = 0;
+}
+
+shared_ptr<PersistentMapNode> assocMapNode(shared_ptr<PersistentMapNode> node, int shift, PersistentMapEntry entry, bool& added) {
+    shared_ptr<PersistentMapNode> copy = makePooled<PersistentMapNode>(*node);
+
+    if (node->isCollision) {
+        for (PersistentMapEntry& existing: copy->entries) {
+            if (existing.key == entry.key) {
+                existing.value = entry.value;
+                return copy;
+            }
+        }
+
+        copy->entries.push_back(entry);
+        added = true;
+
+        return copy;
+    }
+
+    uint32_t bit = 1u << ((entry.hash >> shift) & MASK);
+    size_t index = __builtin_popcount(node->bitmap & (bit - 1));
+
+    if (!(node->bitmap & bit)) {
+        copy->bitmap |= bit;
+        copy->entries.insert(copy->entries.begin() + index, entry);
+        added = true;
+
+        return copy;
+    }
+
+    PersistentMapEntry& existing = copy->entries[index];
+
+    if (existing.child) {
+        existing.child = assocMapNode(existing.child, shift + BITS, entry, added);
+    } else if (existing.key == entry.key) {
+        existing.value = entry.value;
+    } else {
+        shared_ptr<PersistentMapNode> child = makePooled<PersistentMapNode>();
+        bool ignored = false;
+
+        if (shift + BITS >= (int)(sizeof(size_t) * 8)) {
+            child->isCollision = true;
+            child->entries.push_back(existing);
+            child->entries.push_back(entry);
+        } else {
+            child = assocMapNode(child, shift + BITS, existing, ignored);
+            child = assocMapNode(child, shift + BITS, entry, ignored);
+        }
+
+        PersistentMapEntry branch;
+        branch.child = child;
+
+        existing = branch;
+        added = true;
+    }
+
+    return copy;
+}
+
+PersistentMap PersistentMap::set(string key, shared_ptr<InstructionOperrand> value) const {
+    PersistentMapEntry entry;
+    entry.key = key;
+    entry.hash = hash<string>()(key);
+    entry.value = value;
+
+    bool added = false;
+
+    PersistentMap result = *this;
+    result.root = assocMapNode(root, 0, entry, added);
+    if (added) result.count++;
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> PersistentMap::get(string key) const {
+    size_t keyHash = hash<string>()(key);
+
+    PersistentMapNode* node = root.get();
+    int shift = 0;
+
+    while (node) {
+        if (node->isCollision) {
+            for (PersistentMapEntry& entry: node->entries) {
+                if (entry.key == key) return entry.value;
+            }
+
+            return nullptr;
+        }
+
+        uint32_t bit = 1u << ((keyHash >> shift) & MASK);
+        if (!(node->bitmap & bit)) return nullptr;
+
+        PersistentMapEntry& entry = node->entries.at(__builtin_popcount(node->bitmap & (bit - 1)));
+
+        if (!entry.child) return entry.key == key ? entry.value : nullptr;
+
+        node = entry.child.get();
+        shift += BITS;
+    }
+
+    return nullptr;
+}
+
+void forEachMapNode(PersistentMapNode* node, function<void(string, shared_ptr<InstructionOperrand>)>& callback) {
+    for (PersistentMapEntry& entry: node->entries) {
+        if (entry.child) forEachMapNode(entry.child.get(), callback);
+        else callback(entry.key, entry.value);
+    }
+}
+
+void PersistentMap::forEach(function<void(string, shared_ptr<InstructionOperrand>)> callback) const {
+    forEachMapNode(root.get(), callback);
+}
+
+shared_ptr<InstructionOperrand> freeze(shared_ptr<InstructionOperrand> value) {
+    if (auto array = dynamic_pointer_cast<InstructionArrayOperrand>(value)) {
+        vector<shared_ptr<InstructionOperrand>> elements;
+        elements.reserve(array->operrand->size());
+
+        bool containsReferences = false;
+
+        for (shared_ptr<InstructionOperrand> element: *array->operrand) {
+            elements.push_back(freeze(element));
+            containsReferences |= elements.back()->hasReferences();
+        }
+
+        return makePooled<InstructionFrozenArrayOperrand>(PersistentVector(elements), containsReferences);
+    } else if (auto object = dynamic_pointer_cast<InstructionObjectOperrand>(value)) {
+        PersistentMap fields;
+
+        bool containsReferences = false;
+
+        for (auto field: *object->operrand) {
+            shared_ptr<InstructionOperrand> frozen = freeze(field.second);
+            containsReferences |= frozen->hasReferences();
+
+            fields = fields.set(field.first, frozen);
+        }
+
+        return makePooled<InstructionFrozenObjectOperrand>(fields, containsReferences);
+    } else if (auto typed = dynamic_pointer_cast<InstructionTypedArrayOperrand>(value)) {
+        if (!typed->frozen) return typed->copy(true);
+    }
+
+    // frozen collections are passed to fibers without copying, so ropes inside them are joined before that
+    if (auto text = dynamic_cast<InstructionStringOperrand*>(value.get())) text->text();
+
+    // frozen collections and scalars are already immutable
+    return value;
+}
@@ -0,0 +1,380 @@
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "include/profiler.h"
+#include "include/persistent.h"
+
+using namespace std;
+
+const size_t PREVIEW_LENGTH = 60;
+const size_t PREVIEW_ELEMENTS = 8;
+
+void HeapProfiler::recordAllocation(const AllocationSite* site, size_t bytes) {
+    SiteAllocations& allocations = sites[site];
+
+    allocations.allocations++;
+    allocations.bytes += bytes;
+}
+
+void HeapProfiler::recordGrowth(const AllocationSite* site, size_t bytes) {
+    SiteAllocations& allocations = sites[site];
+
+    allocations.growths++;
+    allocations.growthBytes += bytes;
+}
+
+string heapTypeName(InstructionOperrand* operrand) {
+    if (dynamic_cast<InstructionArrayOperrand*>(operrand)) return "array";
+    if (dynamic_cast<InstructionObjectOperrand*>(operrand)) return "object";
+    if (dynamic_cast<InstructionFrozenArrayOperrand*>(operrand)) return "frozen array";
+    if (dynamic_cast<InstructionFrozenObjectOperrand*>(operrand)) return "frozen object";
+    if (dynamic_cast<InstructionFunctionOperrand*>(operrand)) return "function";
+    if (dynamic_cast<InstructionStringOperrand*>(operrand)) return "string";
+    if (dynamic_cast<InstructionNumberOperrand*>(operrand)) return "number";
+
+    return "unknown";
+}
+
+string siteName(InstructionOperrand* operrand) {
+    const AllocationSite* site = nullptr;
+
+    if (auto array = dynamic_cast<InstructionArrayOperrand*>(operrand)) site = array->site;
+    else if (auto object = dynamic_cast<InstructionObjectOperrand*>(operrand)) site = object->site;
+
+    // scalars and values made by builtins have no site
+    return site ? site->tostring() : "-";
+}
+
+// one level deep: mutable containers may contain themselves, so tostring() is only used for their elements which are not containers
+string elementPreview(shared_ptr<InstructionOperrand> element) {
+    if (dynamic_cast<InstructionArrayOperrand*>(element.get())) return "[...]";
+    if (dynamic_cast<InstructionObjectOperrand*>(element.get())) return "{...}";
+
+    return element->tostring();
+}
+
+string preview(InstructionOperrand* operrand) {
+    string text;
+
+    if (auto array = dynamic_cast<InstructionArrayOperrand*>(operrand)) {
+        text = "[";
+
+        for (size_t i = 0; i < array->operrand->size() && i < PREVIEW_ELEMENTS; ++i) {
+            text += (i ? ", " : "") + elementPreview(array->operrand->at(i));
+        }
+
+        if (array->operrand->size() > PREVIEW_ELEMENTS) text += ", ...";
+        text += "]";
+    } else if (auto object = dynamic_cast<InstructionObjectOperrand*>(operrand)) {
+        text = "{";
+        size_t shown = 0;
+
+        for (auto& field: *object->operrand) {
+            if (shown == PREVIEW_ELEMENTS) {
+                text += ", ...";
+                break;
+            }
+
+            text += (shown++ ? ", " : "") + field.first + ": " + elementPreview(field.second);
+        }
+
+        text += "}";
+    } else text = operrand->tostring();
+
+    replace(text.begin(), text.end(), '\n', ' ');
+
+    if (text.size() > PREVIEW_LENGTH) text = text.substr(0, PREVIEW_LENGTH - 3) + "...";
+
+    return text;
+}
+
+HeapSnapshot HeapProfiler::takeSnapshot(FVM* vm) {
+    // node 0 is virtual root: stack, frames and globals point to values from it
+    vector<InstructionOperrand*> nodes = { nullptr };
+    vector<vector<int>> edges(1);
+    unordered_map<InstructionOperrand*, int> ids;
+
+    vector<int> worklist;
+
+    auto addEdge = [&](int from, InstructionOperrand* operrand) {
+        // immortal true/false/null and builtins are not part of program heap
+        if (!operrand || dynamic_cast<InstructionBoolOperrand*>(operrand) || dynamic_cast<InstructionNullOperrand*>(operrand) || dynamic_cast<InstructionNativeFunctionOperrand*>(operrand)) return;
+
+        auto found = ids.find(operrand);
+        int id;
+
+        if (found == ids.end()) {
+            id = nodes.size();
+            ids[operrand] = id;
+
+            nodes.push_back(operrand);
+            edges.emplace_back();
+            worklist.push_back(id);
+        } else id = found->second;
+
+        edges[from].push_back(id);
+    };
+
+    for (shared_ptr<InstructionOperrand>& operrand: vm->vmStack) addEdge(0, operrand.get());
+
+    vector<Scope*> scopes = { vm->globals.get() };
+
+    for (Frame& frame: vm->frames) {
+        scopes.push_back(frame.scope);
+        addEdge(0, frame.closure);
+    }
+
+    for (Scope* scope: scopes) {
+        if (!scope) continue;
+
+        for (auto& member: scope->members) addEdge(0, member.second.get().get());
+    }
+
+    // collector tracing reports direct references of every operrand kind
+    GcTracer tracer;
+    vector<InstructionOperrand*> references;
+    tracer.references = &references;
+
+    while (!worklist.empty()) {
+        int id = worklist.back();
+        worklist.pop_back();
+
+        references.clear();
+        nodes[id]->trace(tracer);
+
+        for (InstructionOperrand* reference: references) addEdge(id, reference);
+    }
+
+    size_t count = nodes.size();
+
+    vector<vector<int>> predecessors(count);
+
+    for (size_t from = 0; from < count; ++from) {
+        for (int to: edges[from]) predecessors[to].push_back(from);
+    }
+
+    // postorder of depth-first walk from root
+    vector<int> postorder;
+    vector<int> postIndex(count, -1);
+    vector<bool> visited(count, false);
+    vector<pair<int, size_t>> stack = { { 0, 0 } };
+    visited[0] = true;
+
+    while (!stack.empty()) {
+        pair<int, size_t>& top = stack.back();
+
+        if (top.second < edges[top.first].size()) {
+            int next = edges[top.first][top.second++];
+
+            if (!visited[next]) {
+                visited[next] = true;
+                stack.push_back({ next, 0 });
+            }
+        } else {
+            postIndex[top.first] = postorder.size();
+            postorder.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+
+    // immediate dominators, Cooper-Harvey-Kennedy iteration in reverse postorder
+    vector<int> idom(count, -1);
+    idom[0] = 0;
+
+    auto intersect = [&](int first, int second) {
+        while (first != second) {
+            while (postIndex[first] < postIndex[second]) first = idom[first];
+            while (postIndex[second] < postIndex[first]) second = idom[second];
+        }
+
+        return first;
+    };
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (size_t i = postorder.size() - 1; i-- > 0;) {
+            int node = postorder[i];
+            int newIdom = -1;
+
+            for (int predecessor: predecessors[node]) {
+                if (idom[predecessor] == -1) continue;
+
+                newIdom = newIdom == -1 ? predecessor : intersect(predecessor, newIdom);
+            }
+
+            if (idom[node] != newIdom) {
+                idom[node] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    HeapSnapshot snapshot;
+
+    vector<size_t> retained(count, 0);
+
+    for (size_t i = 1; i < count; ++i) {
+        retained[i] = nodes[i]->heapSize();
+
+        snapshot.objects++;
+        snapshot.bytes += retained[i];
+    }
+
+    // dominated values finish before their dominator in postorder
+    for (int node: postorder) {
+        if (node != 0) retained[idom[node]] += retained[node];
+    }
+
+    map<pair<string, string>, int> groupIds;
+    vector<int> groupOf(count, -1);
+    vector<size_t> previewRetained;
+    vector<int> previewNode;
+
+    for (size_t i = 1; i < count; ++i) {
+        pair<string, string> key = { heapTypeName(nodes[i]), siteName(nodes[i]) };
+
+        auto found = groupIds.find(key);
+
+        if (found == groupIds.end()) {
+            found = groupIds.insert({ key, snapshot.groups.size() }).first;
+
+            HeapGroup group;
+            group.type = key.first;
+            group.site = key.second;
+
+            snapshot.groups.push_back(group);
+            previewRetained.push_back(0);
+            previewNode.push_back(i);
+        }
+
+        int groupId = found->second;
+        groupOf[i] = groupId;
+
+        HeapGroup& group = snapshot.groups[groupId];
+        group.count++;
+        group.shallowBytes += nodes[i]->heapSize();
+
+        if (retained[i] > previewRetained[groupId]) {
+            previewRetained[groupId] = retained[i];
+            previewNode[groupId] = i;
+        }
+    }
+
+    // walk dominator tree, value adds its retained size only if no dominator of it is from same group
+    vector<vector<int>> dominated(count);
+
+    for (size_t i = 1; i < count; ++i) {
+        if (idom[i] != -1) dominated[idom[i]].push_back(i);
+    }
+
+    vector<int> activeInGroup(snapshot.groups.size(), 0);
+
+    // negative entry - leave node
+    vector<int> walk = { 0 };
+
+    while (!walk.empty()) {
+        int entry = walk.back();
+        walk.pop_back();
+
+        if (entry < 0) {
+            activeInGroup[groupOf[-entry]]--;
+            continue;
+        }
+
+        if (entry != 0) {
+            int groupId = groupOf[entry];
+
+            if (activeInGroup[groupId] == 0) snapshot.groups[groupId].retainedBytes += retained[entry];
+            activeInGroup[groupId]++;
+
+            walk.push_back(-entry);
+        }
+
+        for (int child: dominated[entry]) walk.push_back(child);
+    }
+
+    for (size_t i = 0; i < snapshot.groups.size(); ++i) snapshot.groups[i].preview = preview(nodes[previewNode[i]]);
+
+    sort(snapshot.groups.begin(), snapshot.groups.end(), [](const HeapGroup& first, const HeapGroup& second) {
+        return first.retainedBytes > second.retainedBytes;
+    });
+
+    return snapshot;
+}
+
+vector<pair<const AllocationSite*, SiteAllocations>> sortedSites(map<const AllocationSite*, SiteAllocations>& sites) {
+    vector<pair<const AllocationSite*, SiteAllocations>> sorted(sites.begin(), sites.end());
+
+    sort(sorted.begin(), sorted.end(), [](auto& first, auto& second) {
+        return first.second.bytes + first.second.growthBytes > second.second.bytes + second.second.growthBytes;
+    });
+
+    return sorted;
+}
+
+void HeapProfiler::writeText(ostream& out, HeapSnapshot& snapshot) {
+    out << "[ HEAP PROFILE ]" << endl;
+    out << "  > snapshot | objects: " << snapshot.objects << " | bytes: " << snapshot.bytes << endl;
+    out << "  > live by type and site | count | shallow bytes | retained bytes | preview" << endl;
+
+    for (HeapGroup& group: snapshot.groups) {
+        out << "    " << group.type << " | " << group.site << " | " << group.count << " | " << group.shallowBytes << " | " << group.retainedBytes << " | " << group.preview << endl;
+    }
+
+    out << "  > allocated by site | allocations | bytes | growths | growth bytes" << endl;
+
+    for (auto& site: sortedSites(sites)) {
+        out << "    " << site.first->tostring() << " | " << site.second.allocations << " | " << site.second.bytes << " | " << site.second.growths << " | " << site.second.growthBytes << endl;
+    }
+}
+
+string jsonString(string text) {
+    string escaped = "\"";
+
+    for (char symbol: text) {
+        if (symbol == '"' || symbol == '\\') escaped += string("\\") + symbol;
+        else if ((unsigned char)symbol < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", symbol);
+            escaped += code;
+        } else escaped += symbol;
+    }
+
+    return escaped + "\"";
+}
+
+void HeapProfiler::writeJson(ostream& out, HeapSnapshot& snapshot) {
+    out << "{" << endl;
+    out << "  \"objects\": " << snapshot.objects << "," << endl;
+    out << "  \"bytes\": " << snapshot.bytes << "," << endl;
+    out << "  \"groups\": [";
+
+    for (size_t i = 0; i < snapshot.groups.size(); ++i) {
+        HeapGroup& group = snapshot.groups[i];
+
+        out << (i ? "," : "") << endl << "    { \"type\": " << jsonString(group.type) << ", \"site\": " << jsonString(group.site)
+            << ", \"count\": " << group.count << ", \"shallowBytes\": " << group.shallowBytes << ", \"retainedBytes\": " << group.retainedBytes
+            << ", \"preview\": " << jsonString(group.preview) << " }";
+    }
+
+    out << endl << "  ]," << endl;
+    out << "  \"sites\": [";
+
+    vector<pair<const AllocationSite*, SiteAllocations>> sorted = sortedSites(sites);
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const AllocationSite* site = sorted[i].first;
+        SiteAllocations& allocations = sorted[i].second;
+
+        out << (i ? "," : "") << endl << "    { \"file\": " << jsonString(site->file) << ", \"line\": " << site->line
+            << ", \"allocations\": " << allocations.allocations << ", \"bytes\": " << allocations.bytes
+            << ", \"growths\": " << allocations.growths << ", \"growthBytes\": " << allocations.growthBytes << " }";
+    }
+
+    out << endl << "  ]" << endl;
+    out << "}" << endl;
+}
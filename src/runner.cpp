@@ -1,8 +1,16 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "include/runner.h"
+#include "include/profiler.h"
+#include "include/jit.h"
+#include "include/bytecodeFile.h"
 #include "compiler/include/compiler.h"
+#include "compiler/include/cppEmitter.h"
 
 using namespace std;
 
@@ -21,12 +29,195 @@ string read(string path) {
     return code;
 }
 
-void Runner::run(string path) {
+Runner::Runner(RunnerOptions options) {
+    this->options = options;
+}
+
+bool Runner::run(string path) {
+    Compiler compiler;
+    compiler.moduleCache = options.moduleCache;
+    compiler.threads = options.compileThreads;
+    compiler.treeShake = options.treeShake;
+    compiler.eager = options.eagerCompile;
+    compiler.registry = registry;
+
+    FVM fvm(false, options.allocStats);
+    fvm.out = out;
+    fvm.fiberThreads = options.fiberThreads;
+    fvm.parallelThreshold = options.parallelThreshold;
+    fvm.gc.nurserySize = options.gcNursery;
+    fvm.heap->limit = options.maxHeap;
+    fvm.heap->pressureBytes = options.maxHeap / 4 * 3;
+
+    if (options.heapProfile) fvm.profiler = make_shared<HeapProfiler>();
+
+    if (options.jit && jitSupported()) {
+        fvm.jit = make_shared<Jit>();
+        fvm.jit->threshold = options.jitThreshold;
+        fvm.jit->verify = options.jitVerify;
+    }
+
+    bool success = true;
+
+    try {
+        // compiled program (.fmc) is loaded as is
+        auto compiled = isBytecodeFile(path) ? loadBytecodeFile(path) : compiler.compile(read(path), path);
+
+        fvm.run(compiled->bytecode, *compiled->tables, fvm.globals);
+    } catch (const exception& e) {
+        *err << path << ": " << e.what() << endl;
+        success = false;
+    }
+
+    if (options.allocStats) fvm.printAllocStats();
+    if (options.gcStats) fvm.gc.printStats(*out);
+    if (options.memoryStats) fvm.printMemoryStats();
+    if (fvm.jit && options.jitVerify) fvm.jit->printStats(*out);
+    if (options.treeShakeReport) compiler.printShakeReport(*out);
+
+    // snapshot is taken after run (or error), what program left in globals is live
+    if (options.heapProfile) {
+        HeapSnapshot snapshot = fvm.profiler->takeSnapshot(&fvm);
+
+        string& output = options.heapProfilePath;
+        bool json = output.size() >= 5 && output.substr(output.size() - 5) == ".json";
+
+        if (output.empty()) fvm.profiler->writeText(*out, snapshot);
+        else {
+            ofstream file(output);
+
+            if (json) fvm.profiler->writeJson(file, snapshot);
+            else fvm.profiler->writeText(file, snapshot);
+        }
+    }
+
+    return success;
+}
+
+bool Runner::emitCpp(string path) {
     Compiler compiler;
+    compiler.moduleCache = options.moduleCache;
+    compiler.threads = options.compileThreads;
+    compiler.treeShake = options.treeShake;
+    // C++ source and .fmc need every body
+    compiler.eager = true;
+
+    try {
+        auto compiled = compiler.compile(read(path), path);
+        string source = CppEmitter().emit(compiled, path);
 
-    FVM fvm(false);
+        ofstream file(options.emitCpp);
+        if (!file) throw runtime_error("Cannot write " + options.emitCpp);
 
-    auto compiled = compiler.compile(read(path));
+        file << source;
+
+        if (options.treeShakeReport) compiler.printShakeReport(*out);
+    } catch (const exception& e) {
+        *err << path << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Runner::compile(string path) {
+    Compiler compiler;
+    compiler.moduleCache = options.moduleCache;
+    compiler.threads = options.compileThreads;
+    compiler.treeShake = options.treeShake;
+    compiler.eager = true;
+
+    string output = options.output;
+
+    if (output.empty()) {
+        size_t extension = path.rfind('.');
+        output = (extension == string::npos || path.find('/', extension) != string::npos ? path : path.substr(0, extension)) + ".fmc";
+    }
 
-    fvm.run(compiled);
-}
\ No newline at end of file
+    try {
+        auto compiled = compiler.compile(read(path), path);
+
+        ofstream file(output, ios::binary);
+        if (!file) throw runtime_error("Cannot write " + output);
+
+        writeBytecodeFile(file, compiled);
+
+        if (options.treeShakeReport) compiler.printShakeReport(*out);
+    } catch (const exception& e) {
+        *err << path << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+int runScripts(RunnerOptions options, vector<string> paths) {
+    int status = 0;
+
+    size_t jobs = options.jobs ? options.jobs : max(1u, thread::hardware_concurrency());
+    jobs = min(jobs, paths.size());
+
+    if (jobs <= 1) {
+        for (string path: paths) {
+            Runner newRunner(options);
+            if (!newRunner.run(path)) status = 1;
+        }
+
+        return status;
+    }
+
+    // every script writes to its own buffers, they are printed in order of paths as soon as scripts before are printed
+    vector<stringstream> outputs(paths.size());
+    vector<stringstream> errors(paths.size());
+    vector<bool> finished(paths.size());
+
+    shared_ptr<ModuleRegistry> registry = make_shared<ModuleRegistry>();
+
+    mutex lock;
+    condition_variable changed;
+    size_t next = 0;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t index;
+
+            {
+                lock_guard<mutex> guard(lock);
+                if (next == paths.size()) return;
+
+                index = next++;
+            }
+
+            Runner runner(options);
+            runner.out = &outputs[index];
+            runner.err = &errors[index];
+            runner.registry = registry;
+
+            bool success = runner.run(paths[index]);
+
+            lock_guard<mutex> guard(lock);
+
+            if (!success) status = 1;
+            finished[index] = true;
+
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 0; i < jobs; ++i) workers.push_back(thread(worker));
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&]() { return finished[i]; });
+        }
+
+        cout << outputs[i].str() << flush;
+        cerr << errors[i].str() << flush;
+    }
+
+    for (thread& thread: workers) thread.join();
+
+    return status;
+}
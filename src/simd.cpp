@@ -0,0 +1,504 @@
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#include "include/simd.h"
+
+using namespace std;
+
+// plain C++, also tails of vector loops
+
+double sumF64Scalar(const double* values, size_t count) {
+    double lanes[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; ++lane) lanes[lane] += values[i + lane];
+    }
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += values[i];
+
+    return sum;
+}
+
+int64_t sumI64Scalar(const int64_t* values, size_t count) {
+    // wraps around like int64 of C++ (done in unsigned to keep it defined)
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) sum += (uint64_t)values[i];
+
+    return (int64_t)sum;
+}
+
+double minF64Scalar(const double* values, size_t count) {
+    double result = values[0];
+    for (size_t i = 1; i < count; ++i) result = values[i] < result ? values[i] : result;
+
+    return result;
+}
+
+double maxF64Scalar(const double* values, size_t count) {
+    double result = values[0];
+    for (size_t i = 1; i < count; ++i) result = values[i] > result ? values[i] : result;
+
+    return result;
+}
+
+int64_t minI64Scalar(const int64_t* values, size_t count) {
+    int64_t result = values[0];
+    for (size_t i = 1; i < count; ++i) result = values[i] < result ? values[i] : result;
+
+    return result;
+}
+
+int64_t maxI64Scalar(const int64_t* values, size_t count) {
+    int64_t result = values[0];
+    for (size_t i = 1; i < count; ++i) result = values[i] > result ? values[i] : result;
+
+    return result;
+}
+
+double dotF64Scalar(const double* left, const double* right, size_t count) {
+    double lanes[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; ++lane) lanes[lane] += left[i + lane] * right[i + lane];
+    }
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += left[i] * right[i];
+
+    return sum;
+}
+
+void scaleF64Scalar(const double* values, double factor, double* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) out[i] = values[i] * factor;
+}
+
+void addF64Scalar(const double* left, const double* right, double* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) out[i] = left[i] + right[i];
+}
+
+void addI64Scalar(const int64_t* left, const int64_t* right, int64_t* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) out[i] = (int64_t)((uint64_t)left[i] + (uint64_t)right[i]);
+}
+
+template <typename T>
+bool compareValues(T left, CompareOp op, T right) {
+    switch (op) {
+        case COMPARE_LT: return left < right;
+        case COMPARE_LE: return left <= right;
+        case COMPARE_GT: return left > right;
+        case COMPARE_GE: return left >= right;
+        case COMPARE_EQ: return left == right;
+        case COMPARE_NE: return left != right;
+    }
+
+    return false;
+}
+
+void compareF64Scalar(const double* values, CompareOp op, double value, double* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) out[i] = compareValues(values[i], op, value) ? 1 : 0;
+}
+
+void compareI64Scalar(const int64_t* values, CompareOp op, int64_t value, int64_t* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) out[i] = compareValues(values[i], op, value) ? 1 : 0;
+}
+
+#ifdef SIMD_X86
+
+// SSE2, part of every x86-64 CPU
+
+double sumF64Sse2(const double* values, size_t count) {
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        low = _mm_add_pd(low, _mm_loadu_pd(values + i));
+        high = _mm_add_pd(high, _mm_loadu_pd(values + i + 2));
+    }
+
+    double lanes[4];
+    _mm_storeu_pd(lanes, low);
+    _mm_storeu_pd(lanes + 2, high);
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += values[i];
+
+    return sum;
+}
+
+int64_t sumI64Sse2(const int64_t* values, size_t count) {
+    __m128i sums = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) sums = _mm_add_epi64(sums, _mm_loadu_si128((const __m128i*)(values + i)));
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+
+    return (int64_t)(lanes[0] + lanes[1] + (uint64_t)sumI64Scalar(values + i, count - i));
+}
+
+double minF64Sse2(const double* values, size_t count) {
+    if (count < 4) return minF64Scalar(values, count);
+
+    __m128d result = _mm_loadu_pd(values);
+    size_t i = 2;
+
+    for (; i + 2 <= count; i += 2) result = _mm_min_pd(_mm_loadu_pd(values + i), result);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, result);
+
+    double tail[3] = { lanes[0], lanes[1], i < count ? values[i] : lanes[0] };
+    return minF64Scalar(tail, 3);
+}
+
+double maxF64Sse2(const double* values, size_t count) {
+    if (count < 4) return maxF64Scalar(values, count);
+
+    __m128d result = _mm_loadu_pd(values);
+    size_t i = 2;
+
+    for (; i + 2 <= count; i += 2) result = _mm_max_pd(_mm_loadu_pd(values + i), result);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, result);
+
+    double tail[3] = { lanes[0], lanes[1], i < count ? values[i] : lanes[0] };
+    return maxF64Scalar(tail, 3);
+}
+
+double dotF64Sse2(const double* left, const double* right, size_t count) {
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        low = _mm_add_pd(low, _mm_mul_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+        high = _mm_add_pd(high, _mm_mul_pd(_mm_loadu_pd(left + i + 2), _mm_loadu_pd(right + i + 2)));
+    }
+
+    double lanes[4];
+    _mm_storeu_pd(lanes, low);
+    _mm_storeu_pd(lanes + 2, high);
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += left[i] * right[i];
+
+    return sum;
+}
+
+void scaleF64Sse2(const double* values, double factor, double* out, size_t count) {
+    __m128d factors = _mm_set1_pd(factor);
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(values + i), factors));
+
+    scaleF64Scalar(values + i, factor, out + i, count - i);
+}
+
+void addF64Sse2(const double* left, const double* right, double* out, size_t count) {
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+
+    addF64Scalar(left + i, right + i, out + i, count - i);
+}
+
+void addI64Sse2(const int64_t* left, const int64_t* right, int64_t* out, size_t count) {
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i*)(left + i)), _mm_loadu_si128((const __m128i*)(right + i)));
+        _mm_storeu_si128((__m128i*)(out + i), sum);
+    }
+
+    addI64Scalar(left + i, right + i, out + i, count - i);
+}
+
+inline __m128d compareSse2(__m128d values, CompareOp op, __m128d value) {
+    switch (op) {
+        case COMPARE_LT: return _mm_cmplt_pd(values, value);
+        case COMPARE_LE: return _mm_cmple_pd(values, value);
+        case COMPARE_GT: return _mm_cmpgt_pd(values, value);
+        case COMPARE_GE: return _mm_cmpge_pd(values, value);
+        case COMPARE_EQ: return _mm_cmpeq_pd(values, value);
+        case COMPARE_NE: return _mm_cmpneq_pd(values, value);
+    }
+
+    return _mm_setzero_pd();
+}
+
+void compareF64Sse2(const double* values, CompareOp op, double value, double* out, size_t count) {
+    __m128d compared = _mm_set1_pd(value);
+    __m128d ones = _mm_set1_pd(1);
+    size_t i = 0;
+
+    // mask of all bits set becomes 1.0
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(out + i, _mm_and_pd(compareSse2(_mm_loadu_pd(values + i), op, compared), ones));
+
+    compareF64Scalar(values + i, op, value, out + i, count - i);
+}
+
+// AVX2, chosen when CPU has it; compiled for it only here, rest of program runs on any x86-64
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 double sumF64Avx2(const double* values, size_t count) {
+    __m256d sums = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) sums = _mm256_add_pd(sums, _mm256_loadu_pd(values + i));
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sums);
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += values[i];
+
+    return sum;
+}
+
+AVX2 int64_t sumI64Avx2(const int64_t* values, size_t count) {
+    __m256i sums = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) sums = _mm256_add_epi64(sums, _mm256_loadu_si256((const __m256i*)(values + i)));
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sums);
+
+    return (int64_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3] + (uint64_t)sumI64Scalar(values + i, count - i));
+}
+
+AVX2 double minF64Avx2(const double* values, size_t count) {
+    if (count < 8) return minF64Scalar(values, count);
+
+    __m256d result = _mm256_loadu_pd(values);
+    size_t i = 4;
+
+    for (; i + 4 <= count; i += 4) result = _mm256_min_pd(_mm256_loadu_pd(values + i), result);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, result);
+
+    double best = minF64Scalar(lanes, 4);
+    if (i == count) return best;
+
+    double rest = minF64Scalar(values + i, count - i);
+    return rest < best ? rest : best;
+}
+
+AVX2 double maxF64Avx2(const double* values, size_t count) {
+    if (count < 8) return maxF64Scalar(values, count);
+
+    __m256d result = _mm256_loadu_pd(values);
+    size_t i = 4;
+
+    for (; i + 4 <= count; i += 4) result = _mm256_max_pd(_mm256_loadu_pd(values + i), result);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, result);
+
+    double best = maxF64Scalar(lanes, 4);
+    if (i == count) return best;
+
+    double rest = maxF64Scalar(values + i, count - i);
+    return rest > best ? rest : best;
+}
+
+AVX2 int64_t minI64Avx2(const int64_t* values, size_t count) {
+    if (count < 8) return minI64Scalar(values, count);
+
+    __m256i result = _mm256_loadu_si256((const __m256i*)values);
+    size_t i = 4;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i next = _mm256_loadu_si256((const __m256i*)(values + i));
+        result = _mm256_blendv_epi8(result, next, _mm256_cmpgt_epi64(result, next));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, result);
+
+    int64_t best = minI64Scalar(lanes, 4);
+    if (i == count) return best;
+
+    int64_t rest = minI64Scalar(values + i, count - i);
+    return rest < best ? rest : best;
+}
+
+AVX2 int64_t maxI64Avx2(const int64_t* values, size_t count) {
+    if (count < 8) return maxI64Scalar(values, count);
+
+    __m256i result = _mm256_loadu_si256((const __m256i*)values);
+    size_t i = 4;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i next = _mm256_loadu_si256((const __m256i*)(values + i));
+        result = _mm256_blendv_epi8(result, next, _mm256_cmpgt_epi64(next, result));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, result);
+
+    int64_t best = maxI64Scalar(lanes, 4);
+    if (i == count) return best;
+
+    int64_t rest = maxI64Scalar(values + i, count - i);
+    return rest > best ? rest : best;
+}
+
+AVX2 double dotF64Avx2(const double* left, const double* right, size_t count) {
+    __m256d sums = _mm256_setzero_pd();
+    size_t i = 0;
+
+    // multiply and add are kept separate (no FMA), so rounding is the same as in other sets
+    for (; i + 4 <= count; i += 4) sums = _mm256_add_pd(sums, _mm256_mul_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sums);
+
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) sum += left[i] * right[i];
+
+    return sum;
+}
+
+AVX2 void scaleF64Avx2(const double* values, double factor, double* out, size_t count) {
+    __m256d factors = _mm256_set1_pd(factor);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), factors));
+
+    scaleF64Scalar(values + i, factor, out + i, count - i);
+}
+
+AVX2 void addF64Avx2(const double* left, const double* right, double* out, size_t count) {
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+
+    addF64Scalar(left + i, right + i, out + i, count - i);
+}
+
+AVX2 void addI64Avx2(const int64_t* left, const int64_t* right, int64_t* out, size_t count) {
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(left + i)), _mm256_loadu_si256((const __m256i*)(right + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), sum);
+    }
+
+    addI64Scalar(left + i, right + i, out + i, count - i);
+}
+
+AVX2 inline __m256d compareAvx2(__m256d values, CompareOp op, __m256d value) {
+    // unordered not-equal, so NaN != x is true like in C++
+    switch (op) {
+        case COMPARE_LT: return _mm256_cmp_pd(values, value, _CMP_LT_OQ);
+        case COMPARE_LE: return _mm256_cmp_pd(values, value, _CMP_LE_OQ);
+        case COMPARE_GT: return _mm256_cmp_pd(values, value, _CMP_GT_OQ);
+        case COMPARE_GE: return _mm256_cmp_pd(values, value, _CMP_GE_OQ);
+        case COMPARE_EQ: return _mm256_cmp_pd(values, value, _CMP_EQ_OQ);
+        case COMPARE_NE: return _mm256_cmp_pd(values, value, _CMP_NEQ_UQ);
+    }
+
+    return _mm256_setzero_pd();
+}
+
+AVX2 void compareF64Avx2(const double* values, CompareOp op, double value, double* out, size_t count) {
+    __m256d compared = _mm256_set1_pd(value);
+    __m256d ones = _mm256_set1_pd(1);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(out + i, _mm256_and_pd(compareAvx2(_mm256_loadu_pd(values + i), op, compared), ones));
+
+    compareF64Scalar(values + i, op, value, out + i, count - i);
+}
+
+AVX2 void compareI64Avx2(const int64_t* values, CompareOp op, int64_t value, int64_t* out, size_t count) {
+    __m256i compared = _mm256_set1_epi64x(value);
+    __m256i ones = _mm256_set1_epi64x(1);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i next = _mm256_loadu_si256((const __m256i*)(values + i));
+        __m256i result;
+
+        // only > and == exist for int64, others are their negations
+        switch (op) {
+            case COMPARE_LT: result = _mm256_and_si256(_mm256_cmpgt_epi64(compared, next), ones); break;
+            case COMPARE_LE: result = _mm256_andnot_si256(_mm256_cmpgt_epi64(next, compared), ones); break;
+            case COMPARE_GT: result = _mm256_and_si256(_mm256_cmpgt_epi64(next, compared), ones); break;
+            case COMPARE_GE: result = _mm256_andnot_si256(_mm256_cmpgt_epi64(compared, next), ones); break;
+            case COMPARE_EQ: result = _mm256_and_si256(_mm256_cmpeq_epi64(next, compared), ones); break;
+            default: result = _mm256_andnot_si256(_mm256_cmpeq_epi64(next, compared), ones); break;
+        }
+
+        _mm256_storeu_si256((__m256i*)(out + i), result);
+    }
+
+    compareI64Scalar(values + i, op, value, out + i, count - i);
+}
+
+#endif
+
+SimdKernels chooseKernels() {
+    SimdKernels kernels = {
+        "scalar",
+        sumF64Scalar, sumI64Scalar,
+        minF64Scalar, maxF64Scalar, minI64Scalar, maxI64Scalar,
+        dotF64Scalar,
+        scaleF64Scalar, addF64Scalar, addI64Scalar,
+        compareF64Scalar, compareI64Scalar,
+    };
+
+#ifdef SIMD_X86
+    // SSE2 has no 64-bit integer compare, so min, max and compare of Int64Array stay scalar
+    kernels.name = "sse2";
+    kernels.sumF64 = sumF64Sse2;
+    kernels.sumI64 = sumI64Sse2;
+    kernels.minF64 = minF64Sse2;
+    kernels.maxF64 = maxF64Sse2;
+    kernels.dotF64 = dotF64Sse2;
+    kernels.scaleF64 = scaleF64Sse2;
+    kernels.addF64 = addF64Sse2;
+    kernels.addI64 = addI64Sse2;
+    kernels.compareF64 = compareF64Sse2;
+
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.name = "avx2";
+        kernels.sumF64 = sumF64Avx2;
+        kernels.sumI64 = sumI64Avx2;
+        kernels.minF64 = minF64Avx2;
+        kernels.maxF64 = maxF64Avx2;
+        kernels.minI64 = minI64Avx2;
+        kernels.maxI64 = maxI64Avx2;
+        kernels.dotF64 = dotF64Avx2;
+        kernels.scaleF64 = scaleF64Avx2;
+        kernels.addF64 = addF64Avx2;
+        kernels.addI64 = addI64Avx2;
+        kernels.compareF64 = compareF64Avx2;
+        kernels.compareI64 = compareI64Avx2;
+    }
+#endif
+#endif
+
+    return kernels;
+}
+
+const SimdKernels& simdKernels() {
+    static const SimdKernels kernels = chooseKernels();
+
+    return kernels;
+}
@@ -0,0 +1,277 @@
+#include <vector>
+#include <memory>
+#include <string>
+#include <typeinfo>
+
+#include "include/fvm.h"
+#include "include/simd.h"
+#include "include/typedArray.h"
+
+using namespace std;
+
+string InstructionFloat64ArrayOperrand::tostring() {
+    string result = "Float64Array: ";
+    for (double element: operrand) result += to_string(element) + " ";
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> InstructionFloat64ArrayOperrand::get(size_t index) {
+    return makePooled<InstructionNumberOperrand>(operrand[index]);
+}
+
+void InstructionFloat64ArrayOperrand::set(size_t index, shared_ptr<InstructionOperrand> value) {
+    if (!isNumberTag(value->tag)) throw runtime_error("FVM: ELEMENT OF Float64Array MUST BE A NUMBER");
+
+    operrand[index] = static_cast<InstructionNumberOperrand*>(value.get())->operrand;
+}
+
+shared_ptr<InstructionTypedArrayOperrand> InstructionFloat64ArrayOperrand::copy(bool frozen) {
+    auto result = makePooled<InstructionFloat64ArrayOperrand>(0);
+    result->operrand = operrand;
+    result->frozen = frozen;
+
+    return result;
+}
+
+string InstructionInt64ArrayOperrand::tostring() {
+    string result = "Int64Array: ";
+    for (int64_t element: operrand) result += to_string(element) + " ";
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> InstructionInt64ArrayOperrand::get(size_t index) {
+    return makePooled<InstructionNumberOperrand>((double)operrand[index]);
+}
+
+void InstructionInt64ArrayOperrand::set(size_t index, shared_ptr<InstructionOperrand> value) {
+    int64_t integer;
+    if (!isNumberTag(value->tag) || !toInteger(value.get(), integer)) throw runtime_error("FVM: ELEMENT OF Int64Array MUST BE AN INTEGER");
+
+    operrand[index] = integer;
+}
+
+shared_ptr<InstructionTypedArrayOperrand> InstructionInt64ArrayOperrand::copy(bool frozen) {
+    auto result = makePooled<InstructionInt64ArrayOperrand>(0);
+    result->operrand = operrand;
+    result->frozen = frozen;
+
+    return result;
+}
+
+template <typename T>
+shared_ptr<InstructionOperrand> makeTypedArray(shared_ptr<InstructionOperrand> from, string name) {
+    if (isNumberTag(from->tag)) {
+        int64_t size;
+        if (!toInteger(from.get(), size) || size < 0) throw runtime_error("FVM: SIZE OF " + name + " MUST BE A NON-NEGATIVE INTEGER");
+
+        return makePooled<T>(size);
+    }
+
+    // other typed array is converted element by element
+    if (auto typed = dynamic_cast<InstructionTypedArrayOperrand*>(from.get())) {
+        auto result = makePooled<T>(typed->size());
+        for (size_t i = 0; i < typed->size(); ++i) result->set(i, typed->get(i));
+
+        return result;
+    }
+
+    auto array = dynamic_pointer_cast<InstructionArrayOperrand>(from);
+    if (!array) throw runtime_error("FVM: " + name + "() EXPECTED SIZE OR ARRAY OF NUMBERS");
+
+    auto result = makePooled<T>(array->operrand->size());
+    for (size_t i = 0; i < array->operrand->size(); ++i) result->set(i, (*array->operrand)[i]);
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> makeFloat64Array(shared_ptr<InstructionOperrand> from) {
+    return makeTypedArray<InstructionFloat64ArrayOperrand>(from, "Float64Array");
+}
+
+shared_ptr<InstructionOperrand> makeInt64Array(shared_ptr<InstructionOperrand> from) {
+    return makeTypedArray<InstructionInt64ArrayOperrand>(from, "Int64Array");
+}
+
+InstructionTypedArrayOperrand* typedArrayOf(shared_ptr<InstructionOperrand> value, string name) {
+    auto array = dynamic_cast<InstructionTypedArrayOperrand*>(value.get());
+    if (!array) throw runtime_error("FVM: " + name + "() EXPECTED Float64Array OR Int64Array");
+
+    return array;
+}
+
+shared_ptr<InstructionOperrand> typedSum(shared_ptr<InstructionOperrand> array) {
+    const SimdKernels& kernels = simdKernels();
+
+    if (auto floats = dynamic_pointer_cast<InstructionFloat64ArrayOperrand>(array)) {
+        return makePooled<InstructionNumberOperrand>(kernels.sumF64(floats->operrand.data(), floats->operrand.size()));
+    }
+
+    auto integers = static_cast<InstructionInt64ArrayOperrand*>(typedArrayOf(array, "sum"));
+
+    return makePooled<InstructionNumberOperrand>((double)kernels.sumI64(integers->operrand.data(), integers->operrand.size()));
+}
+
+shared_ptr<InstructionOperrand> typedMin(shared_ptr<InstructionOperrand> array) {
+    const SimdKernels& kernels = simdKernels();
+
+    if (typedArrayOf(array, "min")->size() == 0) return nullOperrand();
+
+    if (auto floats = dynamic_pointer_cast<InstructionFloat64ArrayOperrand>(array)) {
+        return makePooled<InstructionNumberOperrand>(kernels.minF64(floats->operrand.data(), floats->operrand.size()));
+    }
+
+    auto integers = static_pointer_cast<InstructionInt64ArrayOperrand>(array);
+
+    return makePooled<InstructionNumberOperrand>((double)kernels.minI64(integers->operrand.data(), integers->operrand.size()));
+}
+
+shared_ptr<InstructionOperrand> typedMax(shared_ptr<InstructionOperrand> array) {
+    const SimdKernels& kernels = simdKernels();
+
+    if (typedArrayOf(array, "max")->size() == 0) return nullOperrand();
+
+    if (auto floats = dynamic_pointer_cast<InstructionFloat64ArrayOperrand>(array)) {
+        return makePooled<InstructionNumberOperrand>(kernels.maxF64(floats->operrand.data(), floats->operrand.size()));
+    }
+
+    auto integers = static_pointer_cast<InstructionInt64ArrayOperrand>(array);
+
+    return makePooled<InstructionNumberOperrand>((double)kernels.maxI64(integers->operrand.data(), integers->operrand.size()));
+}
+
+void checkSameShape(shared_ptr<InstructionOperrand> left, shared_ptr<InstructionOperrand> right, string name) {
+    InstructionTypedArrayOperrand* a = typedArrayOf(left, name);
+    InstructionTypedArrayOperrand* b = typedArrayOf(right, name);
+
+    if (typeid(*a) != typeid(*b) || a->size() != b->size()) throw runtime_error("FVM: " + name + "() EXPECTED ARRAYS OF THE SAME TYPE AND LENGTH");
+}
+
+shared_ptr<InstructionOperrand> typedDot(shared_ptr<InstructionOperrand> left, shared_ptr<InstructionOperrand> right) {
+    checkSameShape(left, right, "dot");
+
+    if (auto floats = dynamic_pointer_cast<InstructionFloat64ArrayOperrand>(left)) {
+        auto other = static_pointer_cast<InstructionFloat64ArrayOperrand>(right);
+
+        return makePooled<InstructionNumberOperrand>(simdKernels().dotF64(floats->operrand.data(), other->operrand.data(), floats->operrand.size()));
+    }
+
+    // SIMD has no 64-bit multiply below AVX-512, wraps around like sum
+    Int64Vector& a = static_pointer_cast<InstructionInt64ArrayOperrand>(left)->operrand;
+    Int64Vector& b = static_pointer_cast<InstructionInt64ArrayOperrand>(right)->operrand;
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < a.size(); ++i) sum += (uint64_t)a[i] * (uint64_t)b[i];
+
+    return makePooled<InstructionNumberOperrand>((double)(int64_t)sum);
+}
+
+shared_ptr<InstructionOperrand> typedAdd(shared_ptr<InstructionOperrand> left, shared_ptr<InstructionOperrand> right) {
+    checkSameShape(left, right, "add");
+
+    const SimdKernels& kernels = simdKernels();
+
+    if (auto floats = dynamic_pointer_cast<InstructionFloat64ArrayOperrand>(left)) {
+        auto other = static_pointer_cast<InstructionFloat64ArrayOperrand>(right);
+        auto result = makePooled<InstructionFloat64ArrayOperrand>(floats->operrand.size());
+
+        kernels.addF64(floats->operrand.data(), other->operrand.data(), result->operrand.data(), result->operrand.size());
+
+        return result;
+    }
+
+    auto integers = static_pointer_cast<InstructionInt64ArrayOperrand>(left);
+    auto other = static_pointer_cast<InstructionInt64ArrayOperrand>(right);
+    auto result = makePooled<InstructionInt64ArrayOperrand>(integers->operrand.size());
+
+    kernels.addI64(integers->operrand.data(), other->operrand.data(), result->operrand.data(), result->operrand.size());
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> typedScale(shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> factor) {
+    InstructionTypedArrayOperrand* typed = typedArrayOf(array, "scale");
+    if (!isNumberTag(factor->tag)) throw runtime_error("FVM: scale() EXPECTED NUMBER");
+
+    double k = static_cast<InstructionNumberOperrand*>(factor.get())->operrand;
+    int64_t integer;
+
+    if (auto integers = dynamic_cast<InstructionInt64ArrayOperrand*>(typed)) {
+        if (toInteger(factor.get(), integer)) {
+            auto result = makePooled<InstructionInt64ArrayOperrand>(integers->operrand.size());
+            for (size_t i = 0; i < integers->operrand.size(); ++i) result->operrand[i] = (int64_t)((uint64_t)integers->operrand[i] * (uint64_t)integer);
+
+            return result;
+        }
+
+        auto result = makePooled<InstructionFloat64ArrayOperrand>(integers->operrand.size());
+        for (size_t i = 0; i < integers->operrand.size(); ++i) result->operrand[i] = (double)integers->operrand[i] * k;
+
+        return result;
+    }
+
+    auto floats = static_cast<InstructionFloat64ArrayOperrand*>(typed);
+    auto result = makePooled<InstructionFloat64ArrayOperrand>(floats->operrand.size());
+
+    simdKernels().scaleF64(floats->operrand.data(), k, result->operrand.data(), result->operrand.size());
+
+    return result;
+}
+
+shared_ptr<InstructionOperrand> typedCompare(shared_ptr<InstructionOperrand> array, shared_ptr<InstructionOperrand> op, shared_ptr<InstructionOperrand> value) {
+    InstructionTypedArrayOperrand* typed = typedArrayOf(array, "compare");
+
+    auto symbol = dynamic_pointer_cast<InstructionStringOperrand>(op);
+    if (!symbol) throw runtime_error("FVM: compare() EXPECTED OPERATOR AS STRING");
+
+    string name = symbol->tostring();
+    CompareOp compareOp;
+
+    if (name == "<") compareOp = COMPARE_LT;
+    else if (name == "<=") compareOp = COMPARE_LE;
+    else if (name == ">") compareOp = COMPARE_GT;
+    else if (name == ">=") compareOp = COMPARE_GE;
+    else if (name == "==") compareOp = COMPARE_EQ;
+    else if (name == "!=") compareOp = COMPARE_NE;
+    else throw runtime_error("FVM: UNKNOWN OPERATOR " + name + " FOR compare()");
+
+    if (!isNumberTag(value->tag)) throw runtime_error("FVM: compare() EXPECTED NUMBER");
+
+    double compared = static_cast<InstructionNumberOperrand*>(value.get())->operrand;
+    const SimdKernels& kernels = simdKernels();
+
+    if (auto floats = dynamic_cast<InstructionFloat64ArrayOperrand*>(typed)) {
+        auto result = makePooled<InstructionFloat64ArrayOperrand>(floats->operrand.size());
+        kernels.compareF64(floats->operrand.data(), compareOp, compared, result->operrand.data(), result->operrand.size());
+
+        return result;
+    }
+
+    auto integers = static_cast<InstructionInt64ArrayOperrand*>(typed);
+    auto result = makePooled<InstructionInt64ArrayOperrand>(integers->operrand.size());
+
+    int64_t integer;
+    if (toInteger(value.get(), integer)) {
+        kernels.compareI64(integers->operrand.data(), compareOp, integer, result->operrand.data(), result->operrand.size());
+    } else {
+        // fraction is compared with every element as number
+        for (size_t i = 0; i < integers->operrand.size(); ++i) {
+            double element = integers->operrand[i];
+            bool matched = false;
+
+            switch (compareOp) {
+                case COMPARE_LT: matched = element < compared; break;
+                case COMPARE_LE: matched = element <= compared; break;
+                case COMPARE_GT: matched = element > compared; break;
+                case COMPARE_GE: matched = element >= compared; break;
+                case COMPARE_EQ: matched = element == compared; break;
+                case COMPARE_NE: matched = element != compared; break;
+            }
+
+            result->operrand[i] = matched;
+        }
+    }
+
+    return result;
+}
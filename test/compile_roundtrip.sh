@@ -0,0 +1,33 @@
+#!/bin/sh
+# compiles every test script with --compile and checks that the .fmc prints the same as the source
+# usage: test/compile_roundtrip.sh [path/to/femic.out]
+
+femic=${1:-./femic.out}
+dir=$(mktemp -d)
+failed=0
+
+for script in test/*.fmr; do
+    name=$(basename "$script" .fmr)
+
+    if ! "$femic" --compile -o "$dir/$name.fmc" "$script" > "$dir/$name.log" 2>&1; then
+        echo "FAIL $script: cannot compile"
+        cat "$dir/$name.log"
+        failed=1
+        continue
+    fi
+
+    "$femic" "$script" > "$dir/$name.source" 2>&1
+    "$femic" "$dir/$name.fmc" 2>&1 | sed "s#$dir/$name.fmc#$script#" > "$dir/$name.compiled"
+
+    if ! cmp -s "$dir/$name.source" "$dir/$name.compiled"; then
+        echo "FAIL $script: output of compiled file differs"
+        diff "$dir/$name.source" "$dir/$name.compiled" | head -10
+        failed=1
+    fi
+done
+
+rm -rf "$dir"
+
+if [ $failed -eq 0 ]; then echo "compile roundtrip ok"; fi
+
+exit $failed